@@ -0,0 +1,105 @@
+#ifndef STM_BASIS_H
+#define STM_BASIS_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	basis.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Covariate basis of the rate polynomials
+	Each rate is a logit-linear function of an intercept plus one polynomial of the given
+	degree in each environmental variable (no interactions), so a basis with numVariables
+	variables has 1 + numVariables * degree terms. Term 0 is the intercept, and term
+	1 + (p - 1) * numVariables + v is the polynomial of degree p in variable v; with two
+	variables and degree 3 the terms are 1, env1, env2, env1^2, env2^2, env1^3, env2^3
+
+	The polynomial of degree p in a variable is P_p(x) / scale_p, where P_0 = 1 and
+		P_p+1(x) = (x - alpha_p) * P_p(x) - beta_p * P_p-1(x)
+	so that one set of coefficients gives each type of basis:
+		Raw: alpha = beta = 0 and scale = 1, i.e., the powers of x
+		Centred: alpha_p is the mean of x, beta = 0 and scale_p = sd^p, i.e., the powers
+			of the standardized x
+		Orthogonal: the coefficients of the Stieltjes procedure, so that the polynomials
+			are orthogonal over the transitions (weighted by multiplicity), with unit mean
+			square; like R's poly(). Raw powers are strongly collinear, and so are their
+			coefficients in the posterior; the orthogonal terms are not
+
+	fit(env, numVariables, weight) computes the coefficients from the data (env holds
+	numVariables values per row), once, when the transitions are loaded. terms(x, out)
+	gives the num_terms() terms for the numVariables values in x. Whatever the basis,
+	raw_coefficients(coef, raw) gives the coefficients of the same polynomial in the raw
+	powers of the variables, for output
+*/
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace STMInput
+{
+	class SerializationData;
+}
+
+namespace STMModel {
+
+enum class BasisType
+{
+	Raw=0,
+	Centred=1,
+	Orthogonal=2
+};
+
+
+class CovariateBasis
+{
+	public:
+	CovariateBasis(BasisType type = BasisType::Raw, size_t degree = 3);
+	CovariateBasis(const STMInput::SerializationData & sd);
+
+	void fit(const std::vector<double> & env, size_t numVariables,
+			const std::vector<double> & weight);
+	bool fitted() const { return numVariables > 0; }
+	BasisType type() const { return basisType; }
+	size_t degree() const { return polyDegree; }
+	size_t num_variables() const { return numVariables; }
+	size_t num_terms() const { return 1 + numVariables * polyDegree; }
+	void terms(const double * x, double * out) const;
+	void raw_coefficients(const double * coef, double * raw) const;
+	std::string serialize(char sep) const;
+
+	static BasisType type_from_name(const std::string & name);	// throws runtime_error
+	static std::string type_name(BasisType type);
+
+	private:
+	void setup_raw_map();
+
+	BasisType basisType;
+	size_t polyDegree;
+	size_t numVariables;
+	// recurrence of each variable: [v * polyDegree + p], p = 0 ... degree - 1
+	std::vector<double> alpha, beta;
+	std::vector<double> scale;		// scale of P_p+1, same layout
+	// coefficient of x^q in the polynomial of degree p of variable v:
+	// [(v * (polyDegree + 1) + p) * (polyDegree + 1) + q]
+	std::vector<double> rawMap;
+};
+
+} // !STMModel namespace
+
+#endif
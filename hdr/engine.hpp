@@ -5,6 +5,7 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <string>
 #include "output.hpp"
 #include "parameters.hpp"
 #include "stmtypes.hpp"
@@ -29,6 +30,98 @@ enum class EngineOutputLevel {
 };
 
 
+/*
+	The sampler used by Metropolis (option -j):
+		Metropolis: one parameter at a time, each with its own tuned sampler variance
+		AdaptiveMetropolis: the coefficients of each rate are proposed together as a 
+			block, from a multivariate normal whose covariance is learned from the chain 
+			(see ProposalBlock); a block is updated with a single likelihood evaluation
+		NUTS, NUTSDense: the no-U-turn sampler, with a diagonal or a dense mass matrix; 
+			see nuts.hpp
+		MALA: joint proposals along the gradient of the log posterior; see mala.hpp
+		Tempering: Metropolis chains at a ladder of temperatures, exchanging their
+			states; see tempering.hpp
+		Ensemble: the affine-invariant ensemble sampler, with stretch moves; see 
+			ensemble.hpp
+	Use make_engine (engines.hpp) to build the engine of a sampler
+*/
+enum class SamplerType {
+	Metropolis = 0,
+	AdaptiveMetropolis = 1,
+	NUTS = 2,
+	NUTSDense = 3,
+	MALA = 4,
+	Tempering = 5,
+	Ensemble = 6
+};
+
+// throws std::runtime_error if name is not one of metropolis, adaptive, nuts, nuts-dense,
+// mala, tempering, ensemble
+SamplerType sampler_from_name(const std::string & name);
+
+// in-place Cholesky factorization of the symmetric positive definite d by d matrix a
+// (row major); the lower triangle is replaced by the factor, and the upper is zeroed.
+// Returns false if a is not positive definite
+bool cholesky_factor(size_t d, std::vector<double> & a);
+
+// the covariance S of the n samples of d values, shrunk towards 1e-3 I as in Stan: 
+// n / (n + 5) S + 1e-3 * 5 / (n + 5) I, with only the variances of S unless dense. If 
+// n >= 2 and the result is positive definite, sets cov to it and factor to its Cholesky
+// factor and returns true; otherwise leaves them unchanged
+bool shrunk_covariance(size_t d, const std::vector<std::vector<double> > & samples, 
+		bool dense, std::vector<double> & cov, std::vector<double> & factor);
+
+
+/*
+	A block of parameters proposed jointly by the adaptive Metropolis sampler (Haario et
+	al. 2001, Bernoulli 7:223). add_sample(values) adds the block's values to the running
+	mean and covariance C of the chain (Welford's algorithm); refresh() recomputes the 
+	Cholesky factor of the proposal covariance (2.38^2 / d) (C + epsilon I) for a block
+	of d parameters, where epsilon is a small fraction of the mean variance, and 
+	propose(rng, values) adds a jump drawn with that covariance to the block's values. 
+	ready() is false until the block has enough samples for C to be meaningful. During
+	adaptation, the proposal covariance is further multiplied by scale(), which the 
+	engine tunes from the block's acceptance rate as it does the sampler variances
+*/
+class ProposalBlock
+{
+	public:
+	ProposalBlock(const std::string & label, const std::vector<STM::ParName> & names,
+			const std::vector<size_t> & index);
+	void add_sample(const STM::ParVector & values);
+	void refresh();
+	bool ready() const { return not cholesky.empty(); }
+	int num_samples() const { return numSamples; }
+	double scale() const { return proposalScale; }
+	void set_scale(double s) { proposalScale = s; }
+	void propose(gsl_rng * rng, STM::ParVector & values) const;
+	const std::string & label() const { return blockLabel; }
+	const std::vector<STM::ParName> & names() const { return parNames; }
+	const std::vector<size_t> & index() const { return parIndex; }
+	std::string serialize(char sep) const;
+	void unserialize(const STMInput::SerializationData & sd);
+
+	private:
+	std::string blockLabel;
+	std::vector<STM::ParName> parNames;
+	std::vector<size_t> parIndex;			// position of each parameter in the vector
+	int numSamples;
+	double proposalScale;
+	std::vector<double> mean;
+	std::vector<double> sumSquares;			// of deviations from the mean, d by d
+	std::vector<double> cholesky;			// lower triangle, row major; empty if not ready
+};
+
+
+/*
+	Metropolis runs the sampler and handles everything around it: adaptation, burnin, 
+	thinning, the output of the samples, DIC and the resume data. Other samplers derive
+	from it and replace the sampling itself: auto_adapt() (the adaptation phase, run 
+	until adapted()), do_sample(n, saveDeviance) (n samples, each recorded with 
+	save_sample()) and serialize() (their own resume data, after Metropolis's). The 
+	likelihood is raised to the power inverseTemperature, which is 1 except in the hot 
+	chains of parallel tempering (see tempering.hpp)
+*/
 class Metropolis
 {
 	public:
@@ -37,30 +130,51 @@ class Metropolis
 			const lhood, EngineOutputLevel outLevel = EngineOutputLevel::Normal, 
 			STMOutput::OutputOptions outOpt = STMOutput::OutputOptions(),
 			int thin = 1, int burnin = 0, bool doDIC = false, 
-			bool rngSetSeed = false, int rngSeed = 0);
+			bool rngSetSeed = false, int rngSeed = 0, 
+			SamplerType sampler = SamplerType::Metropolis);
 	Metropolis(std::map<std::string, STMInput::SerializationData> & sd, 
 			STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue);
 //	Metropolis(const Metropolis & m);
 //	Metropolis & operator= (const Metropolis &m);
-// 	~Metropolis();
+	virtual ~Metropolis() {}
 	void run_sampler(int n);
 
+	protected:
+	virtual void auto_adapt();
+	virtual bool adapted() const { return parameters.adapted(); }
+	virtual std::map<std::string, double> do_sample(int n, bool saveDeviance = false);
+	virtual std::string serialize(char sep) const;
+	void save_sample(bool saveDeviance);
+	void serialize_all() const;
+	static std::string timestamp();
+	virtual void set_up_rng();
+	// the log posterior of params (-INFINITY if it is not a number), and its gradient 
+	// with respect to the parameters at index (positions in params.values())
+	double log_posterior_gradient(const STMParameters::STModelParameters & params,
+			const std::vector<size_t> & index, std::vector<double> & gradient, 
+			double & logLikelihood) const;
+	// positions of the active parameters in parameters.values(), and their values
+	std::vector<size_t> active_index() const;
+	std::vector<double> active_values(const std::vector<size_t> & index) const;
+	// the adaptation is not included in the burnin period: restarts the iterations, with
+	// the parameters at index where the adaptation left them (values)
+	void restart_iterations(const std::vector<size_t> & index, 
+			const std::vector<double> & values);
+
 	private:
 	// private functions
-	void auto_adapt();
-	std::map<std::string, double> do_sample(int n, bool saveDeviance = false);
 	STM::ParPair propose_parameter(const 
 			STM::ParName & par) const;
 	int select_parameter(const STM::ParPair & p);
+	int select_block(const ProposalBlock & block);
+	void setup_blocks();
+	void update_blocks();
 	double log_posterior_prob(const double logl, const STM::ParPair & pair) const;
-	void set_up_rng();
-	void serialize_all() const;
-	std::string serialize(char sep) const;
 	static std::string version();
 	void regression_adapt(int numSteps, int stepSize);
 	void prepare_deviance();
 
-	
+	protected:
 	// pointers to objects that the engine doesn't own, but that it uses
 	STMOutput::OutputQueue * outputQueue;
 	STMLikelihood::Likelihood * likelihood;
@@ -74,6 +188,9 @@ class Metropolis
 	double currentLL;
 	std::pair<double, int> DBar;			// the mean deviance along with the sample size
 	std::pair<STM::ParMap, int> thetaBar;	// parameter means with sample size
+	std::vector<ProposalBlock> blocks;		// adaptive Metropolis only
+	std::map<STM::ParName, double> proposalScale;	// of the sampler variances (1 if not
+													// set); the hot chains of tempering
 
 	// settings
 	int outputBufferSize;
@@ -87,11 +204,14 @@ class Metropolis
 	unsigned long int rngSeed;
 	EngineOutputLevel outputLevel;
 	STMOutput::OutputOptions posteriorOptions;
+	SamplerType samplerType;
+	double inverseTemperature;
 	
 	// data that do not need to be saved in resumeData
 	std::vector<std::pair<double, int> > sampleDeviance;
 	std::vector<STM::ParMap> currentSamples;
 	bool saveResumeData;
+	bool adaptBlocks;		// the block covariances are learned during adaptation and burnin
 };
 
 } // namespace
@@ -0,0 +1,54 @@
+#ifndef STM_ENGINES_H
+#define STM_ENGINES_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	engines.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The samplers available at run time
+	make_engine builds the engine of a sampler (Metropolis, or one of the engines that 
+	derive from it), either from scratch or from the resume data, where the sampler is
+	the one that was saved. The caller owns the result. Parallel tempering needs a 
+	likelihood for each of its hot chains as well, in replicaLikelihoods (the other 
+	samplers ignore them); num_likelihoods(sd) is the number of likelihoods, including 
+	lhood, that the engine saved in sd needs
+*/
+
+#include <vector>
+#include <string>
+#include <map>
+#include "engine.hpp"
+
+namespace STMEngine
+{
+	Metropolis * make_engine(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+			EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, 
+			int burnin, bool doDIC, bool rngSetSeed, int rngSeed, SamplerType sampler,
+			const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods = 
+			std::vector<STMLikelihood::Likelihood *>());
+	Metropolis * make_engine(std::map<std::string, STMInput::SerializationData> & sd,
+			STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue,
+			const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods = 
+			std::vector<STMLikelihood::Likelihood *>());
+	size_t num_likelihoods(const std::map<std::string, STMInput::SerializationData> & sd);
+}
+
+#endif
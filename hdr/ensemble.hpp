@@ -0,0 +1,72 @@
+#ifndef STM_ENSEMBLE_H
+#define STM_ENSEMBLE_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	ensemble.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The affine-invariant ensemble sampler (Goodman and Weare 2010, CAMCoS 5:65), option
+	-j ensemble: K = 2 (d + 1) walkers over the d active parameters, updated by stretch
+	moves, every walker saved at each iteration (K rows per iteration)
+*/
+
+#include <vector>
+#include "engine.hpp"
+
+namespace STMEngine {
+
+class Ensemble : public Metropolis
+{
+	public:
+	Ensemble(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+			EngineOutputLevel outLevel = EngineOutputLevel::Normal,
+			STMOutput::OutputOptions outOpt = STMOutput::OutputOptions(),
+			int thin = 1, int burnin = 0, bool doDIC = false, bool rngSetSeed = false,
+			int rngSeed = 0);
+	Ensemble(std::map<std::string, STMInput::SerializationData> & sd,
+			STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue);
+
+	protected:
+	// the stretch moves are unchanged by any affine transformation of the parameters, so
+	// there are no proposal variances to adapt; the burnin lets the walkers spread out
+	void auto_adapt() override {}
+	bool adapted() const override { return true; }
+	std::map<std::string, double> do_sample(int n, bool saveDeviance = false) override;
+	std::string serialize(char sep) const override;
+
+	private:
+	STMParameters::STModelParameters walker_parameters(const std::vector<double> & x) const;
+	std::vector<double> log_posterior(const std::vector<std::vector<double> > & x,
+			std::vector<double> & logLikelihood) const;
+	void start_walkers();
+	int update_half(size_t half);
+	void save_walkers(bool saveDeviance);
+
+	std::vector<size_t> activeIndex;		// positions of the active parameters
+	std::vector<std::vector<double> > walkers;	// K by d; empty until the first sample
+	std::vector<double> walkerPosterior, walkerLL;
+
+	static const double stretchScale;		// a
+};
+
+} // namespace
+
+#endif
@@ -46,16 +46,24 @@ namespace STMInput {
 template<typename T> T str_convert(const std::string &s);
 template<typename T> std::vector<T> str_convert(const std::vector<std::string> & sv);
 
+/*
+	Reads one input file of the given type. Reading transitions requires the state model,
+	which gives the valid states and the names of the prevalence columns
+*/
 class STMInputHelper
 {
 	public:
 	STMInputHelper (const char * filename, InputType type, char delim = ',');
+	STMInputHelper (const char * filename, InputType type, 
+			const STMModel::ModelDescription & model, char delim = ',');
 	std::vector<STMParameters::ParameterSettings> parameter_inits();
 	std::map<std::string, STMLikelihood::PriorDist> priors();
 	std::vector<STMModel::STMTransition> transitions();
+	size_t compact_transitions();
 	std::map<std::string, STMInput::SerializationData> resume_data() const;
 	
 	private:
+	void read_file(const char * filename, InputType type, char delim);
 	void setup_transitions(const char * filename, char delim);
 	void setup_parameters (const char * filename, char delim);
 	void setup_resume(const char * filename);
@@ -74,6 +82,7 @@ class STMInputHelper
 	std::vector<STMParameters::ParameterSettings> initialValues;
 	std::map<std::string, STMLikelihood::PriorDist> priorDists;
 	std::vector<STMModel::STMTransition> trans;
+	const STMModel::ModelDescription * model;
 	std::string prevalenceBaseName;
 	std::map<std::string, STMInput::SerializationData> resumeData;
 };
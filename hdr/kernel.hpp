@@ -0,0 +1,89 @@
+#ifndef STM_KERNEL_H
+#define STM_KERNEL_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	kernel.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Vectorized batch functions for the likelihood
+	Each function processes n consecutive values. The same source (src/kernel_isa.cpp)
+	is compiled once for each supported instruction set, and kernel() returns the
+	best version for the CPU the program is running on, chosen on the first call.
+
+	interval_rates(logit, ratio, n, rate)
+		rate = 1 - (1 - inv_logit(logit))^ratio; i.e., the probability of a rate event
+		over ratio time steps, given its logit over a single time step. The ratio is the
+		same for all n values; when it is 1, rate = inv_logit(logit), computed without 
+		the power
+	interval_rates_gradient(logit, ratio, n, rate, slope)
+		the same rates, and slope = d rate / d logit = ratio * inv_logit(logit) * (1 - rate)
+	update_logits(logit, delta, term, n, result)
+		result = logit + delta * term
+	multiply(a, lda, n, inner, b, numColumns, c)
+		the matrix product c = a * b, where a is n by inner (column-major, with leading 
+		dimension lda), b is inner by numColumns and c is n by numColumns (both 
+		column-major and contiguous); meant for small inner and n of about chunkSize, 
+		so that the rows of a stay in cache while they are used for every column of b
+	transpose_multiply(a, lda, n, inner, x, c)
+		c += a' * x, where a is n by inner as in multiply and x has n values, so that c 
+		gets one sum per column of a; used for the gradient with respect to the 
+		coefficients of a rate, given the gradient with respect to its logits
+	sum_log(lik, weight, n)
+		the sum of weight * log(lik); lik values of exactly 0 or 1 are moved to the
+		nearest representable value inside (0, 1) first
+
+	update_logits_single, multiply_single, transpose_multiply_single and sum_log_single 
+	are the same functions for
+	a term, design matrix or weight stored in single precision (see 
+	STMModel::TransitionTable); each value is converted to double as it is loaded, so 
+	the results and all of the arithmetic are in double precision
+*/
+
+#include <cstddef>
+
+namespace STMKernel {
+
+struct Kernel
+{
+	const char * name;
+	void (*interval_rates)(const double * logit, double ratio, size_t n, double * rate);
+	void (*interval_rates_gradient)(const double * logit, double ratio, size_t n, 
+			double * rate, double * slope);
+	void (*update_logits)(const double * logit, double delta, const double * term,
+			size_t n, double * result);
+	void (*multiply)(const double * a, size_t lda, size_t n, size_t inner, const double * b,
+			size_t numColumns, double * c);
+	void (*transpose_multiply)(const double * a, size_t lda, size_t n, size_t inner,
+			const double * x, double * c);
+	double (*sum_log)(const double * lik, const double * weight, size_t n);
+	void (*update_logits_single)(const double * logit, double delta, const float * term,
+			size_t n, double * result);
+	void (*multiply_single)(const float * a, size_t lda, size_t n, size_t inner, 
+			const double * b, size_t numColumns, double * c);
+	void (*transpose_multiply_single)(const float * a, size_t lda, size_t n, size_t inner,
+			const double * x, double * c);
+	double (*sum_log_single)(const double * lik, const float * weight, size_t n);
+};
+
+const Kernel & kernel();
+
+} // !STMKernel namespace
+
+#endif
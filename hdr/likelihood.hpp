@@ -29,7 +29,10 @@
 
 #include <vector>
 #include <map>
+#include <memory>
+#include <functional>
 #include "model.hpp"
+#include "threadpool.hpp"
 #include "stmtypes.hpp"
 
 // forward declarations
@@ -60,24 +63,208 @@ struct PriorDist {
 };
 
 
+/*
+	Likelihood holds everything that does not depend on the state model (the transition 
+	table, caches, threads and priors); the per-chunk computation is the pure virtual 
+	chunk_log_likelihood, implemented by ModelLikelihood<Model> for each model policy 
+	class (see model_2s.hpp and model_4s.hpp), so that the transition probabilities of 
+	each model are compiled with its constant numbers of rates and states. The likelihood
+	of each block of transitions is cached for the current state of the sampler, and is
+	computed by a persistent pool of numThreads workers, each owning a fixed slice of
+	every block. Use make_likelihood (models.hpp) to build the likelihood of a model
+	chosen at run time
+*/
 class Likelihood {
 	public:
-  	Likelihood(const std::vector<STMModel::STMTransition> & transitionData,
+  	Likelihood(const STMModel::ModelDescription & model,
+  			const std::vector<STMModel::STMTransition> & transitionData,
   			const std::string & transitionDataOriginFile,
   			const std::map<std::string, PriorDist> & pr, unsigned int numThreads = 8,
-  			int parameterInterval = 1);
-	Likelihood(STMInput::SerializationData sd, const std::vector<std::string> &parNames,
-			const std::vector<STMModel::STMTransition> & transitionData);
+  			int parameterInterval = 1, 
+  			STM::PrevalenceModelTypes prevModel = STM::PrevalenceModelTypes::Empirical,
+  			const STMModel::CovariateBasis & basis = STMModel::CovariateBasis(),
+  			bool singlePrecision = false, 
+  			STMModel::RowOrder order = STMModel::RowOrder::Locality, 
+  			bool exactIntervals = false, unsigned int firstCpu = 0);
+	Likelihood(const STMModel::ModelDescription & model, const STMInput::SerializationData & sd, 
+			const std::vector<std::string> &parNames,
+			const std::vector<STMModel::STMTransition> & transitionData, 
+			unsigned int firstCpu = 0);
+	virtual ~Likelihood() {}
+	// the full likelihood of params, without affecting the cached state; of K parameter
+	// sets, from a single pass over the transitions
 	double compute_log_likelihood(const STMParameters::STModelParameters & params);
+	std::vector<double> compute_log_likelihood(
+			const std::vector<STMParameters::STModelParameters> & params);
+	// recomputes and caches the likelihood of params
+	double reset_log_likelihood(const STMParameters::STModelParameters & params);
+	// the likelihood of proposal, which differs from the cached state only in the
+	// parameter at position par, or in pars, which must all be coefficients of the same
+	// rate (or unused by the model); only the blocks that depend on them are evaluated
+	double propose_log_likelihood(const STMParameters::STModelParameters & proposal, 
+			size_t par);
+	double propose_log_likelihood(const STMParameters::STModelParameters & proposal, 
+			const std::vector<size_t> & pars);
+	// the rate of which the parameter at position par of params is a coefficient; false 
+	// if the model does not use it
+	bool parameter_rate(const STMParameters::STModelParameters & params, size_t par, 
+			size_t & rate);
+	// make the most recent proposal the cached state, or discard it
+	void accept_proposal();
+	void reject_proposal();
+	// true if the cached state is that of params, so that a reset would not change it
+	bool is_current(const STMParameters::STModelParameters & params) const;
 	double log_prior(const std::pair<std::string, double> & param) const;
+
+	// compute_log_likelihood(params), and its derivative with respect to each parameter
+	// (0 for those the model does not use) from the same pass; not with exact intervals
+	double compute_log_likelihood_and_gradient(const STMParameters::STModelParameters & params,
+			STM::ParVector & gradient);
+	double log_prior_gradient(const std::pair<std::string, double> & param) const;
+	// the sums of the workers are added in worker order by default, so that the result
+	// changes in the last bits with the number of threads; reproducible sums add the
+	// chunks in a fixed pairwise tree with compensated additions instead, bit-identical
+	// for any number of threads (-x). Applies to the gradient as well
+	void set_reproducible(bool r) { reproducible = r; }
+	// false: the rows and cached logits are placed by the calling thread rather than by
+	// their workers (see STMModel::TransitionTable::place_rows); for the cached logits,
+	// only before the first reset_log_likelihood
+	void set_first_touch(bool f);
+	bool is_reproducible() const { return reproducible; }
+	unsigned int num_threads() const { return pool->size(); }
+	const STMModel::ModelDescription & model_description() const 
+	{ return transitions.model_description(); }
 	std::string serialize(char s, const std::vector<STM::ParName> & parNames) const;
 
+	// the rate coefficients of sample (in the covariate basis, see basis.hpp) in the raw
+	// powers of the environmental variables, for output; other parameters are copied
+	STM::ParMap raw_scale(const STM::ParMap & sample) const;
+
+	protected:
+	// sum of the log likelihood of the n <= STMModel::chunkSize transitions starting at 
+	// begin, given the logits of each rate; see STMModel::TransitionTable::log_likelihood
+	virtual double chunk_log_likelihood(size_t begin, size_t n, 
+			const STM::ParValue * const * logits, const STM::ParValue * cellPrev) const = 0;
+	// equilibrium prevalence of cells [begin, begin + n); see 
+	// STMModel::TransitionTable::equilibrium_prevalence
+	virtual void cell_prevalence(size_t begin, size_t n, const double * coef, bool warm,
+			STM::ParValue * prev) const = 0;
+	// the same, with derivatives; see STMModel::TransitionTable::log_likelihood_gradient
+	// and STMModel::TransitionTable::equilibrium_gradient
+	virtual double chunk_log_likelihood_gradient(size_t begin, size_t n, 
+			const STM::ParValue * const * logits, const STM::ParValue * cellPrev,
+			STM::ParValue * const * dLogit, STM::ParValue * dPrev) const = 0;
+	virtual void cell_prevalence_gradient(size_t begin, size_t n, const double * coef,
+			const STM::ParValue * prev, const STM::ParValue * cellDPrev, double * grad) 
+			const = 0;
+	// transition matrices of matrix cells [begin, begin + n) with exact intervals; see
+	// STMModel::TransitionTable::interval_matrices
+	virtual void cell_matrices(size_t begin, size_t n, const double * coef, 
+			const STM::ParValue * cellPrev, STM::ParValue * matrices) const = 0;
+
+	STMModel::TransitionTable transitions;
+	unsigned int targetInterval;
+
 	private:
-	std::vector<STMModel::STMTransition> transitions;
+	struct LogitUpdate
+	{
+		size_t rate;
+		std::vector<double> delta;		// change in the coefficient of each term
+		std::vector<size_t> term;
+	};
+	typedef std::function<void(size_t, size_t, double *)> SliceFunction;
+	void setup_threads();
+	void sum_blocks(const std::vector<size_t> & blocks, size_t width, 
+			std::vector<double> & blockSums, const SliceFunction & sliceSum);
+	double sum_log_likelihood(size_t begin, size_t end, const LogitUpdate * update = nullptr);
+	double cache_log_likelihood(size_t begin, size_t end);
+	double compute_slice(size_t begin, size_t end, const STM::ParVector & par, 
+			const STM::ParValue * cellPrev) const;
+	void compute_batch_slice(size_t begin, size_t end, const std::vector<double> & coef, 
+			size_t numSets, const STM::ParValue * cellPrev, double * sums) const;
+	void gradient_slice(size_t begin, size_t end, const STM::ParVector & par, 
+			const STM::ParValue * cellPrev, STM::ParValue * dPrev, double * sums) const;
+	bool uses_cells() const { return transitions.num_cells() > 0; }
+	bool uses_matrices() const { return transitions.exact_intervals(); }
+	double matrix_slice(size_t begin, size_t end, const STM::ParValue * matrices) const;
+	void compute_matrices(const STM::ParVector & par, const STM::ParValue * cellPrev, 
+			std::vector<STM::ParValue> & matrices);
+	void compute_prevalence(const STM::ParVector & par, bool warm, 
+			std::vector<STM::ParValue> & prev);
+	void compute_prevalence(const double * coef, bool warm, STM::ParValue * prev);
+	void check_parameter_layout(const STMParameters::STModelParameters & params);
+
+	std::vector<double> blockLogLik;			// cached likelihood of each block
+	std::vector<double> proposalBlockLogLik;
+	STM::ParVector currentPars;
+	// cached logits, stored by rate. The rows of rate r are only current in the blocks
+	// that depend on r (TransitionTable::dependent_blocks): accept_proposal copies the
+	// proposal's logits of those blocks only. Other blocks still convert the stale rows
+	// to rates, but none of their types of transition uses them
+	STMThreads::FirstTouchVector<double> logits;
+	STMThreads::FirstTouchVector<double> proposalLogits;	// of the rate changed by the 
+															// proposal
+	std::vector<size_t> proposalPars;
+	size_t proposalRate;
+	std::vector<size_t> proposalBlocks;			// blocks that depend on proposalRate
+	STM::ParVector proposalValues;
+	std::vector<STM::ParValue> cellPrevalence;			// analytical prevalence of each cell
+	std::vector<STM::ParValue> proposalCellPrevalence;
+	std::vector<STM::ParValue> intervalMatrices;		// with exact intervals, in place of 
+	std::vector<STM::ParValue> proposalIntervalMatrices;	// the logits
 	std::map<std::string, PriorDist> priors;
 	unsigned int likelihoodThreads;
+	unsigned int firstCpu;					// of the pool; see STMThreads::ThreadPool
+	std::unique_ptr<STMThreads::ThreadPool> pool;
+	std::vector<size_t> allBlocks;
+	std::vector<size_t> sliceOffset;		// block b, worker w: [b * (numThreads + 1) + w]
+	std::vector<double> partialSums;		// per worker, see sum_blocks
+	bool reproducible;
+	bool firstTouch;
+	std::vector<size_t> chunkOffset;		// index of the first chunk of each block
+	std::vector<double> chunkSums;			// reproducible mode only
 	std::string transitionFileName;		// from where did the transition data originate?
-	unsigned int targetInterval;
+};
+
+
+template<class Model>
+class ModelLikelihood : public Likelihood
+{
+	public:
+  	ModelLikelihood(const std::vector<STMModel::STMTransition> & transitionData,
+  			const std::string & transitionDataOriginFile,
+  			const std::map<std::string, PriorDist> & pr, unsigned int numThreads,
+  			int parameterInterval, STM::PrevalenceModelTypes prevModel,
+  			const STMModel::CovariateBasis & basis, bool singlePrecision, 
+  			STMModel::RowOrder order, bool exactIntervals, unsigned int firstCpu) : 
+  			Likelihood(Model::description(), transitionData, transitionDataOriginFile, pr,
+  			numThreads, parameterInterval, prevModel, basis, singlePrecision, order, 
+  			exactIntervals, firstCpu) {}
+	ModelLikelihood(const STMInput::SerializationData & sd, const std::vector<std::string> &parNames,
+			const std::vector<STMModel::STMTransition> & transitionData, unsigned int firstCpu) :
+			Likelihood(Model::description(), sd, parNames, transitionData, firstCpu) {}
+
+	protected:
+	double chunk_log_likelihood(size_t begin, size_t n, const STM::ParValue * const * logits, 
+			const STM::ParValue * cellPrev) const override
+	{ return transitions.template log_likelihood<Model>(begin, n, logits, cellPrev); }
+	void cell_prevalence(size_t begin, size_t n, const double * coef, bool warm,
+			STM::ParValue * prev) const override
+	{ transitions.template equilibrium_prevalence<Model>(begin, n, coef, warm, prev); }
+	double chunk_log_likelihood_gradient(size_t begin, size_t n, 
+			const STM::ParValue * const * logits, const STM::ParValue * cellPrev,
+			STM::ParValue * const * dLogit, STM::ParValue * dPrev) const override
+	{ 
+		return transitions.template log_likelihood_gradient<Model>(begin, n, logits, 
+				cellPrev, dLogit, dPrev); 
+	}
+	void cell_prevalence_gradient(size_t begin, size_t n, const double * coef,
+			const STM::ParValue * prev, const STM::ParValue * cellDPrev, double * grad) const 
+			override
+	{ transitions.template equilibrium_gradient<Model>(begin, n, coef, prev, cellDPrev, grad); }
+	void cell_matrices(size_t begin, size_t n, const double * coef, 
+			const STM::ParValue * cellPrev, STM::ParValue * matrices) const override
+	{ transitions.template interval_matrices<Model>(begin, n, coef, cellPrev, matrices); }
 };
 
 } // !STMLikelihood namespace
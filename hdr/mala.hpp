@@ -0,0 +1,74 @@
+#ifndef STM_MALA_H
+#define STM_MALA_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	mala.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The Metropolis-adjusted Langevin algorithm (Roberts and Tweedie 1996), -j mala: all
+	of the active parameters are proposed jointly by a preconditioned step along the 
+	gradient of the log posterior, one likelihood and gradient evaluation per iteration
+*/
+
+#include <vector>
+#include "engine.hpp"
+
+namespace STMEngine {
+
+class MALA : public Metropolis
+{
+	public:
+	MALA(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+			EngineOutputLevel outLevel = EngineOutputLevel::Normal,
+			STMOutput::OutputOptions outOpt = STMOutput::OutputOptions(),
+			int thin = 1, int burnin = 0, bool doDIC = false, bool rngSetSeed = false,
+			int rngSeed = 0);
+	MALA(std::map<std::string, STMInput::SerializationData> & sd,
+			STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue);
+
+	protected:
+	void auto_adapt() override;
+	bool adapted() const override { return adaptationDone; }
+	std::map<std::string, double> do_sample(int n, bool saveDeviance = false) override;
+	std::string serialize(char sep) const override;
+
+	private:
+	void drift(const std::vector<double> & x, const std::vector<double> & g, 
+			std::vector<double> & mean) const;
+	double log_proposal_density(const std::vector<double> & x, 
+			const std::vector<double> & mean) const;
+	bool step();
+
+	std::vector<size_t> activeIndex;		// positions of the active parameters
+	std::vector<double> theta, grad;		// the current state and its gradient
+	std::vector<double> preconditioner;		// A, d by d, row major; the diagonal of the
+											// sampler variances until adapted
+	std::vector<double> preconditionerFactor;	// L
+	double stepSize;						// eps
+	bool adaptationDone;
+
+	static const double optimalAcceptance;
+	static const std::vector<double> acceptanceInterval;
+};
+
+} // namespace
+
+#endif
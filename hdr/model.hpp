@@ -31,9 +31,14 @@
 #include <string>
 #include <sstream>
 #include <cmath>
-#include <functional>
+#include <cstdint>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include "stmtypes.hpp"
+#include "kernel.hpp"
+#include "basis.hpp"
+#include "threadpool.hpp"
 
 namespace STMModel
 {
@@ -42,8 +47,141 @@ inline STM::ParValue deannual(STM::ParValue val, int interval);
 inline STM::ParValue inv_logit(STM::ParValue logit_val);
 
 
-// function type for transition probability function
-typedef std::function<STM::ParValue(STM::ParMap &, STM::StateMap &)> TransProbFunction;
+// type of a transition probability function
+// takes a pointer to the interval-scaled rates (in the order given by the model's 
+// description) and a pointer to the prevalence of each state (in the order given by 
+// ModelDescription::stateNames)
+typedef STM::ParValue (*TransProbFunction)(const STM::ParValue *, const STM::ParValue *);
+
+
+/*
+	Applies the transition probability function F to n transitions of the same type
+	rates[r][j] is the rate r of transition j, prevalence has NS values per transition,
+	and the probabilities are written to prob. Because F is a template argument, each 
+	instantiation is a separate loop with F inlined; the models use this to build one 
+	specialized kernel per type of transition (see TwoStateModel::transition_probs)
+*/
+template<TransProbFunction F, size_t NR, size_t NS>
+inline void evaluate_transitions(size_t n, const STM::ParValue * const * rates, 
+		const STM::ParValue * prevalence, STM::ParValue * prob)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		STM::ParValue p [NR];
+		for(size_t r = 0; r < NR; r++)
+			p[r] = rates[r][j];
+		prob[j] = F(p, prevalence + j * NS);
+	}
+}
+
+
+// type of a function giving the partial derivatives of a transition probability
+// returns the probability, as the TransProbFunction of the same type of transition, and 
+// adds its derivative with respect to each rate to dp and, if de is not null, with 
+// respect to the prevalence of each state to de
+typedef STM::ParValue (*TransPartialFunction)(const STM::ParValue *, const STM::ParValue *,
+		STM::ParValue *, STM::ParValue *);
+
+
+/*
+	Applies the partial derivative function F to n transitions of the same type, as 
+	evaluate_transitions; dRate[r][j] is set to the derivative of the probability of 
+	transition j with respect to rate r and, if dPrev is not null, dPrev[s][j] to its 
+	derivative with respect to the prevalence of state s (see 
+	TwoStateModel::transition_gradient)
+*/
+template<TransPartialFunction F, size_t NR, size_t NS>
+inline void evaluate_partials(size_t n, const STM::ParValue * const * rates, 
+		const STM::ParValue * prevalence, STM::ParValue * prob, STM::ParValue * const * dRate,
+		STM::ParValue * const * dPrev)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		STM::ParValue p [NR], dp [NR] = {}, de [NS] = {};
+		for(size_t r = 0; r < NR; r++)
+			p[r] = rates[r][j];
+		prob[j] = F(p, prevalence + j * NS, dp, dPrev ? de : nullptr);
+		for(size_t r = 0; r < NR; r++)
+			dRate[r][j] = dp[r];
+		if(dPrev)
+			for(size_t s = 0; s < NS; s++)
+				dPrev[s][j] = de[s];
+	}
+}
+
+
+// solves a x = b by Gaussian elimination with partial pivoting; a is m by m, row major, 
+// and is overwritten, and b is replaced by x. Returns false if a is singular
+inline bool solve_linear(size_t m, double * a, double * b)
+{
+	for(size_t c = 0; c < m; c++)
+	{
+		size_t pivot = c;
+		for(size_t r = c + 1; r < m; r++)
+			if(std::fabs(a[r * m + c]) > std::fabs(a[pivot * m + c]))
+				pivot = r;
+		if(not (std::fabs(a[pivot * m + c]) > 0))
+			return false;
+		if(pivot != c)
+		{
+			std::swap_ranges(a + c * m, a + (c + 1) * m, a + pivot * m);
+			std::swap(b[c], b[pivot]);
+		}
+		for(size_t r = c + 1; r < m; r++)
+		{
+			const double f = a[r * m + c] / a[c * m + c];
+			for(size_t k = c; k < m; k++)
+				a[r * m + k] -= f * a[c * m + k];
+			b[r] -= f * b[c];
+		}
+	}
+	for(size_t c = m; c-- > 0; )
+	{
+		for(size_t k = c + 1; k < m; k++)
+			b[c] -= a[c * m + k] * b[k];
+		b[c] /= a[c * m + c];
+	}
+	return true;
+}
+
+
+// c = a b, for m by m row-major matrices; c must not overlap a or b
+inline void multiply_square(size_t m, const double * a, const double * b, double * c)
+{
+	for(size_t i = 0; i < m; i++)
+	{
+		for(size_t k = 0; k < m; k++)
+			c[i * m + k] = 0;
+		for(size_t l = 0; l < m; l++)
+			for(size_t k = 0; k < m; k++)
+				c[i * m + k] += a[i * m + l] * b[l * m + k];
+	}
+}
+
+
+/*
+	Each rate in the model is a logit-linear function of the terms of the covariate basis
+	(see basis.hpp); by default, a cubic polynomial in each of two environmental 
+	variables. The coefficients of a rate are named by the rate's prefix followed by the 
+	term number, so that with the default basis the rate with prefix "g" has coefficients 
+	g0...g6 for the terms 1, env1, env2, env1^2, env2^2, env1^3, env2^3
+*/
+struct RateDefinition
+{
+	std::string name;
+	std::string prefix;
+};
+const size_t maxRates = 16;
+const size_t maxStates = 16;
+const size_t chunkSize = 128;	// rows per batch in the likelihood; see TransitionTable
+const double negligiblePrevalence = 1e-12;	// treated as 0 by the equilibrium gradient
+
+// order of the rows within each run of a TransitionTable (see below)
+enum class RowOrder
+{
+	File = 0,
+	Locality = 1
+};
 
 
 class StateException: public std::runtime_error
@@ -53,63 +191,313 @@ class StateException: public std::runtime_error
 };	
 
 
-class State
+/*
+	Run-time description of a state model, used wherever the model is only needed as data
+	(reading transitions, naming parameters, saving the model with the resume data)
+		name: the name used to select the model on the command line (-m)
+		stateNames: the code of each state in the input files, in the order used for the 
+			prevalence arrays
+		rates: the rates of the model, in the order used for the rate arrays
+		rateDependencies: for each initial state, the rates used by transitions out of 
+			that state
+		validTransitions: numStates * numStates flags, [initial * numStates + final]
+		hasSTMPrevalence: false if the model has no analytical prevalence (-a), in which
+			case the empirical prevalence is used
+	
+	The computations are done by a model policy class (e.g., TwoStateModel in 
+	model_2s.hpp), which gives the same information at compile time along with the 
+	transition probabilities; Model::description() returns the model's description. 
+	Models can also be read from a model file at run time (see model_program.hpp)
+*/
+struct ModelDescription
 {
-	public:
-	// the constructor throws a StateException on an invalid state
-	State(char s): theState(STM::StateTypes(s)) { self_check(); };
-	STM::StateTypes get() const { return theState; };
-	static std::vector<char> state_names();
+	std::string name;
+	std::vector<char> stateNames;
+	std::vector<RateDefinition> rates;
+	std::vector<std::vector<size_t> > rateDependencies;
+	std::vector<bool> validTransitions;
+	bool hasSTMPrevalence;
 	
-	private:
-	STM::StateTypes theState;
-	void self_check();
-	void invalid_state();
+	size_t num_states() const { return stateNames.size(); }
+	size_t num_rates() const { return rates.size(); }
+	unsigned char state_index(char state) const;	// throws StateException
+	bool valid_transition(size_t initial, size_t final) const
+	{ 
+		return initial < num_states() and final < num_states() and 
+				validTransitions[initial * num_states() + final];
+	}
 };
 
 
-class STMTransition
+/*
+	The transition matrices of n <= chunkSize transitions, as the models' 
+	transition_matrices and transition_matrix_gradients (see FourStateModel), from one 
+	call of stateModel.transition_probs or transition_gradient per possible type of 
+	transition; for the models without a kernel for the whole matrix
+*/
+template<class Model>
+inline void matrices_by_type(const Model & stateModel, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob)
 {
-	public:
-	STMTransition(char state1, char state2, double env1, double env2, 
-			std::map<char, double> prevalence, int interval);
+	const ModelDescription & desc = stateModel.description();
+	const size_t NM = desc.num_states() * desc.num_states();
+	std::fill(prob, prob + n * NM, 0.0);
+	STM::ParValue typeProb [chunkSize];
+	for(size_t type = 0; type < NM; type++)
+	{
+		if(not desc.validTransitions[type])
+			continue;
+		stateModel.transition_probs(type, n, rates, prevalence, typeProb);
+		for(size_t j = 0; j < n; j++)
+			prob[j * NM + type] = typeProb[j];
+	}
+}
 
-	STM::ParValue transition_prob(const STM::ParMap & p, int targetInterval);
-	void set_global_prevalence();
-	static STM::PrevalenceModelTypes get_prevalence_model()	{ return prevalenceModel; }
-	static void set_prevalence_model(const STM::PrevalenceModelTypes &pr);
-	char get_state(char st)
+template<class Model>
+inline void matrix_gradients_by_type(const Model & stateModel, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob, STM::ParValue * dRate, STM::ParValue * dPrev)
+{
+	const ModelDescription & desc = stateModel.description();
+	const size_t NS = desc.num_states(), NR = desc.num_rates(), NM = NS * NS;
+	std::fill(prob, prob + n * NM, 0.0);
+	std::fill(dRate, dRate + n * NM * NR, 0.0);
+	std::fill(dPrev, dPrev + n * NM * NS, 0.0);
+	STM::ParValue typeProb [chunkSize], typeRate [maxRates][chunkSize], 
+			typePrev [maxStates][chunkSize];
+	STM::ParValue * rateCols [maxRates], * prevCols [maxStates];
+	for(size_t r = 0; r < NR; r++)
+		rateCols[r] = typeRate[r];
+	for(size_t s = 0; s < NS; s++)
+		prevCols[s] = typePrev[s];
+	for(size_t type = 0; type < NM; type++)
 	{
-		if(st == 'i') return char(initial.get());
-		else return char(final.get());
+		if(not desc.validTransitions[type])
+			continue;
+		stateModel.transition_gradient(type, n, rates, prevalence, typeProb, rateCols, 
+				prevCols);
+		for(size_t j = 0; j < n; j++)
+		{
+			prob[j * NM + type] = typeProb[j];
+			for(size_t r = 0; r < NR; r++)
+				dRate[(j * NM + type) * NR + r] = typeRate[r][j];
+			for(size_t s = 0; s < NS; s++)
+				dPrev[(j * NM + type) * NS + s] = typePrev[s][j];
+		}
 	}
+}
+
+
+/*
+	A single observed transition, as read from the input file
+	These are not used for computation; the likelihood copies them into a TransitionTable
+	The states are checked against the model and stored as their indices in the model;
+	env holds the values of the environmental variables (env1, env2, ...)
+	
+	Identical transitions (same states, environment, interval and prevalence) may be 
+	merged into a single record; multiplicity() gives the number of observations the 
+	record stands for. operator< orders transitions by everything except multiplicity, 
+	so that identical transitions compare equal
+*/
+class STMTransition
+{
+	public:
+	STMTransition(const ModelDescription & model, char state1, char state2, 
+			const std::vector<double> & env, std::map<char, double> prevalence, 
+			int interval);
+
+	int multiplicity() const { return weight; }
+	void merge(const STMTransition & tr) { weight += tr.weight; }
+	bool operator<(const STMTransition & tr) const;
 
 	private:
-	static void setup_transition_functions();
-	TransProbFunction generate_transition_function();	
-	STM::ParMap generate_transform_rates(const STM::ParMap & p) const;
-	STM::ParMap generate_interval_rates(const STM::ParMap & p, int targetInterval) const;
-	void invalid_transition();
-	void compute_stm_prevalence(const STM::ParMap &rates);
-
-	static std::map<STM::StateTypes, std::map<STM::StateTypes, TransProbFunction> > transitionFunctions;
-	State initial, final;
-	double env1, env2;
-	STM::StateMap expected;
+	unsigned char initial, final;			// state indices
+	std::vector<double> env;
+	std::vector<STM::ParValue> expected;	// indexed by state index
 	int interval;
-	TransProbFunction transProb;
-	static STM::PrevalenceModelTypes prevalenceModel;
+	int weight;
+	
+	friend class TransitionTable;
 };
 
 
+/*
+	Columnar (struct-of-arrays) storage of the transition data, which the likelihood
+	streams through in chunks of at most chunkSize rows. The rows are sorted into one
+	block per initial state, each block into segments of a single type of transition
+	(evaluated by the model's transition_probs for that type), and each segment into runs
+	of equal intervals, whose rates are scaled once per run. The rates come from the
+	design matrix of the covariate basis (basis.hpp). With the analytical prevalence,
+	the table also keeps one cell per unique interval and environment; with exact
+	intervals, one matrix cell per environment. The templates on Model take the model's
+	policy class, or an object for a model defined at run time (model_program.hpp)
+*/
+class TransitionTable
+{
+	public:
+	TransitionTable() : model(nullptr), numStates(0), numRates(0), numVariables(0), 
+			numTerms(0), prevalenceModel(STM::PrevalenceModelTypes::Empirical), 
+			singlePrecision(false), rowOrder(RowOrder::Locality), exactIntervals(false) {}
+	TransitionTable(const std::vector<STMTransition> & transitionData, 
+			const ModelDescription & model, STM::PrevalenceModelTypes prevModel,
+			const CovariateBasis & basis = CovariateBasis(), bool singlePrecision = false,
+			RowOrder order = RowOrder::Locality, bool exactIntervals = false);
+	// singlePrecision stores the design matrix, prevalence and multiplicity as float
+	// (relative error below 6e-8); RowOrder::Locality sorts each run along a Hilbert
+	// curve over the first two environmental variables; exactIntervals takes the
+	// probabilities from powers of the one-step transition matrix instead of scaling
+	// the rates
+	size_t size() const { return interval.size(); }
+	double multiplicity(size_t i) const 
+	{ return singlePrecision ? weightSingle[i] : weight[i]; }
+	bool single_precision() const { return singlePrecision; }
+	RowOrder row_order() const { return rowOrder; }
+	bool exact_intervals() const { return exactIntervals; }
+	size_t num_matrix_cells() const { return matrixCellOffset.empty() ? 0 : 
+			matrixCellOffset.size() - 1; }
+	size_t num_matrix_entries() const { return matrixSteps.size(); }
+	// the one-step matrix P of matrix cells [begin, begin + n) (the model's 
+	// transition_matrices) and its powers, by repeated squaring: numStates^2 values per
+	// entry (initial * numStates + final)
+	template<class Model>
+	void interval_matrices(size_t begin, size_t n, const double * coef, 
+			const STM::ParValue * cellPrevalence, STM::ParValue * matrices, 
+			const Model & stateModel = Model()) const;
+	// the log likelihood of rows [begin, begin + n), from the entries of interval_matrices
+	double matrix_log_likelihood(size_t begin, size_t n, const STM::ParValue * matrices) 
+			const;
+	// copies the per-row arrays, each slice written by the worker that owns it, so that
+	// it is on the worker's memory node; sliceOffset has numThreads + 1 offsets per block
+	// (see Likelihood). Without a pool, the calling thread writes all of the rows
+	void place_rows(const std::vector<size_t> & sliceOffset, 
+			STMThreads::ThreadPool * pool = nullptr);
+	size_t bytes_per_transition() const;
+	size_t num_blocks() const { return numStates; }
+	size_t block_begin(size_t block) const { return blockOffset[block]; }
+	size_t block_end(size_t block) const { return blockOffset[block + 1]; }
+	// the blocks whose probabilities depend on the parameter at position par
+	const std::vector<size_t> & dependent_blocks(size_t par) const 
+	{ return parameterBlocks[par]; }
+	// the logit of each rate for rows [begin, begin + n); logits[r] is the output of rate r
+	void compute_logits(size_t begin, size_t n, const STM::ParVector & p, 
+			STM::ParValue * const * logits) const;
+	// the coefficients of p, one column of num_terms() values per rate
+	void coefficient_matrix(const STM::ParVector & p, double * coef) const;
+	// logits of rows [begin, begin + n) for numColumns columns of coefficient_matrix, as
+	// an n by numColumns column-major matrix
+	void compute_logits(size_t begin, size_t n, const double * coef, size_t numColumns,
+			STM::ParValue * logits) const;
+	// the weighted sum of the log probabilities of rows [begin, begin + n); cellPrevalence
+	// is the prevalence of every cell, with the analytical prevalence
+	template<class Model>
+	double log_likelihood(size_t begin, size_t n, const STM::ParValue * const * logits,
+			const STM::ParValue * cellPrevalence = nullptr, 
+			const Model & stateModel = Model()) const;
+	size_t num_cells() const { return cellInterval.size(); }
+	size_t num_terms() const { return numTerms; }
+	const CovariateBasis & basis() const { return covariateBasis; }
+	// the prevalence of cells [begin, begin + n), numStates values per cell, for the
+	// coefficients coef; with warm, prev holds the starting values of the solver
+	template<class Model>
+	void equilibrium_prevalence(size_t begin, size_t n, const double * coef, bool warm,
+			STM::ParValue * prev, const Model & stateModel = Model()) const;
+	// the sum of log_likelihood; dLogit[r][j] is its derivative with respect to the logit
+	// of rate r of row begin + j, and dPrev (numStates values per row, with the analytical
+	// prevalence) with respect to the prevalence. Probabilities of exactly 0 or 1 have
+	// no gradient
+	template<class Model>
+	double log_likelihood_gradient(size_t begin, size_t n, 
+			const STM::ParValue * const * logits, const STM::ParValue * cellPrevalence,
+			STM::ParValue * const * dLogit, STM::ParValue * dPrev, 
+			const Model & stateModel = Model()) const;
+	// adds dLogit times the design matrix to grad, num_terms() values per rate
+	void coefficient_gradient(size_t begin, size_t n, const STM::ParValue * const * dLogit,
+			double * grad) const;
+	// adds up dPrev by cell, in row order
+	void sum_by_cell(const STM::ParValue * dPrev, STM::ParValue * cellDPrev) const;
+	// adds the gradient through the equilibrium of cells [begin, begin + n), from the
+	// implicit function theorem with one adjoint solve per cell, from the model's 
+	// transition_matrix_gradients; states below
+	// negligiblePrevalence are held at zero, and cells with a singular Jacobian skipped
+	template<class Model>
+	void equilibrium_gradient(size_t begin, size_t n, const double * coef, 
+			const STM::ParValue * prev, const STM::ParValue * cellDPrev, double * grad,
+			const Model & stateModel = Model()) const;
+	// moves the coefficient gradient to the positions of the parameters
+	void parameter_gradient(const double * coefGrad, STM::ParVector & gradient) const;
+	void update_logits(size_t term, double delta, size_t begin, size_t n, 
+			const STM::ParValue * logit, STM::ParValue * result) const;
+	// the rate and term of which the parameter at position par is the coefficient
+	bool parameter_term(size_t par, size_t & rate, size_t & term) const;
+	size_t num_rates() const { return numRates; }
+	const ModelDescription & model_description() const { return *model; }
+	STM::PrevalenceModelTypes prevalence_model() const { return prevalenceModel; }
+	// the interval of the parameters' rates (1 by default)
+	void set_target_interval(int targetInterval);
+	void set_parameter_layout(const std::vector<STM::ParName> & parNames);
+	bool has_parameter_layout() const { return not coefficientIndex.empty(); }
+	void set_global_prevalence();
 
-// IMPLEMENTATION
+	private:
+	const STM::ParValue * chunk_prevalence(size_t begin, size_t n, 
+			const STM::ParValue * cellPrevalence, STM::ParValue * buffer) const;
+	void push_back(const STMTransition & tr);
+	void setup_cells();
+	void setup_matrix_cells();
+	void convert_to_single();
+	void setup_curve(const std::vector<STMTransition> & transitionData);
+	uint64_t curve_index(const double * x) const;
+	template<typename T>
+	void place(STMThreads::FirstTouchVector<T> & values, size_t rowValues, 
+			const std::vector<size_t> & slices, STMThreads::ThreadPool * pool);
 
-inline STM::ParValue transform_interval(STM::ParValue val, int originalInterval, 
-		int targetInterval)
-{ return 1 - std::pow((1 - val), (double(originalInterval)/targetInterval)); }
+	const ModelDescription * model;
+	size_t numStates;
+	size_t numRates;
+	size_t numVariables;						// environmental variables per transition
+	size_t numTerms;							// terms of the basis, per rate
+	CovariateBasis covariateBasis;
+	STM::PrevalenceModelTypes prevalenceModel;
+	std::vector<size_t> coefficientIndex;	// position in the parameter vector of each 
+											// coefficient, numTerms per rate
+	std::vector<std::vector<size_t> > parameterBlocks;	// dependent blocks of each parameter
+	std::vector<size_t> blockOffset;						// first row of each block
+	std::vector<size_t> segmentOffset;					// first row of each segment
+	std::vector<size_t> segmentType;
+	std::vector<size_t> runOffset;				// first row of each run of equal intervals
+	std::vector<int> runInterval;
+	std::vector<double> runRatio;				// runInterval / target interval
+	std::vector<double> env;					// numVariables values per transition
+	STMThreads::FirstTouchVector<double> terms;		// design matrix, stored by column
+	std::vector<int> interval;
+	STMThreads::FirstTouchVector<double> weight;	// multiplicity of each transition
+	std::vector<unsigned char> initial, final;	// state indices
+	STMThreads::FirstTouchVector<STM::ParValue> prevalence;
+	bool singlePrecision;
+	STMThreads::FirstTouchVector<float> termsSingle;	// with singlePrecision, these  
+	STMThreads::FirstTouchVector<float> prevalenceSingle;	// replace terms, prevalence
+	STMThreads::FirstTouchVector<float> weightSingle;		// and weight
+	STMThreads::FirstTouchVector<size_t> cellIndex;	// cell of each row (STM prevalence)
+	std::vector<double> cellTerms;				// design matrix of the cells, by column
+	std::vector<int> cellInterval;				// cells are sorted by interval
+	std::vector<double> cellRatio;
+	RowOrder rowOrder;
+	std::vector<double> curveLow, curveScale;	// map the variables to the curve's grid
+	bool exactIntervals;
+	STMThreads::FirstTouchVector<size_t> matrixEntry;	// entry of each row (exact intervals)
+	std::vector<size_t> matrixCellOffset;		// first entry of each matrix cell
+	std::vector<int> matrixInterval;			// interval of each entry
+	std::vector<unsigned int> matrixSteps;		// matrixInterval / target interval
+	std::vector<double> matrixTerms;			// design matrix of the matrix cells, by column
+	std::vector<STM::ParValue> matrixPrevalence;	// of each matrix cell, or
+	std::vector<size_t> matrixPrevalenceCell;		// its cell (STM prevalence)
+};
 
 
+
+// IMPLEMENTATION
+
 inline STM::ParValue inv_logit(STM::ParValue logit_val)
 {
 	if(logit_val > 0)
@@ -119,73 +507,934 @@ inline STM::ParValue inv_logit(STM::ParValue logit_val)
 }
 
 
-inline void State::invalid_state()
+inline unsigned char ModelDescription::state_index(char state) const
 {
-	std::stringstream msg;
-	msg << "invalid state: " << char(theState);
-	const std::string m = msg.str();
-	throw StateException(m.c_str());
+	auto pos = std::find(stateNames.begin(), stateNames.end(), state);
+	if(pos == stateNames.end())
+	{
+		std::stringstream msg;
+		msg << "invalid state: " << state;
+		const std::string m = msg.str();
+		throw StateException(m.c_str());
+	}
+	return pos - stateNames.begin();
 }
 
 
-inline void STMTransition::invalid_transition()
+inline STMTransition::STMTransition(const ModelDescription & model, char state1, 
+		char state2, const std::vector<double> & env, std::map<char, double> prevalence, 
+		int interval) : initial(model.state_index(state1)), final(model.state_index(state2)), 
+		env(env), expected(model.num_states(), 0), interval(interval), weight(1)
 {
-	std::stringstream msg;
-	msg << "invalid transition: " << char(initial.get());
-	msg << " -> " << char(final.get());
-	const std::string m = msg.str();
-	throw StateException(m.c_str());
+	for(const auto & pr : prevalence)
+		expected[model.state_index(pr.first)] = pr.second;
+	if(not model.valid_transition(initial, final))
+	{
+		std::stringstream msg;
+		msg << "invalid transition: " << state1 << " -> " << state2;
+		const std::string m = msg.str();
+		throw StateException(m.c_str());
+	}
 }
 
 
-inline STM::ParValue STMTransition::transition_prob(const STM::ParMap & p, int targetInterval)
-{ 
-	STM::ParMap rates = generate_interval_rates(p, targetInterval);
-	if(STMTransition::prevalenceModel == STM::PrevalenceModelTypes::STM)
-		compute_stm_prevalence(rates);
-	return transProb(rates, expected); 
+inline bool STMTransition::operator<(const STMTransition & tr) const
+{
+	if(initial != tr.initial) return initial < tr.initial;
+	if(final != tr.final) return final < tr.final;
+	if(env != tr.env) return env < tr.env;
+	if(interval != tr.interval) return interval < tr.interval;
+	return expected < tr.expected;
 }
 
 
-inline STMTransition::STMTransition(char state1, char state2, double env1, double env2, 
-		std::map<char, double> prevalence, int interval) : 
-		initial(state1), final(state2), env1(env1), env2(env2), interval(interval)
+inline TransitionTable::TransitionTable(const std::vector<STMTransition> & transitionData,
+		const ModelDescription & model, STM::PrevalenceModelTypes prevModel, 
+		const CovariateBasis & basis, bool singlePrecision, RowOrder ordering, 
+		bool exactIntervals) : model(&model), numStates(model.num_states()), 
+		numRates(model.num_rates()), numVariables(0), covariateBasis(basis), 
+		prevalenceModel(prevModel), singlePrecision(singlePrecision), rowOrder(ordering),
+		exactIntervals(exactIntervals)
 {
-	if(transitionFunctions.empty())
-		setup_transition_functions();
-	for(const auto & pr : prevalence)
-		expected[State(pr.first).get()] = pr.second;
+	if(numStates > maxStates or numRates > maxRates)
+		throw std::runtime_error("TransitionTable: model has too many states or rates");
+	if(not transitionData.empty())
+		numVariables = transitionData.front().env.size();
+	for(const auto & tr : transitionData)
+	{
+		if(tr.env.size() != numVariables)
+			throw std::runtime_error(
+					"TransitionTable: transitions have different numbers of variables");
+	}
+	// models without an analytical solution use the empirical prevalence
+	if(prevalenceModel == STM::PrevalenceModelTypes::STM and not model.hasSTMPrevalence)
+		prevalenceModel = STM::PrevalenceModelTypes::Empirical;
+	env.reserve(transitionData.size() * numVariables);
+	interval.reserve(transitionData.size());
+	weight.reserve(transitionData.size());
+	initial.reserve(transitionData.size());
+	final.reserve(transitionData.size());
+	prevalence.reserve(transitionData.size() * numStates);
+
+	// one block per initial state and one segment per type of transition within each 
+	// block, and one run per interval within each segment, in curve or file order 
+	// within each run
+	setup_curve(transitionData);
+	std::vector<size_t> type (transitionData.size()), order (transitionData.size());
+	std::vector<uint64_t> curve (transitionData.size(), 0);
+	for(size_t i = 0; i < transitionData.size(); i++)
+	{
+		type[i] = transitionData[i].initial * numStates + transitionData[i].final;
+		order[i] = i;
+		if(rowOrder == RowOrder::Locality)
+			curve[i] = curve_index(transitionData[i].env.data());
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+	{ 
+		if(type[a] != type[b])
+			return type[a] < type[b];
+		if(transitionData[a].interval != transitionData[b].interval)
+			return transitionData[a].interval < transitionData[b].interval;
+		return curve[a] < curve[b];
+	});
+	blockOffset.assign(1, 0);
+	for(const auto & i : order)
+	{
+		const bool newSegment = segmentType.empty() or type[i] != segmentType.back();
+		if(newSegment)
+		{
+			segmentOffset.push_back(size());
+			segmentType.push_back(type[i]);
+		}
+		if(newSegment or transitionData[i].interval != runInterval.back())
+		{
+			runOffset.push_back(size());
+			runInterval.push_back(transitionData[i].interval);
+		}
+		while(blockOffset.size() <= type[i] / numStates)
+			blockOffset.push_back(size());
+		push_back(transitionData[i]);
+	}
+	segmentOffset.push_back(size());
+	runOffset.push_back(size());
+	while(blockOffset.size() <= numStates)
+		blockOffset.push_back(size());
+
+	if(not covariateBasis.fitted())
+		covariateBasis.fit(env, numVariables, std::vector<double> (weight.begin(), 
+				weight.end()));
+	else if(covariateBasis.num_variables() != numVariables)
+	{
+		std::ostringstream msg;
+		msg << "TransitionTable: the covariate basis has " << 
+				covariateBasis.num_variables() << " variables, but the transitions have " <<
+				numVariables;
+		throw std::runtime_error(msg.str());
+	}
+	numTerms = covariateBasis.num_terms();
+	terms.resize(numTerms * size());
+	std::vector<double> rowTerms (numTerms);
+	for(size_t i = 0; i < size(); i++)
+	{
+		covariateBasis.terms(&env[i * numVariables], rowTerms.data());
+		for(size_t k = 0; k < numTerms; k++)
+			terms[k * size() + i] = rowTerms[k];
+	}
 	if(prevalenceModel == STM::PrevalenceModelTypes::Global)
 		set_global_prevalence();
-	generate_transition_function(); 
+	if(prevalenceModel == STM::PrevalenceModelTypes::STM)
+		setup_cells();
+	if(exactIntervals)
+		setup_matrix_cells();
+	set_target_interval(1);
+	if(singlePrecision)
+		convert_to_single();
+}
+
+
+inline void TransitionTable::convert_to_single()
+{
+	termsSingle.assign(terms.begin(), terms.end());
+	prevalenceSingle.assign(prevalence.begin(), prevalence.end());
+	weightSingle.assign(weight.begin(), weight.end());
+	STMThreads::FirstTouchVector<double>().swap(terms);
+	STMThreads::FirstTouchVector<STM::ParValue>().swap(prevalence);
+	STMThreads::FirstTouchVector<double>().swap(weight);
+	std::vector<double>().swap(env);
+}
+
+
+inline size_t TransitionTable::bytes_per_transition() const
+// the data read for each transition on a pass over the table, excluding the cached logits
+{
+	const size_t real = singlePrecision ? sizeof(float) : sizeof(double);
+	size_t bytes = (numTerms + 1) * real;	// design matrix and multiplicity
+	if(exactIntervals)
+		return real + sizeof(size_t);		// multiplicity and matrix entry
+	if(prevalenceModel == STM::PrevalenceModelTypes::STM)
+		bytes += sizeof(size_t);
+	else
+		bytes += numStates * real;
+	return bytes;
+}
+
+
+inline void TransitionTable::setup_cells()
+{
+	// a cell is the interval followed by the environmental variables
+	auto cell_key = [this](size_t i)
+	{
+		std::vector<double> key (1, interval[i]);
+		key.insert(key.end(), &env[i * numVariables], &env[(i + 1) * numVariables]);
+		return key;
+	};
+	std::map<std::vector<double>, size_t> cells;
+	for(size_t i = 0; i < size(); i++)
+		cells[cell_key(i)] = 0;
+	
+	// numbered by interval, then along the curve
+	std::vector<std::map<std::vector<double>, size_t>::iterator> cellOrder;
+	for(auto c = cells.begin(); c != cells.end(); ++c)
+		cellOrder.push_back(c);
+	if(rowOrder == RowOrder::Locality)
+	{
+		std::stable_sort(cellOrder.begin(), cellOrder.end(), [this](
+				std::map<std::vector<double>, size_t>::iterator a, 
+				std::map<std::vector<double>, size_t>::iterator b)
+		{
+			if(a->first[0] != b->first[0])
+				return a->first[0] < b->first[0];
+			return curve_index(&a->first[1]) < curve_index(&b->first[1]);
+		});
+	}
+
+	const size_t numCells = cells.size();
+	cellTerms.resize(numTerms * numCells);
+	cellInterval.clear();
+	std::vector<double> rowTerms (numTerms);
+	for(auto & c : cellOrder)
+	{
+		const size_t k = cellInterval.size();
+		c->second = k;
+		cellInterval.push_back(int(c->first[0]));
+		covariateBasis.terms(&c->first[1], rowTerms.data());
+		for(size_t t = 0; t < numTerms; t++)
+			cellTerms[t * numCells + k] = rowTerms[t];
+	}
+	cellIndex.resize(size());
+	for(size_t i = 0; i < size(); i++)
+		cellIndex[i] = cells.at(cell_key(i));
+}
+
+
+inline void TransitionTable::setup_curve(const std::vector<STMTransition> & transitionData)
+// the range of each of the (first two) variables is mapped to the curve's grid
+{
+	const size_t curveVariables = std::min(numVariables, size_t(2));
+	curveLow.assign(curveVariables, 0);
+	curveScale.assign(curveVariables, 0);
+	for(size_t v = 0; v < curveVariables and not transitionData.empty(); v++)
+	{
+		double low = transitionData.front().env[v], high = low;
+		for(const auto & tr : transitionData)
+		{
+			low = std::min(low, tr.env[v]);
+			high = std::max(high, tr.env[v]);
+		}
+		curveLow[v] = low;
+		if(high > low)
+			curveScale[v] = 65535.0 / (high - low);
+	}
+}
+
+
+inline uint64_t TransitionTable::curve_index(const double * x) const
+// position on a Hilbert curve of order 16 over the first two variables
+{
+	const uint32_t n = 1u << 16;
+	uint32_t c [2] = {0, 0};
+	for(size_t v = 0; v < curveLow.size(); v++)
+		c[v] = uint32_t(std::min(65535.0, std::max(0.0, (x[v] - curveLow[v]) * 
+				curveScale[v] + 0.5)));
+	uint64_t d = 0;
+	for(uint32_t h = n / 2; h > 0; h /= 2)
+	{
+		const uint32_t rx = (c[0] & h) ? 1 : 0;
+		const uint32_t ry = (c[1] & h) ? 1 : 0;
+		d += uint64_t(h) * h * ((3 * rx) ^ ry);
+		// rotate the quadrant so that the curve is continuous
+		if(ry == 0)
+		{
+			if(rx == 1)
+			{
+				c[0] = n - 1 - c[0];
+				c[1] = n - 1 - c[1];
+			}
+			std::swap(c[0], c[1]);
+		}
+	}
+	return d;
+}
+
+
+inline void TransitionTable::place_rows(const std::vector<size_t> & sliceOffset, 
+		STMThreads::ThreadPool * pool)
+{
+	place(terms, 1, sliceOffset, pool);
+	place(weight, 1, sliceOffset, pool);
+	place(prevalence, numStates, sliceOffset, pool);
+	place(termsSingle, 1, sliceOffset, pool);
+	place(weightSingle, 1, sliceOffset, pool);
+	place(prevalenceSingle, numStates, sliceOffset, pool);
+	place(cellIndex, 1, sliceOffset, pool);
+	place(matrixEntry, 1, sliceOffset, pool);
 }
 
 
-inline void STMTransition::set_global_prevalence()
+template<typename T>
+inline void TransitionTable::place(STMThreads::FirstTouchVector<T> & values, 
+		size_t rowValues, const std::vector<size_t> & slices, STMThreads::ThreadPool * pool)
+// values holds one or more columns of size() rows, with rowValues values per row
 {
-	for(auto & exp : expected)
-		expected[exp.first] = 1.0;
+	if(values.empty())
+		return;
+	const size_t numBlocks = num_blocks();
+	const size_t numThreads = slices.size() / numBlocks - 1;
+	if(pool and pool->size() != numThreads)
+		throw std::runtime_error("TransitionTable: the slices do not match the threads");
+	const size_t columnSize = size() * rowValues;
+	STMThreads::FirstTouchVector<T> placed (values.size());
+	auto copy_slices = [&](unsigned int w)
+	{
+		for(size_t b = 0; b < numBlocks; b++)
+		{
+			const size_t * slice = &slices[b * (numThreads + 1)];
+			const size_t first = pool ? slice[w] : slice[0];
+			const size_t last = pool ? slice[w + 1] : slice[numThreads];
+			for(size_t c = 0; c < values.size() / columnSize; c++)
+				std::copy(values.begin() + c * columnSize + first * rowValues, 
+						values.begin() + c * columnSize + last * rowValues, 
+						placed.begin() + c * columnSize + first * rowValues);
+		}
+	};
+	if(pool)
+		pool->run(copy_slices);
+	else
+		copy_slices(0);
+	values.swap(placed);
+}
+
+
+inline void TransitionTable::setup_matrix_cells()
+{
+	const size_t NS = numStates;
+	const bool byPrevalence = prevalenceModel != STM::PrevalenceModelTypes::STM;
+	// a matrix cell is the environmental variables, followed by the prevalence unless it 
+	// is the analytical one; each cell has one entry per distinct interval
+	auto cell_key = [&](size_t i)
+	{
+		std::vector<double> key (&env[i * numVariables], &env[(i + 1) * numVariables]);
+		if(byPrevalence)
+			key.insert(key.end(), &prevalence[i * NS], &prevalence[(i + 1) * NS]);
+		return key;
+	};
+	std::map<std::vector<double>, std::map<int, size_t> > cells;
+	std::map<std::vector<double>, size_t> firstRow;
+	for(size_t i = 0; i < size(); i++)
+	{
+		const std::vector<double> key = cell_key(i);
+		cells[key][interval[i]] = 0;
+		firstRow.insert(std::make_pair(key, i));
+	}
+
+	typedef std::map<std::vector<double>, std::map<int, size_t> >::iterator CellIterator;
+	std::vector<CellIterator> cellOrder;
+	for(auto c = cells.begin(); c != cells.end(); ++c)
+		cellOrder.push_back(c);
+	if(rowOrder == RowOrder::Locality)
+	{
+		std::stable_sort(cellOrder.begin(), cellOrder.end(), [this](CellIterator a, 
+				CellIterator b)
+		{ return curve_index(a->first.data()) < curve_index(b->first.data()); });
+	}
+
+	const size_t numCells = cells.size();
+	matrixTerms.resize(numTerms * numCells);
+	matrixCellOffset.assign(1, 0);
+	matrixInterval.clear();
+	matrixPrevalence.clear();
+	matrixPrevalenceCell.clear();
+	std::vector<double> rowTerms (numTerms);
+	for(auto & c : cellOrder)
+	{
+		const size_t k = matrixCellOffset.size() - 1;
+		covariateBasis.terms(c->first.data(), rowTerms.data());
+		for(size_t t = 0; t < numTerms; t++)
+			matrixTerms[t * numCells + k] = rowTerms[t];
+		const size_t row = firstRow.at(c->first);
+		if(byPrevalence)
+			matrixPrevalence.insert(matrixPrevalence.end(), &prevalence[row * NS], 
+					&prevalence[(row + 1) * NS]);
+		else
+			matrixPrevalenceCell.push_back(cellIndex[row]);
+		for(auto & entry : c->second)
+		{
+			entry.second = matrixInterval.size();
+			matrixInterval.push_back(entry.first);
+		}
+		matrixCellOffset.push_back(matrixInterval.size());
+	}
+	matrixEntry.resize(size());
+	for(size_t i = 0; i < size(); i++)
+		matrixEntry[i] = cells.at(cell_key(i)).at(interval[i]);
 }
 
 
-inline STM::ParMap STMTransition::generate_interval_rates(const STM::ParMap & p, 
-		int targetInterval) const
+inline void TransitionTable::push_back(const STMTransition & tr)
 {
-	STM::ParMap transformLogitParams = generate_transform_rates(p);
-	STM::ParMap macroParams;
-	for(const auto & par : transformLogitParams)
-		macroParams[par.first] = transform_interval(inv_logit(par.second), interval, 
-				targetInterval);
-	return macroParams;
+	env.insert(env.end(), tr.env.begin(), tr.env.end());
+	interval.push_back(tr.interval);
+	weight.push_back(tr.weight);
+	initial.push_back(tr.initial);
+	final.push_back(tr.final);
+	prevalence.insert(prevalence.end(), tr.expected.begin(), tr.expected.end());
 }
 
 
-inline TransProbFunction STMTransition::generate_transition_function()
+inline void TransitionTable::set_target_interval(int targetInterval)
+{
+	runRatio.resize(runInterval.size());
+	for(size_t k = 0; k < runInterval.size(); k++)
+		runRatio[k] = double(runInterval[k]) / targetInterval;
+	// with exact intervals, the equilibrium is that of the one-step matrix
+	cellRatio.resize(cellInterval.size());
+	for(size_t k = 0; k < cellInterval.size(); k++)
+		cellRatio[k] = exactIntervals ? 1.0 : double(cellInterval[k]) / targetInterval;
+	matrixSteps.resize(matrixInterval.size());
+	for(size_t k = 0; k < matrixInterval.size(); k++)
+	{
+		if(matrixInterval[k] % targetInterval != 0 or matrixInterval[k] < targetInterval)
+		{
+			std::ostringstream msg;
+			msg << "TransitionTable: with exact intervals, each interval must be a " <<
+					"multiple of the target interval (" << targetInterval << "), but " << 
+					matrixInterval[k] << " is not";
+			throw std::runtime_error(msg.str());
+		}
+		matrixSteps[k] = matrixInterval[k] / targetInterval;
+	}
+}
+
+
+inline void TransitionTable::set_global_prevalence()
 { 
-	try
-		{ transProb = STMTransition::transitionFunctions.at(initial.get()).at(final.get()); }
-	catch (std::out_of_range e)
-		{ invalid_transition(); }
+	std::fill(prevalence.begin(), prevalence.end(), 1.0); 
+	std::fill(prevalenceSingle.begin(), prevalenceSingle.end(), 1.0f); 
+}
+
+
+inline void TransitionTable::set_parameter_layout(const std::vector<STM::ParName> & parNames)
+{
+	coefficientIndex.clear();
+	for(const auto & rate : model->rates)
+	{
+		for(size_t k = 0; k < numTerms; k++)
+		{
+			std::ostringstream coefName;
+			coefName << rate.prefix << k;
+			auto pos = std::find(parNames.begin(), parNames.end(), coefName.str());
+			if(pos == parNames.end())
+			{
+				std::ostringstream msg;
+				msg << "TransitionTable: missing parameter " << coefName.str() << 
+						" for rate " << rate.name;
+				throw std::runtime_error(msg.str());
+			}
+			if(std::find(coefficientIndex.begin(), coefficientIndex.end(), 
+					size_t(pos - parNames.begin())) != coefficientIndex.end())
+				throw std::runtime_error("TransitionTable: parameter " + coefName.str() + 
+						" is a coefficient of more than one rate");
+			coefficientIndex.push_back(pos - parNames.begin());
+		}
+	}
+	
+	// with analytical prevalence, every transition depends on all of the rates
+	std::vector<std::vector<size_t> > rateBlocks (numRates);
+	for(size_t block = 0; block < num_blocks(); block++)
+	{
+		if(prevalenceModel == STM::PrevalenceModelTypes::STM or exactIntervals)
+		{
+			for(auto & rb : rateBlocks)
+				rb.push_back(block);
+		}
+		else
+		{
+			for(const auto & rate : model->rateDependencies.at(block))
+				rateBlocks.at(rate).push_back(block);
+		}
+	}
+	parameterBlocks.assign(parNames.size(), std::vector<size_t> ());
+	for(size_t i = 0; i < coefficientIndex.size(); i++)
+		parameterBlocks[coefficientIndex[i]] = rateBlocks[i / numTerms];
+}
+
+
+inline bool TransitionTable::parameter_term(size_t par, size_t & rate, size_t & term) const
+{
+	auto pos = std::find(coefficientIndex.begin(), coefficientIndex.end(), par);
+	if(pos == coefficientIndex.end())
+		return false;
+	rate = (pos - coefficientIndex.begin()) / numTerms;
+	term = (pos - coefficientIndex.begin()) % numTerms;
+	return true;
+}
+
+
+inline void TransitionTable::compute_logits(size_t begin, size_t n, const STM::ParVector & p,
+		STM::ParValue * const * logits) const
+{
+	const size_t * coef = coefficientIndex.data();
+	for(size_t r = 0; r < numRates; r++)
+	{
+		std::fill(logits[r], logits[r] + n, 0.0);
+		for(size_t k = 0; k < numTerms; k++)
+			update_logits(k, p[*coef++], begin, n, logits[r], logits[r]);
+	}
+}
+
+
+inline void TransitionTable::update_logits(size_t term, double delta, size_t begin, 
+		size_t n, const STM::ParValue * logit, STM::ParValue * result) const
+// result = logit + delta * term k, for the n rows starting at begin
+{
+	const size_t first = term * size() + begin;
+	if(singlePrecision)
+		STMKernel::kernel().update_logits_single(logit, delta, &termsSingle[first], n, 
+				result);
+	else
+		STMKernel::kernel().update_logits(logit, delta, &terms[first], n, result);
+}
+
+
+inline void TransitionTable::coefficient_matrix(const STM::ParVector & p, double * coef) 
+		const
+{
+	for(size_t i = 0; i < coefficientIndex.size(); i++)
+		coef[i] = p[coefficientIndex[i]];
+}
+
+
+inline void TransitionTable::compute_logits(size_t begin, size_t n, const double * coef, 
+		size_t numColumns, STM::ParValue * logits) const
+{
+	if(singlePrecision)
+		STMKernel::kernel().multiply_single(&termsSingle[begin], size(), n, numTerms, 
+				coef, numColumns, logits);
+	else
+		STMKernel::kernel().multiply(&terms[begin], size(), n, numTerms, coef, 
+				numColumns, logits);
+}
+
+
+template<class Model>
+inline void TransitionTable::equilibrium_prevalence(size_t begin, size_t n, 
+		const double * coef, bool warm, STM::ParValue * prev, const Model & stateModel) const
+{
+	const size_t NR = numRates, NS = numStates;
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	const size_t numCells = num_cells();
+	for(size_t first = begin; first < begin + n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, begin + n - first);
+		STM::ParValue logits [maxRates * chunkSize];
+		kern.multiply(&cellTerms[first], numCells, len, numTerms, coef, NR, logits);
+
+		// the cells are sorted by interval, so their ratios come in runs
+		STM::ParValue rates [maxRates][chunkSize];
+		for(size_t j = 0; j < len; )
+		{
+			size_t last = j + 1;
+			while(last < len and cellRatio[first + last] == cellRatio[first + j])
+				last++;
+			for(size_t r = 0; r < NR; r++)
+				kern.interval_rates(logits + r * len + j, cellRatio[first + j], last - j, 
+						rates[r] + j);
+			j = last;
+		}
+		const STM::ParValue * rateCols [maxRates];
+		for(size_t r = 0; r < NR; r++)
+			rateCols[r] = rates[r];
+		stateModel.equilibrium(len, rateCols, prev + first * NS, warm);
+	}
+}
+
+
+inline const STM::ParValue * TransitionTable::chunk_prevalence(size_t begin, size_t n, 
+		const STM::ParValue * cellPrevalence, STM::ParValue * buffer) const
+// the prevalence of rows [begin, begin + n), in place or copied into buffer
+{
+	const size_t NS = numStates;
+	if(prevalenceModel == STM::PrevalenceModelTypes::STM)
+	{
+		if(not cellPrevalence)
+			throw std::runtime_error("TransitionTable: the analytical prevalence is missing");
+		for(size_t j = 0; j < n; j++)
+		{
+			const STM::ParValue * cp = cellPrevalence + cellIndex[begin + j] * NS;
+			std::copy(cp, cp + NS, &buffer[j * NS]);
+		}
+		return buffer;
+	}
+	if(singlePrecision)
+	{
+		const float * sp = &prevalenceSingle[begin * NS];
+		std::copy(sp, sp + n * NS, buffer);
+		return buffer;
+	}
+	return &prevalence[begin * NS];
+}
+
+
+template<class Model>
+inline double TransitionTable::log_likelihood(size_t begin, size_t n, 
+		const STM::ParValue * const * logits, const STM::ParValue * cellPrevalence, 
+		const Model & stateModel) const
+{
+	const size_t NR = numRates, NS = numStates;
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	const size_t end = begin + n;
+
+	// one call per rate for each run of equal intervals overlapping the chunk
+	STM::ParValue rates [maxRates][chunkSize];
+	size_t run = std::upper_bound(runOffset.begin(), runOffset.end(), begin) - 
+			runOffset.begin() - 1;
+	for(size_t first = begin; first < end; run++)
+	{
+		const size_t last = std::min(end, runOffset[run + 1]);
+		const size_t offset = first - begin;
+		for(size_t r = 0; r < NR; r++)
+			kern.interval_rates(logits[r] + offset, runRatio[run], last - first, 
+					rates[r] + offset);
+		first = last;
+	}
+
+	STM::ParValue prevBuffer [chunkSize * maxStates];
+	const STM::ParValue * prev = chunk_prevalence(begin, n, cellPrevalence, prevBuffer);
+
+	// one call per segment overlapping the chunk
+	STM::ParValue lik [chunkSize];
+	size_t seg = std::upper_bound(segmentOffset.begin(), segmentOffset.end(), begin) - 
+			segmentOffset.begin() - 1;
+	for(size_t first = begin; first < end; seg++)
+	{
+		const size_t last = std::min(end, segmentOffset[seg + 1]);
+		const size_t offset = first - begin;
+		const STM::ParValue * segRates [maxRates];
+		for(size_t r = 0; r < NR; r++)
+			segRates[r] = rates[r] + offset;
+		stateModel.transition_probs(segmentType[seg], last - first, segRates, 
+				prev + offset * NS, lik + offset);
+		first = last;
+	}
+	if(singlePrecision)
+		return kern.sum_log_single(lik, &weightSingle[begin], n);
+	return kern.sum_log(lik, &weight[begin], n);
+}
+
+
+template<class Model>
+inline double TransitionTable::log_likelihood_gradient(size_t begin, size_t n, 
+		const STM::ParValue * const * logits, const STM::ParValue * cellPrevalence, 
+		STM::ParValue * const * dLogit, STM::ParValue * dPrev, const Model & stateModel) const
+{
+	const size_t NR = numRates, NS = numStates;
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	const size_t end = begin + n;
+
+	// rates and their derivatives with respect to the logits, as in log_likelihood
+	STM::ParValue rates [maxRates][chunkSize], slope [maxRates][chunkSize];
+	size_t run = std::upper_bound(runOffset.begin(), runOffset.end(), begin) - 
+			runOffset.begin() - 1;
+	for(size_t first = begin; first < end; run++)
+	{
+		const size_t last = std::min(end, runOffset[run + 1]);
+		const size_t offset = first - begin;
+		for(size_t r = 0; r < NR; r++)
+			kern.interval_rates_gradient(logits[r] + offset, runRatio[run], last - first, 
+					rates[r] + offset, slope[r] + offset);
+		first = last;
+	}
+
+	STM::ParValue prevBuffer [chunkSize * maxStates];
+	const STM::ParValue * prev = chunk_prevalence(begin, n, cellPrevalence, prevBuffer);
+
+	// probabilities and their partial derivatives, one call per segment
+	STM::ParValue lik [chunkSize];
+	STM::ParValue dRate [maxRates][chunkSize], dState [maxStates][chunkSize];
+	size_t seg = std::upper_bound(segmentOffset.begin(), segmentOffset.end(), begin) - 
+			segmentOffset.begin() - 1;
+	for(size_t first = begin; first < end; seg++)
+	{
+		const size_t last = std::min(end, segmentOffset[seg + 1]);
+		const size_t offset = first - begin;
+		const STM::ParValue * segRates [maxRates];
+		STM::ParValue * segDRate [maxRates];
+		STM::ParValue * segDState [maxStates];
+		for(size_t r = 0; r < NR; r++)
+		{
+			segRates[r] = rates[r] + offset;
+			segDRate[r] = dRate[r] + offset;
+		}
+		for(size_t s = 0; s < NS; s++)
+			segDState[s] = dState[s] + offset;
+		stateModel.transition_gradient(segmentType[seg], last - first, segRates, 
+				prev + offset * NS, lik + offset, segDRate, dPrev ? segDState : nullptr);
+		first = last;
+	}
+
+	// d (w log p) / dx = w / p * dp / dx
+	STM::ParValue scale [chunkSize];
+	for(size_t j = 0; j < n; j++)
+		scale[j] = (lik[j] > 0 and lik[j] < 1) ? multiplicity(begin + j) / lik[j] : 0;
+	for(size_t r = 0; r < NR; r++)
+		for(size_t j = 0; j < n; j++)
+			dLogit[r][j] = scale[j] * dRate[r][j] * slope[r][j];
+	if(dPrev)
+		for(size_t j = 0; j < n; j++)
+			for(size_t s = 0; s < NS; s++)
+				dPrev[j * NS + s] = scale[j] * dState[s][j];
+
+	if(singlePrecision)
+		return kern.sum_log_single(lik, &weightSingle[begin], n);
+	return kern.sum_log(lik, &weight[begin], n);
+}
+
+
+inline void TransitionTable::coefficient_gradient(size_t begin, size_t n, 
+		const STM::ParValue * const * dLogit, double * grad) const
+{
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	for(size_t r = 0; r < numRates; r++)
+	{
+		if(singlePrecision)
+			kern.transpose_multiply_single(&termsSingle[begin], size(), n, numTerms, 
+					dLogit[r], grad + r * numTerms);
+		else
+			kern.transpose_multiply(&terms[begin], size(), n, numTerms, dLogit[r], 
+					grad + r * numTerms);
+	}
+}
+
+
+inline void TransitionTable::sum_by_cell(const STM::ParValue * dPrev, 
+		STM::ParValue * cellDPrev) const
+{
+	const size_t NS = numStates;
+	std::fill(cellDPrev, cellDPrev + num_cells() * NS, 0.0);
+	for(size_t i = 0; i < size(); i++)
+		for(size_t s = 0; s < NS; s++)
+			cellDPrev[cellIndex[i] * NS + s] += dPrev[i * NS + s];
+}
+
+
+template<class Model>
+inline void TransitionTable::equilibrium_gradient(size_t begin, size_t n, 
+		const double * coef, const STM::ParValue * prev, const STM::ParValue * cellDPrev, 
+		double * grad, const Model & stateModel) const
+{
+	const size_t NR = numRates, NS = numStates;
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	const size_t numCells = num_cells();
+	// derivatives of G(e) = e * P(e), unconstrained: [(j * NS + final) * NS + state] and
+	// [(j * NS + final) * NR + rate]; from the transition matrices of the cells
+	const size_t NM = NS * NS;
+	std::vector<STM::ParValue> dGdE (chunkSize * NS * NS), dGdRate (chunkSize * NS * NR);
+	std::vector<STM::ParValue> prob (chunkSize * NM), dProbRate (chunkSize * NM * NR), 
+			dProbPrev (chunkSize * NM * NS);
+	for(size_t first = begin; first < begin + n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, begin + n - first);
+		STM::ParValue logits [maxRates * chunkSize];
+		kern.multiply(&cellTerms[first], numCells, len, numTerms, coef, NR, logits);
+		STM::ParValue rates [maxRates][chunkSize], slope [maxRates][chunkSize];
+		for(size_t j = 0; j < len; )
+		{
+			size_t last = j + 1;
+			while(last < len and cellRatio[first + last] == cellRatio[first + j])
+				last++;
+			for(size_t r = 0; r < NR; r++)
+				kern.interval_rates_gradient(logits + r * len + j, cellRatio[first + j], 
+						last - j, rates[r] + j, slope[r] + j);
+			j = last;
+		}
+
+		const STM::ParValue * e = prev + first * NS;
+		const STM::ParValue * rateCols [maxRates];
+		for(size_t r = 0; r < NR; r++)
+			rateCols[r] = rates[r];
+		std::fill(dGdE.begin(), dGdE.end(), 0.0);
+		std::fill(dGdRate.begin(), dGdRate.end(), 0.0);
+		stateModel.transition_matrix_gradients(len, rateCols, e, prob.data(), 
+				dProbRate.data(), dProbPrev.data());
+		for(size_t j = 0; j < len; j++)
+		{
+			for(size_t type = 0; type < NM; type++)
+			{
+				if(not model->validTransitions[type])
+					continue;
+				const size_t initial = type / NS, final = type % NS;
+				const STM::ParValue ei = e[j * NS + initial];
+				const STM::ParValue * dPrev = &dProbPrev[(j * NM + type) * NS];
+				const STM::ParValue * dRate = &dProbRate[(j * NM + type) * NR];
+				STM::ParValue * row = &dGdE[(j * NS + final) * NS];
+				row[initial] += prob[j * NM + type];
+				for(size_t s = 0; s < NS; s++)
+					row[s] += ei * dPrev[s];
+				for(size_t r = 0; r < NR; r++)
+					dGdRate[(j * NS + final) * NR + r] += ei * dRate[r];
+			}
+		}
+
+		// adjoint of each cell, over the states other than the most prevalent one; states
+		// of negligible prevalence are at a boundary of the simplex (their colonization
+		// terms vanish with them), where they stay
+		STM::ParValue dLogit [maxRates][chunkSize];
+		for(size_t j = 0; j < len; j++)
+		{
+			const STM::ParValue * ej = e + j * NS;
+			const STM::ParValue * a = cellDPrev + (first + j) * NS;
+			const size_t d = std::max_element(ej, ej + NS) - ej;
+			size_t state [maxStates], nf = 0;
+			for(size_t s = 0; s < NS; s++)
+				if(s != d and ej[s] >= negligiblePrevalence)
+					state[nf++] = s;
+			double jt [maxStates * maxStates], lambda [maxStates];
+			for(size_t f = 0; f < nf; f++)
+			{
+				const STM::ParValue * row = &dGdE[(j * NS + state[f]) * NS];
+				for(size_t c = 0; c < nf; c++)
+					jt[c * nf + f] = row[state[c]] - row[d] - (c == f ? 1.0 : 0.0);
+				lambda[f] = a[state[f]] - a[d];
+			}
+			const bool regular = solve_linear(nf, jt, lambda);
+			for(size_t r = 0; r < NR; r++)
+			{
+				double dr = 0;
+				for(size_t f = 0; regular and f < nf; f++)
+					dr -= lambda[f] * dGdRate[(j * NS + state[f]) * NR + r];
+				dLogit[r][j] = std::isfinite(dr) ? dr * slope[r][j] : 0;
+			}
+		}
+		for(size_t r = 0; r < NR; r++)
+			kern.transpose_multiply(&cellTerms[first], numCells, len, numTerms, dLogit[r], 
+					grad + r * numTerms);
+	}
+}
+
+
+template<class Model>
+inline void TransitionTable::interval_matrices(size_t begin, size_t n, const double * coef,
+		const STM::ParValue * cellPrevalence, STM::ParValue * matrices, 
+		const Model & stateModel) const
+{
+	const size_t NR = numRates, NS = numStates, NM = numStates * numStates;
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	const size_t numCells = num_matrix_cells();
+	const bool byCell = prevalenceModel == STM::PrevalenceModelTypes::STM;
+	if(byCell and not cellPrevalence)
+		throw std::runtime_error("TransitionTable: the analytical prevalence is missing");
+	std::vector<STM::ParValue> step (chunkSize * NM), power, product (NM), square (NM);
+	for(size_t first = begin; first < begin + n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, begin + n - first);
+		STM::ParValue logits [maxRates * chunkSize];
+		kern.multiply(&matrixTerms[first], numCells, len, numTerms, coef, NR, logits);
+		STM::ParValue rates [maxRates][chunkSize];
+		const STM::ParValue * rateCols [maxRates];
+		for(size_t r = 0; r < NR; r++)
+		{
+			kern.interval_rates(logits + r * len, 1.0, len, rates[r]);
+			rateCols[r] = rates[r];
+		}
+		STM::ParValue prevBuffer [chunkSize * maxStates];
+		for(size_t j = 0; j < len; j++)
+		{
+			const STM::ParValue * cp = byCell ? 
+					cellPrevalence + matrixPrevalenceCell[first + j] * NS : 
+					&matrixPrevalence[(first + j) * NS];
+			std::copy(cp, cp + NS, &prevBuffer[j * NS]);
+		}
+
+		// the one-step matrix of each cell
+		stateModel.transition_matrices(len, rateCols, prevBuffer, step.data());
+
+		// its powers: power[i] is P^(2^i), shared by all of the cell's entries
+		for(size_t j = 0; j < len; j++)
+		{
+			const size_t * entry = &matrixCellOffset[first + j];
+			unsigned int maxSteps = 1;
+			for(size_t k = entry[0]; k < entry[1]; k++)
+				maxSteps = std::max(maxSteps, matrixSteps[k]);
+			size_t numPowers = 1;
+			while(maxSteps >> numPowers)
+				numPowers++;
+			power.resize(numPowers * NM);
+			std::copy(&step[j * NM], &step[(j + 1) * NM], power.begin());
+			for(size_t i = 1; i < numPowers; i++)
+				multiply_square(NS, &power[(i - 1) * NM], &power[(i - 1) * NM], &power[i * NM]);
+
+			for(size_t k = entry[0]; k < entry[1]; k++)
+			{
+				STM::ParValue * result = matrices + k * NM;
+				bool empty = true;
+				for(size_t i = 0; i < numPowers; i++)
+				{
+					if(not (matrixSteps[k] >> i & 1u))
+						continue;
+					if(empty)
+						std::copy(&power[i * NM], &power[(i + 1) * NM], result);
+					else
+					{
+						multiply_square(NS, result, &power[i * NM], product.data());
+						std::copy(product.begin(), product.end(), result);
+					}
+					empty = false;
+				}
+			}
+		}
+	}
+}
+
+
+inline double TransitionTable::matrix_log_likelihood(size_t begin, size_t n, 
+		const STM::ParValue * matrices) const
+{
+	const size_t NS = numStates, NM = numStates * numStates;
+	const STMKernel::Kernel & kern = STMKernel::kernel();
+	STM::ParValue lik [chunkSize];
+	double sumlogl = 0;
+	for(size_t first = begin; first < begin + n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, begin + n - first);
+		for(size_t j = 0; j < len; j++)
+		{
+			const size_t i = first + j;
+			lik[j] = matrices[matrixEntry[i] * NM + initial[i] * NS + final[i]];
+		}
+		if(singlePrecision)
+			sumlogl += kern.sum_log_single(lik, &weightSingle[first], len);
+		else
+			sumlogl += kern.sum_log(lik, &weight[first], len);
+	}
+	return sumlogl;
+}
+
+
+inline void TransitionTable::parameter_gradient(const double * coefGrad, 
+		STM::ParVector & gradient) const
+{
+	for(size_t i = 0; i < coefficientIndex.size(); i++)
+		gradient[coefficientIndex[i]] += coefGrad[i];
 }
 
 
@@ -0,0 +1,189 @@
+#ifndef STM_MODEL_2S_H
+#define STM_MODEL_2S_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	model_2s.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The two state model (states 0 and 1, absent and present)
+	Policy class for TransitionTable::log_likelihood and STMLikelihood::ModelLikelihood
+	Each probability function returns the probability of one type of transition given 
+	the interval-scaled rates (p) and the prevalence (e)
+	
+	equilibrium(n, rates, prev, warm) gives the analytical (-a) prevalence of n 
+	environmental cells, the fixed point of the model: present = 1 - epsilon / gamma, or 0
+	if epsilon > gamma; the starting values (warm) are not needed
+
+	transition_gradient(type, n, rates, prevalence, prob, dRate, dPrev) gives the same
+	probabilities as transition_probs, with their partial derivatives with respect to the
+	rates and (unless dPrev is null) the prevalences; see evaluate_partials in model.hpp.
+	transition_matrices and transition_matrix_gradients give every probability of each 
+	transition, one type at a time (see matrices_by_type in model.hpp)
+*/
+
+#include "model.hpp"
+
+namespace STMModel
+{
+
+struct TwoStateModel
+{
+	// position of each state in the prevalence arrays and of each rate in the rate arrays
+	enum State { Absent = 0, Present = 1 };
+	enum Rate { gamma = 0, epsilon = 1 };
+	static constexpr size_t numStates = 2;
+	static constexpr size_t numRates = 2;
+
+	static const ModelDescription & description();
+
+	static constexpr size_t transition_type(size_t initial, size_t final) 
+	{ return initial * numStates + final; }
+
+	// Colonizations
+	static STM::ParValue colonization(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[gamma] * e[Present]; }
+
+	// Absences
+	static STM::ParValue absence(const STM::ParValue *p, const STM::ParValue *e)
+	{ return 1.0 - colonization(p, e); }
+
+	// Extinctions
+	static STM::ParValue extinction(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[epsilon]; }
+
+	// Presences
+	static STM::ParValue presence(const STM::ParValue *p, const STM::ParValue *e)
+	{ return 1.0 - extinction(p, e); }
+
+	// partial derivatives of each of the above
+	static STM::ParValue d_colonization(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		dp[gamma] += e[Present];
+		if(de) de[Present] += p[gamma];
+		return colonization(p, e);
+	}
+	static STM::ParValue d_absence(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		dp[gamma] -= e[Present];
+		if(de) de[Present] -= p[gamma];
+		return absence(p, e);
+	}
+	static STM::ParValue d_extinction(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		dp[epsilon] += 1.0;
+		return extinction(p, e);
+	}
+	static STM::ParValue d_presence(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		dp[epsilon] -= 1.0;
+		return presence(p, e);
+	}
+
+	static void transition_probs(size_t type, size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob);
+	static void transition_gradient(size_t type, size_t n, 
+			const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+			STM::ParValue * prob, STM::ParValue * const * dRate, STM::ParValue * const * dPrev);
+	static void transition_matrices(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob)
+	{ matrices_by_type(TwoStateModel(), n, rates, prevalence, prob); }
+	static void transition_matrix_gradients(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob, STM::ParValue * dRate,
+			STM::ParValue * dPrev)
+	{ matrix_gradients_by_type(TwoStateModel(), n, rates, prevalence, prob, dRate, dPrev); }
+	static void equilibrium(size_t n, const STM::ParValue * const * rates, 
+			STM::ParValue * prev, bool warm);
+};
+
+
+
+// IMPLEMENTATION
+
+inline void TwoStateModel::transition_probs(size_t type, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob)
+{
+	switch(type)
+	{
+		case transition_type(Absent, Present):
+			evaluate_transitions<colonization, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(Absent, Absent):
+			evaluate_transitions<absence, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(Present, Absent):
+			evaluate_transitions<extinction, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(Present, Present):
+			evaluate_transitions<presence, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		default:
+			throw std::runtime_error("TwoStateModel: invalid transition type");
+	}
+}
+
+
+inline void TwoStateModel::transition_gradient(size_t type, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob, STM::ParValue * const * dRate, STM::ParValue * const * dPrev)
+{
+	switch(type)
+	{
+		case transition_type(Absent, Present):
+			evaluate_partials<d_colonization, numRates, numStates>(n, rates, prevalence, 
+					prob, dRate, dPrev);
+			break;
+		case transition_type(Absent, Absent):
+			evaluate_partials<d_absence, numRates, numStates>(n, rates, prevalence, prob, 
+					dRate, dPrev);
+			break;
+		case transition_type(Present, Absent):
+			evaluate_partials<d_extinction, numRates, numStates>(n, rates, prevalence, prob,
+					dRate, dPrev);
+			break;
+		case transition_type(Present, Present):
+			evaluate_partials<d_presence, numRates, numStates>(n, rates, prevalence, prob, 
+					dRate, dPrev);
+			break;
+		default:
+			throw std::runtime_error("TwoStateModel: invalid transition type");
+	}
+}
+
+
+inline void TwoStateModel::equilibrium(size_t n, const STM::ParValue * const * rates, 
+		STM::ParValue * prev, bool warm)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		STM::ParValue present = 1.0 - (rates[epsilon][j] / rates[gamma][j]);
+		if(present < 0) present = 0;
+		prev[j * numStates + Present] = present;
+		prev[j * numStates + Absent] = 1.0 - present;
+	}
+}
+
+} // !STMModel namespace
+
+#endif
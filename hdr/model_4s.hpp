@@ -0,0 +1,507 @@
+#ifndef STM_MODEL_4S_H
+#define STM_MODEL_4S_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	model_4s.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The four state model (states T, B, M and R)
+	Policy class for TransitionTable::log_likelihood and STMLikelihood::ModelLikelihood
+	Each probability function returns the probability of one type of transition given 
+	the interval-scaled rates (p) and the prevalence (e); transitions between T and B are 
+	not possible
+	
+	equilibrium(n, rates, prev, warm) gives the analytical (-a) prevalence of n 
+	environmental cells: the stable fixed point of e = e * P(e), where P(e) is the 
+	transition matrix, which depends on the prevalence through the colonization terms. 
+	Unlike in the two state model, there is no closed form, so it is solved numerically 
+	(see model_4s.cpp); prev holds the starting values when warm is true
+
+	transition_gradient(type, n, rates, prevalence, prob, dRate, dPrev) gives the same
+	probabilities as transition_probs, with their partial derivatives with respect to the
+	rates and (unless dPrev is null) the prevalences; see evaluate_partials in model.hpp
+*/
+
+#include "model.hpp"
+
+namespace STMModel
+{
+
+struct FourStateModel
+{
+	// position of each state in the prevalence arrays and of each rate in the rate arrays
+	enum State { T = 0, B = 1, M = 2, R = 3 };
+	enum Rate { alpha_b = 0, alpha_t, beta_b, beta_t, theta, theta_t, epsilon };
+	static constexpr size_t numStates = 4;
+	static constexpr size_t numRates = 7;
+
+	static const ModelDescription & description();
+
+	static constexpr size_t transition_type(size_t initial, size_t final) 
+	{ return initial * numStates + final; }
+
+	/*
+		The probabilities are written in closed form from a few shared subexpressions:
+			stay = 1 - epsilon: probability of not being disturbed (to R)
+			colT = alpha_t * (T + M), colB = alpha_b * (B + M): colonization of R by 
+				temperate and boreal species
+		Every probability of a transition out of a state is then a product of terms; 
+		e.g., M -> M is (1 - theta) * stay rather than 1 - M_T - M_B - to_R
+		transition_matrices computes all 16 probabilities of each of n transitions (0 for
+		T <-> B), at prob[j * 16 + type], from one evaluation of the subexpressions per
+		transition; transition_matrix_gradients adds their derivatives, at 
+		dRate[(j * 16 + type) * numRates + rate] and dPrev[(j * 16 + type) * numStates + 
+		state]. The functions below give the probability of a single type of transition,
+		for the specialized kernels of transition_probs
+	*/
+	static void transition_matrices(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob);
+	static void transition_matrix_gradients(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob, STM::ParValue * dRate,
+			STM::ParValue * dPrev);
+
+	// T -> R, B -> R, M -> R
+	static STM::ParValue to_R(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[epsilon]; }
+
+	// T -> M
+	static STM::ParValue T_M(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[beta_b] * (e[B] + e[M]) * (1.0 - p[epsilon]); }
+
+	// T -> T
+	static STM::ParValue T_T(const STM::ParValue *p, const STM::ParValue *e)
+	{ return (1.0 - p[beta_b] * (e[B] + e[M])) * (1.0 - p[epsilon]); }
+
+	// B -> M
+	static STM::ParValue B_M(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[beta_t] * (e[T] + e[M]) * (1.0 - p[epsilon]); }
+
+	// B -> B
+	static STM::ParValue B_B(const STM::ParValue *p, const STM::ParValue *e)
+	{ return (1.0 - p[beta_t] * (e[T] + e[M])) * (1.0 - p[epsilon]); }
+
+	// M -> T
+	static STM::ParValue M_T(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[theta] * p[theta_t] * (1.0 - p[epsilon]); }
+
+	// M -> B
+	static STM::ParValue M_B(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[theta] * (1.0 - p[theta_t]) * (1.0 - p[epsilon]); }
+
+	// M -> M
+	static STM::ParValue M_M(const STM::ParValue *p, const STM::ParValue *e)
+	{ return (1.0 - p[theta]) * (1.0 - p[epsilon]); }
+
+	// R -> T
+	static STM::ParValue R_T(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[alpha_t] * (e[T] + e[M]) * (1.0 - p[alpha_b] * (e[B] + e[M])); }
+
+	// R -> B
+	static STM::ParValue R_B(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[alpha_b] * (e[B] + e[M]) * (1.0 - p[alpha_t] * (e[T] + e[M])); }
+
+	// R -> M
+	static STM::ParValue R_M(const STM::ParValue *p, const STM::ParValue *e)
+	{ return p[alpha_b] * (e[B] + e[M]) * p[alpha_t] * (e[T] + e[M]); }
+
+	// R -> R
+	static STM::ParValue R_R(const STM::ParValue *p, const STM::ParValue *e)
+	{ return (1.0 - p[alpha_t] * (e[T] + e[M])) * (1.0 - p[alpha_b] * (e[B] + e[M])); }
+
+	/*
+		Partial derivatives of each of the above; with sTM = T + M and sBM = B + M, the 
+		derivatives with respect to the prevalences go to both states of each sum
+	*/
+	static void add_pair(STM::ParValue *de, State s1, State s2, STM::ParValue value)
+	{
+		de[s1] += value;
+		de[s2] += value;
+	}
+
+	static STM::ParValue d_to_R(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		dp[epsilon] += 1.0;
+		return to_R(p, e);
+	}
+
+	static STM::ParValue d_T_M(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue sBM = e[B] + e[M], stay = 1.0 - p[epsilon];
+		dp[beta_b] += sBM * stay;
+		dp[epsilon] -= p[beta_b] * sBM;
+		if(de) add_pair(de, B, M, p[beta_b] * stay);
+		return T_M(p, e);
+	}
+
+	static STM::ParValue d_T_T(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue sBM = e[B] + e[M], stay = 1.0 - p[epsilon];
+		dp[beta_b] -= sBM * stay;
+		dp[epsilon] -= 1.0 - p[beta_b] * sBM;
+		if(de) add_pair(de, B, M, -p[beta_b] * stay);
+		return T_T(p, e);
+	}
+
+	static STM::ParValue d_B_M(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue sTM = e[T] + e[M], stay = 1.0 - p[epsilon];
+		dp[beta_t] += sTM * stay;
+		dp[epsilon] -= p[beta_t] * sTM;
+		if(de) add_pair(de, T, M, p[beta_t] * stay);
+		return B_M(p, e);
+	}
+
+	static STM::ParValue d_B_B(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue sTM = e[T] + e[M], stay = 1.0 - p[epsilon];
+		dp[beta_t] -= sTM * stay;
+		dp[epsilon] -= 1.0 - p[beta_t] * sTM;
+		if(de) add_pair(de, T, M, -p[beta_t] * stay);
+		return B_B(p, e);
+	}
+
+	static STM::ParValue d_M_T(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue stay = 1.0 - p[epsilon];
+		dp[theta] += p[theta_t] * stay;
+		dp[theta_t] += p[theta] * stay;
+		dp[epsilon] -= p[theta] * p[theta_t];
+		return M_T(p, e);
+	}
+
+	static STM::ParValue d_M_B(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue stay = 1.0 - p[epsilon];
+		dp[theta] += (1.0 - p[theta_t]) * stay;
+		dp[theta_t] -= p[theta] * stay;
+		dp[epsilon] -= p[theta] * (1.0 - p[theta_t]);
+		return M_B(p, e);
+	}
+
+	static STM::ParValue d_M_M(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		dp[theta] -= 1.0 - p[epsilon];
+		dp[epsilon] -= 1.0 - p[theta];
+		return M_M(p, e);
+	}
+
+	static STM::ParValue d_R_T(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue colT = p[alpha_t] * (e[T] + e[M]);
+		const STM::ParValue notB = 1.0 - p[alpha_b] * (e[B] + e[M]);
+		dp[alpha_t] += (e[T] + e[M]) * notB;
+		dp[alpha_b] -= colT * (e[B] + e[M]);
+		if(de)
+		{
+			add_pair(de, T, M, p[alpha_t] * notB);
+			add_pair(de, B, M, -colT * p[alpha_b]);
+		}
+		return R_T(p, e);
+	}
+
+	static STM::ParValue d_R_B(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue colB = p[alpha_b] * (e[B] + e[M]);
+		const STM::ParValue notT = 1.0 - p[alpha_t] * (e[T] + e[M]);
+		dp[alpha_b] += (e[B] + e[M]) * notT;
+		dp[alpha_t] -= colB * (e[T] + e[M]);
+		if(de)
+		{
+			add_pair(de, B, M, p[alpha_b] * notT);
+			add_pair(de, T, M, -colB * p[alpha_t]);
+		}
+		return R_B(p, e);
+	}
+
+	static STM::ParValue d_R_M(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue colT = p[alpha_t] * (e[T] + e[M]);
+		const STM::ParValue colB = p[alpha_b] * (e[B] + e[M]);
+		dp[alpha_t] += (e[T] + e[M]) * colB;
+		dp[alpha_b] += (e[B] + e[M]) * colT;
+		if(de)
+		{
+			add_pair(de, T, M, p[alpha_t] * colB);
+			add_pair(de, B, M, p[alpha_b] * colT);
+		}
+		return R_M(p, e);
+	}
+
+	static STM::ParValue d_R_R(const STM::ParValue *p, const STM::ParValue *e,
+			STM::ParValue *dp, STM::ParValue *de)
+	{
+		const STM::ParValue notT = 1.0 - p[alpha_t] * (e[T] + e[M]);
+		const STM::ParValue notB = 1.0 - p[alpha_b] * (e[B] + e[M]);
+		dp[alpha_t] -= (e[T] + e[M]) * notB;
+		dp[alpha_b] -= (e[B] + e[M]) * notT;
+		if(de)
+		{
+			add_pair(de, T, M, -p[alpha_t] * notB);
+			add_pair(de, B, M, -p[alpha_b] * notT);
+		}
+		return R_R(p, e);
+	}
+
+	static void transition_probs(size_t type, size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob);
+	static void transition_gradient(size_t type, size_t n, 
+			const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+			STM::ParValue * prob, STM::ParValue * const * dRate, STM::ParValue * const * dPrev);
+	static void equilibrium(size_t n, const STM::ParValue * const * rates, 
+			STM::ParValue * prev, bool warm);
+};
+
+
+
+// IMPLEMENTATION
+
+inline void FourStateModel::transition_matrices(size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob)
+{
+	const size_t NS = numStates;
+	for(size_t j = 0; j < n; j++)
+	{
+		const STM::ParValue * e = prevalence + j * NS;
+		const STM::ParValue eps = rates[epsilon][j], stay = 1.0 - eps;
+		const STM::ParValue sTM = e[T] + e[M], sBM = e[B] + e[M];
+		const STM::ParValue colT = rates[alpha_t][j] * sTM, colB = rates[alpha_b][j] * sBM;
+		const STM::ParValue toM_T = rates[beta_b][j] * sBM, toM_B = rates[beta_t][j] * sTM;
+		const STM::ParValue th = rates[theta][j], tt = rates[theta_t][j];
+
+		STM::ParValue * fromT = prob + (j * NS + T) * NS;
+		fromT[T] = (1.0 - toM_T) * stay;
+		fromT[B] = 0;
+		fromT[M] = toM_T * stay;
+		fromT[R] = eps;
+
+		STM::ParValue * fromB = prob + (j * NS + B) * NS;
+		fromB[T] = 0;
+		fromB[B] = (1.0 - toM_B) * stay;
+		fromB[M] = toM_B * stay;
+		fromB[R] = eps;
+
+		STM::ParValue * fromM = prob + (j * NS + M) * NS;
+		fromM[T] = th * tt * stay;
+		fromM[B] = th * (1.0 - tt) * stay;
+		fromM[M] = (1.0 - th) * stay;
+		fromM[R] = eps;
+
+		STM::ParValue * fromR = prob + (j * NS + R) * NS;
+		fromR[T] = colT * (1.0 - colB);
+		fromR[B] = colB * (1.0 - colT);
+		fromR[M] = colT * colB;
+		fromR[R] = (1.0 - colT) * (1.0 - colB);
+	}
+}
+
+
+inline void FourStateModel::transition_matrix_gradients(size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob, STM::ParValue * dRate, STM::ParValue * dPrev)
+{
+	const size_t NS = numStates, NR = numRates, NM = NS * NS;
+	transition_matrices(n, rates, prevalence, prob);
+	std::fill(dRate, dRate + n * NM * NR, 0.0);
+	std::fill(dPrev, dPrev + n * NM * NS, 0.0);
+	for(size_t j = 0; j < n; j++)
+	{
+		const STM::ParValue * e = prevalence + j * NS;
+		const STM::ParValue stay = 1.0 - rates[epsilon][j];
+		const STM::ParValue sTM = e[T] + e[M], sBM = e[B] + e[M];
+		const STM::ParValue at = rates[alpha_t][j], ab = rates[alpha_b][j];
+		const STM::ParValue bt = rates[beta_t][j], bb = rates[beta_b][j];
+		const STM::ParValue th = rates[theta][j], tt = rates[theta_t][j];
+		const STM::ParValue colT = at * sTM, colB = ab * sBM;
+		auto dr = [&](State initial, State final) 
+				{ return dRate + (j * NM + initial * NS + final) * NR; };
+		auto de = [&](State initial, State final) 
+				{ return dPrev + (j * NM + initial * NS + final) * NS; };
+
+		dr(T, T)[beta_b] = -sBM * stay;
+		dr(T, T)[epsilon] = -(1.0 - bb * sBM);
+		add_pair(de(T, T), B, M, -bb * stay);
+		dr(T, M)[beta_b] = sBM * stay;
+		dr(T, M)[epsilon] = -bb * sBM;
+		add_pair(de(T, M), B, M, bb * stay);
+
+		dr(B, B)[beta_t] = -sTM * stay;
+		dr(B, B)[epsilon] = -(1.0 - bt * sTM);
+		add_pair(de(B, B), T, M, -bt * stay);
+		dr(B, M)[beta_t] = sTM * stay;
+		dr(B, M)[epsilon] = -bt * sTM;
+		add_pair(de(B, M), T, M, bt * stay);
+
+		dr(M, T)[theta] = tt * stay;
+		dr(M, T)[theta_t] = th * stay;
+		dr(M, T)[epsilon] = -th * tt;
+		dr(M, B)[theta] = (1.0 - tt) * stay;
+		dr(M, B)[theta_t] = -th * stay;
+		dr(M, B)[epsilon] = -th * (1.0 - tt);
+		dr(M, M)[theta] = -stay;
+		dr(M, M)[epsilon] = -(1.0 - th);
+
+		dr(T, R)[epsilon] = dr(B, R)[epsilon] = dr(M, R)[epsilon] = 1.0;
+
+		dr(R, T)[alpha_t] = sTM * (1.0 - colB);
+		dr(R, T)[alpha_b] = -colT * sBM;
+		add_pair(de(R, T), T, M, at * (1.0 - colB));
+		add_pair(de(R, T), B, M, -colT * ab);
+		dr(R, B)[alpha_b] = sBM * (1.0 - colT);
+		dr(R, B)[alpha_t] = -colB * sTM;
+		add_pair(de(R, B), B, M, ab * (1.0 - colT));
+		add_pair(de(R, B), T, M, -colB * at);
+		dr(R, M)[alpha_t] = sTM * colB;
+		dr(R, M)[alpha_b] = sBM * colT;
+		add_pair(de(R, M), T, M, at * colB);
+		add_pair(de(R, M), B, M, ab * colT);
+		dr(R, R)[alpha_t] = -sTM * (1.0 - colB);
+		dr(R, R)[alpha_b] = -sBM * (1.0 - colT);
+		add_pair(de(R, R), T, M, -at * (1.0 - colB));
+		add_pair(de(R, R), B, M, -ab * (1.0 - colT));
+	}
+}
+
+
+inline void FourStateModel::transition_probs(size_t type, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob)
+{
+	switch(type)
+	{
+		case transition_type(T, T):
+			evaluate_transitions<T_T, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(T, M):
+			evaluate_transitions<T_M, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(T, R):
+		case transition_type(B, R):
+		case transition_type(M, R):
+			evaluate_transitions<to_R, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(B, B):
+			evaluate_transitions<B_B, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(B, M):
+			evaluate_transitions<B_M, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(M, T):
+			evaluate_transitions<M_T, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(M, B):
+			evaluate_transitions<M_B, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(M, M):
+			evaluate_transitions<M_M, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(R, T):
+			evaluate_transitions<R_T, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(R, B):
+			evaluate_transitions<R_B, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(R, M):
+			evaluate_transitions<R_M, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		case transition_type(R, R):
+			evaluate_transitions<R_R, numRates, numStates>(n, rates, prevalence, prob);
+			break;
+		default:
+			throw std::runtime_error("FourStateModel: invalid transition type");
+	}
+}
+
+
+inline void FourStateModel::transition_gradient(size_t type, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob, STM::ParValue * const * dRate, STM::ParValue * const * dPrev)
+{
+	switch(type)
+	{
+		case transition_type(T, T):
+			evaluate_partials<d_T_T, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(T, M):
+			evaluate_partials<d_T_M, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(T, R):
+		case transition_type(B, R):
+		case transition_type(M, R):
+			evaluate_partials<d_to_R, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(B, B):
+			evaluate_partials<d_B_B, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(B, M):
+			evaluate_partials<d_B_M, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(M, T):
+			evaluate_partials<d_M_T, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(M, B):
+			evaluate_partials<d_M_B, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(M, M):
+			evaluate_partials<d_M_M, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(R, T):
+			evaluate_partials<d_R_T, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(R, B):
+			evaluate_partials<d_R_B, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(R, M):
+			evaluate_partials<d_R_M, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		case transition_type(R, R):
+			evaluate_partials<d_R_R, numRates, numStates>(n, rates, prevalence, prob, dRate,
+					dPrev);
+			break;
+		default:
+			throw std::runtime_error("FourStateModel: invalid transition type");
+	}
+}
+
+} // !STMModel namespace
+
+#endif
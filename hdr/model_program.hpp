@@ -0,0 +1,198 @@
+#ifndef STM_MODEL_PROGRAM_H
+#define STM_MODEL_PROGRAM_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	model_program.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	State models defined at run time, from a model file
+	The file declares the states (single characters), the rates (name and parameter
+	prefix, which must not end in a digit, so that the names of the coefficients are
+	distinct; see RateDefinition) and the probability of each possible type of transition, as an expression
+	of the interval-scaled rates and of the prevalence of the states; e.g., for the two
+	state model (see models/2state.stm):
+
+		# comments start with #
+		states 0 1
+		rate gamma g
+		rate epsilon e
+		0 -> 1 = gamma * [1]
+		0 -> 0 = 1 - gamma * [1]
+		1 -> 0 = epsilon
+		1 -> 1 = 1 - epsilon
+		equilibrium iterate
+
+	Expressions are made of numbers, rate names, the prevalence of a state ([1] above),
+	+, -, * and /, and parentheses. Transitions without an expression are not possible.
+	The probabilities of the transitions out of each state must sum to one, which is
+	checked at random rates and prevalences when the file is read. With the line
+	"equilibrium iterate", the analytical prevalence (-a) is the stable fixed point 
+	of e = e * P(e), found numerically (see ProgramModel::equilibrium); without it, the
+	model has no analytical prevalence. The solver takes the same path as the built-in
+	four state model, so that both find the same fixed point where there are several
+	(e.g., with T or B alone); the prevalences agree to the solver's tolerance, except
+	near a double root (e.g., gamma = epsilon in the two state model)
+
+	Each expression is compiled into an ExpressionProgram, a flat list of instructions
+	for a stack machine (constants are folded at compile time). evaluate(n, rates,
+	prevalence, numStates, result) runs the program over n transitions: each
+	instruction is a single loop over a batch of chunkSize transitions, so the cost of
+	decoding an instruction is shared by the batch and the loops are vectorized. 
+	derivative() runs the same program in forward mode, on pairs of values and 
+	derivatives, for the gradient of the likelihood (see transition_gradient)
+
+	ProgramModel has the interface of the model policy classes (see model_2s.hpp) as
+	member functions, and ProgramLikelihood is the likelihood of a ProgramModel.
+	find_model (models.hpp) reads a model file when the model name is not one of the
+	built-in models; the file name is then the name of the model, so that resuming
+	reads the same file
+*/
+
+#include <string>
+#include <vector>
+#include "model.hpp"
+#include "likelihood.hpp"
+
+namespace STMModel
+{
+
+class ExpressionProgram
+{
+	public:
+	ExpressionProgram() : depth(0) {}
+	// throws std::runtime_error if the expression is invalid
+	ExpressionProgram(const std::string & expression, const ModelDescription & model);
+	void evaluate(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, size_t numStates, STM::ParValue * result) const;
+	// derivative with respect to rate index (wrtRate) or to the prevalence of state index
+	void derivative(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, size_t numStates, bool wrtRate, size_t index,
+			STM::ParValue * result) const;
+	bool empty() const { return code.empty(); }
+	bool uses_rate(size_t rate) const;
+	bool uses_prevalence(size_t state) const;
+	std::string str() const;			// the program, one instruction per line
+
+	static const size_t maxDepth = 16;	// of the stack, i.e., of nested subexpressions
+
+	private:
+	enum class OpCode { Constant, Rate, Prevalence, Add, Subtract, Multiply, Divide, Negate };
+	struct Instruction
+	{
+		OpCode op;
+		size_t index;		// of the rate or state
+		double value;		// of the constant
+	};
+	class Parser;
+
+	void emit(OpCode op, size_t index = 0, double value = 0);
+
+	std::vector<Instruction> code;
+	size_t depth;
+};
+
+
+class ProgramModel
+{
+	public:
+	ProgramModel(const std::string & fileName);		// throws std::runtime_error
+	const ModelDescription & description() const { return desc; }
+	void transition_probs(size_t type, size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob) const;
+	void transition_gradient(size_t type, size_t n, const STM::ParValue * const * rates, 
+			const STM::ParValue * prevalence, STM::ParValue * prob, 
+			STM::ParValue * const * dRate, STM::ParValue * const * dPrev) const;
+	// one program per type of transition (see matrices_by_type in model.hpp)
+	void transition_matrices(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob) const
+	{ matrices_by_type(*this, n, rates, prevalence, prob); }
+	void transition_matrix_gradients(size_t n, const STM::ParValue * const * rates,
+			const STM::ParValue * prevalence, STM::ParValue * prob, STM::ParValue * dRate,
+			STM::ParValue * dPrev) const
+	{ matrix_gradients_by_type(*this, n, rates, prevalence, prob, dRate, dPrev); }
+	void equilibrium(size_t n, const STM::ParValue * const * rates, STM::ParValue * prev,
+			bool warm) const;
+
+	private:
+	void parse_line(const std::string & line, std::vector<std::string> & expressions);
+	void step(size_t n, const STM::ParValue * const * rates, const STM::ParValue * prev,
+			STM::ParValue * next, STM::ParValue * dNext = nullptr) const;
+	void check_probabilities() const;
+
+	ModelDescription desc;
+	std::vector<ExpressionProgram> programs;	// [initial * numStates + final]
+};
+
+} // !STMModel namespace
+
+
+namespace STMLikelihood
+{
+
+class ProgramLikelihood : public Likelihood
+{
+	public:
+	ProgramLikelihood(const STMModel::ProgramModel & model,
+			const std::vector<STMModel::STMTransition> & transitionData,
+			const std::string & transitionDataOriginFile,
+			const std::map<std::string, PriorDist> & pr, unsigned int numThreads,
+			int parameterInterval, STM::PrevalenceModelTypes prevModel,
+			const STMModel::CovariateBasis & basis, bool singlePrecision, 
+			STMModel::RowOrder order, bool exactIntervals, unsigned int firstCpu) :
+			Likelihood(model.description(), transitionData, transitionDataOriginFile, pr,
+			numThreads, parameterInterval, prevModel, basis, singlePrecision, order, 
+			exactIntervals, firstCpu),
+			stateModel(model) {}
+	ProgramLikelihood(const STMModel::ProgramModel & model,
+			const STMInput::SerializationData & sd, const std::vector<std::string> &parNames,
+			const std::vector<STMModel::STMTransition> & transitionData, 
+			unsigned int firstCpu) :
+			Likelihood(model.description(), sd, parNames, transitionData, firstCpu),
+			stateModel(model) {}
+
+	protected:
+	double chunk_log_likelihood(size_t begin, size_t n, const STM::ParValue * const * logits,
+			const STM::ParValue * cellPrev) const override
+	{ return transitions.log_likelihood(begin, n, logits, cellPrev, stateModel); }
+	void cell_prevalence(size_t begin, size_t n, const double * coef, bool warm,
+			STM::ParValue * prev) const override
+	{ transitions.equilibrium_prevalence(begin, n, coef, warm, prev, stateModel); }
+	double chunk_log_likelihood_gradient(size_t begin, size_t n, 
+			const STM::ParValue * const * logits, const STM::ParValue * cellPrev,
+			STM::ParValue * const * dLogit, STM::ParValue * dPrev) const override
+	{ 
+		return transitions.log_likelihood_gradient(begin, n, logits, cellPrev, dLogit, dPrev,
+				stateModel); 
+	}
+	void cell_prevalence_gradient(size_t begin, size_t n, const double * coef,
+			const STM::ParValue * prev, const STM::ParValue * cellDPrev, double * grad) const 
+			override
+	{ transitions.equilibrium_gradient(begin, n, coef, prev, cellDPrev, grad, stateModel); }
+	void cell_matrices(size_t begin, size_t n, const double * coef, 
+			const STM::ParValue * cellPrev, STM::ParValue * matrices) const override
+	{ transitions.interval_matrices(begin, n, coef, cellPrev, matrices, stateModel); }
+
+	private:
+	const STMModel::ProgramModel & stateModel;
+};
+
+} // !STMLikelihood namespace
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef STM_MODELS_H
+#define STM_MODELS_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	models.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The state models available at run time
+	find_model(name) returns the description of the model called name (throws 
+	std::runtime_error if there is none); model_names() lists the available models.
+	make_likelihood builds the likelihood of a model (see STMLikelihood::ModelLikelihood) 
+	from its description, either from scratch or from the resume data
+*/
+
+#include <vector>
+#include <string>
+#include <map>
+#include "model.hpp"
+#include "likelihood.hpp"
+
+namespace STMModel
+{
+	class ProgramModel;
+
+	// a built-in model, or a model file (see model_program.hpp); throws runtime_error
+	const ModelDescription & find_model(const std::string & name);
+	std::vector<std::string> model_names();		// of the built-in models
+	// the model read from a file with this description, or nullptr
+	const ProgramModel * find_program_model(const ModelDescription & model);
+}
+
+namespace STMLikelihood
+{
+	// the threads of the likelihood are pinned from CPU firstCpu (see STMThreads::ThreadPool)
+	Likelihood * make_likelihood(const STMModel::ModelDescription & model,
+			const std::vector<STMModel::STMTransition> & transitionData,
+			const std::string & transitionDataOriginFile,
+			const std::map<std::string, PriorDist> & pr, unsigned int numThreads,
+			int parameterInterval, STM::PrevalenceModelTypes prevModel,
+			const STMModel::CovariateBasis & basis = STMModel::CovariateBasis(),
+			bool singlePrecision = false, 
+			STMModel::RowOrder order = STMModel::RowOrder::Locality, 
+			bool exactIntervals = false, unsigned int firstCpu = 0);
+	Likelihood * make_likelihood(const STMModel::ModelDescription & model,
+			const STMInput::SerializationData & sd, const std::vector<std::string> &parNames,
+			const std::vector<STMModel::STMTransition> & transitionData, 
+			unsigned int firstCpu = 0);
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef STM_NUTS_H
+#define STM_NUTS_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	nuts.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	The no-U-turn sampler (Hoffman and Gelman 2014), -j nuts or -j nuts-dense: each
+	iteration is a Hamiltonian trajectory on the log posterior, with a diagonal or dense
+	mass matrix that the warm-up (auto_adapt) tunes along with the step size
+*/
+
+#include <vector>
+#include "engine.hpp"
+
+namespace STMEngine {
+
+class NUTS : public Metropolis
+{
+	public:
+	NUTS(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+			EngineOutputLevel outLevel = EngineOutputLevel::Normal,
+			STMOutput::OutputOptions outOpt = STMOutput::OutputOptions(),
+			int thin = 1, int burnin = 0, bool doDIC = false, bool rngSetSeed = false,
+			int rngSeed = 0, bool denseMetric = false);
+	NUTS(std::map<std::string, STMInput::SerializationData> & sd,
+			STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue);
+
+	protected:
+	void auto_adapt() override;
+	bool adapted() const override { return warmedUp; }
+	std::map<std::string, double> do_sample(int n, bool saveDeviance = false) override;
+	std::string serialize(char sep) const override;
+
+	private:
+	struct Point		// a point of a trajectory: position, momentum and gradient
+	{
+		std::vector<double> theta, r, grad;
+		double logPosterior, logLikelihood;
+	};
+	struct Subtree
+	{
+		Point minus, plus;		// its first and last points
+		Point proposal;
+		double numValid;		// points inside the slice
+		bool valid;				// no U-turn and no divergence
+		bool divergent;
+		double sumAcceptance;	// sum and number of the acceptance statistics
+		int numAcceptance;
+	};
+
+	void evaluate(Point & point);
+	double joint(const Point & point) const;
+	void velocity(const std::vector<double> & r, std::vector<double> & v) const;
+	void draw_momentum(std::vector<double> & r);
+	void leapfrog(Point & point, double eps);
+	bool no_uturn(const Point & minus, const Point & plus) const;
+	Subtree build_tree(const Point & start, double logSlice, int direction, int depth,
+			double joint0);
+	double transition();
+	void find_step_size();
+	void restart_step_size();
+	void adapt_step_size(double acceptance);
+
+	std::vector<size_t> activeIndex;		// positions of the active parameters
+	Point current;
+	bool denseMetric;
+	std::vector<double> inverseMetric;		// M^-1, d by d, row major
+	std::vector<double> metricFactor;		// its Cholesky factor
+	double stepSize;
+	int warmupIterations;
+	int maxTreeDepth;
+	double targetAcceptance;
+	bool warmedUp;
+
+	// dual averaging of the step size (Hoffman and Gelman 2014, section 3.2)
+	double muStep, hBar, logStepBar;
+	int numStepUpdates;
+
+	// statistics of the iterations since the last report
+	int numTransitions, numDivergent, sumTreeDepth;
+};
+
+} // namespace
+
+#endif
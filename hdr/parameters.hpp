@@ -56,12 +56,17 @@ class STModelParameters
 
 
 	/* 
-		uses environmental conditions (passed as parameters) along with the model
-		parameters (stored internally) to generate the transition rates
+		parameter values are stored in a dense vector, in the same order as names()
+		values() returns the dense vector; this is what the likelihood uses
+		index(par) returns the position of parameter par in values() and names()
+		current_state() returns a copy of the values keyed by name, for output
+		update() sets a single parameter value, either by name or by index
 	*/
-
-	const STM::ParMap & current_state() const;
+	const STM::ParVector & values() const;
+	size_t index(const STM::ParName & par) const;
+	STM::ParMap current_state() const;
 	void update(const STM::ParPair & par);
+	void update(size_t index, STM::ParValue val);
 	STM::ParPair at(const STM::ParName & p) const;
 
 
@@ -143,6 +148,7 @@ class STModelParameters
 	static std::vector<STM::ParName> parNames;
 	static std::vector<STM::ParName> activeParNames;
 	static std::map<STM::ParName, ParameterSettings> parSettings;
+	static std::map<STM::ParName, size_t> parIndex;
 	static std::vector<double> targetAcceptanceInterval;
 	static double optimalAcceptanceRate;
 	const static double varianceMax;
@@ -150,7 +156,7 @@ class STModelParameters
 
 	// the data below is owned by each individual object
 	double iterationCount;
-	STM::ParMap parameterValues;
+	STM::ParVector parameterValues;
 };
 
 
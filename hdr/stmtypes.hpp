@@ -6,11 +6,10 @@
 #include <iostream>
 namespace STM
 {
-	enum class StateTypes: char; // defined in the 2- or 4-state model cpp file
 	typedef double ParValue;
 	typedef std::string ParName;
 	typedef std::map<ParName, ParValue> ParMap;
-	typedef std::map<StateTypes, ParValue> StateMap;
+	typedef std::vector<ParValue> ParVector;
 	typedef std::pair<ParName, ParValue> ParPair;
 	
 	enum class PrevalenceModelTypes
@@ -0,0 +1,83 @@
+#ifndef STM_TEMPERING_H
+#define STM_TEMPERING_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	tempering.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Parallel tempering (replica exchange), -j tempering with -T replicas: Metropolis
+	chains with the likelihood raised to 1 / T exchange their states; only the cold chain
+	(T = 1, the engine itself) is saved
+*/
+
+#include <vector>
+#include <memory>
+#include "engine.hpp"
+
+namespace STMThreads {
+	class ThreadPool;
+}
+
+namespace STMEngine {
+
+class ParallelTempering : public Metropolis
+{
+	public:
+	// one replica per likelihood in replicaLikelihoods, in addition to the cold chain
+	ParallelTempering(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+			const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods,
+			EngineOutputLevel outLevel = EngineOutputLevel::Normal,
+			STMOutput::OutputOptions outOpt = STMOutput::OutputOptions(),
+			int thin = 1, int burnin = 0, bool doDIC = false, bool rngSetSeed = false,
+			int rngSeed = 0);
+	ParallelTempering(std::map<std::string, STMInput::SerializationData> & sd,
+			STMLikelihood::Likelihood * const lhood, 
+			const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods,
+			STMOutput::OutputQueue * const queue);
+	~ParallelTempering();
+
+	// the number of chains (including the cold one) in resume data written by this engine
+	static size_t num_chains(const STMInput::SerializationData & sd);
+
+	protected:
+	void auto_adapt() override;
+	std::map<std::string, double> do_sample(int n, bool saveDeviance = false) override;
+	std::string serialize(char sep) const override;
+	void set_up_rng() override;
+
+	private:
+	class Replica;
+	void set_temperatures();
+	void swap_states(std::vector<int> & accepted);
+	void adapt_ladder(const std::vector<int> & accepted);
+
+	std::vector<std::unique_ptr<Replica> > replicas;	// T_1 to T_(M-1)
+	std::unique_ptr<STMThreads::ThreadPool> pool;	// worker i runs chain i
+	std::vector<double> temperatures;		// T_0 to T_(M-1)
+	int numSwapRounds;						// during the burnin, for the ladder adaptation
+	std::vector<int> swapAttempts;			// of the pair (i - 1, i), since the last report
+	std::vector<int> swapAccepted;
+	bool adapting;		// the cold chain adapts alone, without exchanges
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef STM_THREADPOOL_H
+#define STM_THREADPOOL_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	threadpool.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Persistent pool of worker threads
+	The threads are started once and live as long as the pool, so that a parallel job
+	costs one wake-up signal and one completion count instead of starting a new parallel
+	region. run(job) calls job(w) once for each worker w in [0, size()) and returns when
+	all calls are complete. Worker 0 is the thread calling run(); workers 1 and up are
+	pool threads, each pinned to its own CPU (Linux only) so that data owned by a
+	worker stays in that CPU's cache. Worker w is pinned to CPU firstCpu + w * cpuStride
+	(of those the process may use), so that pools running side by side, like the
+	likelihoods of the chains of parallel tempering, are given CPUs of their own.
+
+	Between jobs, workers spin briefly waiting for the next job and then sleep on a
+	condition variable. An exception thrown by a job is rethrown by run().
+	The pool is not re-entrant: only one thread may call run() at a time.
+
+	On a machine with several memory (NUMA) nodes, the operating system places a page 
+	of memory on the node of the thread that first writes to it. A FirstTouchVector 
+	does not initialize its elements when it is resized, so that the pages of a large 
+	vector stay unplaced until a worker writes its own part of it
+*/
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <utility>
+
+namespace STMThreads {
+
+class ThreadPool
+{
+	public:
+	typedef std::function<void(unsigned int)> Job;
+
+	explicit ThreadPool(unsigned int numThreads, unsigned int firstCpu = 0, 
+			unsigned int cpuStride = 1);
+	~ThreadPool();
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+	unsigned int size() const { return numThreads; }
+	void run(const Job & job);
+
+	private:
+	void worker(unsigned int id);
+	void execute(unsigned int id);
+	static void pin(std::thread & th, unsigned int cpu);
+
+	unsigned int numThreads;
+	std::vector<std::thread> threads;
+	const Job * currentJob;
+	std::exception_ptr jobError;
+	std::atomic<unsigned long> generation;	// incremented for every job
+	std::atomic<unsigned int> pending;		// pool threads still working on the job
+	bool stopping;
+	std::mutex mtx;
+	std::condition_variable wake;
+};
+
+
+// an allocator that default-initializes (i.e., for numbers, leaves uninitialized) the
+// elements of a container, rather than setting them to zero
+template<typename T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+	template<typename U> struct rebind { typedef FirstTouchAllocator<U> other; };
+	FirstTouchAllocator() {}
+	template<typename U> FirstTouchAllocator(const FirstTouchAllocator<U> &) {}
+	template<typename U> void construct(U * p) { ::new(static_cast<void *>(p)) U; }
+	template<typename U, typename... Args> void construct(U * p, Args &&... args)
+	{ ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...); }
+};
+
+template<typename T>
+using FirstTouchVector = std::vector<T, FirstTouchAllocator<T> >;
+
+} // !STMThreads namespace
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef STM_VECMATH_H
+#define STM_VECMATH_H
+
+/*
+	QUICC-FOR ST-Model MCMC
+	vecmath.hpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Branch-free double precision exp and log
+	These use only arithmetic, comparisons and 64-bit integer operations on the bits of
+	the argument, so that loops calling them can be vectorized by the compiler (libm
+	calls cannot). The approximations are those of Cephes (exp) and fdlibm (log),
+	accurate to about 1 ulp over the range used by the likelihood.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace STMKernel {
+
+inline uint64_t as_bits(double x)
+{
+	uint64_t b;
+	std::memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+
+inline double as_double(uint64_t b)
+{
+	double x;
+	std::memcpy(&x, &b, sizeof(x));
+	return x;
+}
+
+
+// exp(x); arguments are clamped to [-708, 709], so results never underflow or overflow
+inline double vexp(double x)
+{
+	const double shifter = 0x1.8p52;
+	const double log2e = 1.4426950408889634073599;
+	const double c1 = 6.93145751953125E-1;
+	const double c2 = 1.42860682030941723212E-6;
+	const double p0 = 1.26177193074810590878E-4;
+	const double p1 = 3.02994407707441961300E-2;
+	const double p2 = 9.99999999999999999910E-1;
+	const double q0 = 3.00198505138664455042E-6;
+	const double q1 = 2.52448340349684104192E-3;
+	const double q2 = 2.27265548208155028766E-1;
+	const double q3 = 2.00000000000000000009E0;
+
+	x = x < -708.0 ? -708.0 : x;
+	x = x > 709.0 ? 709.0 : x;
+
+	// round x/ln(2) to the nearest integer n; n ends up in the low bits of t
+	double t = x * log2e + shifter;
+	double n = t - shifter;
+	double r = x - n * c1;
+	r = r - n * c2;
+
+	// rational approximation of exp(r) on [-ln(2)/2, ln(2)/2]
+	double rr = r * r;
+	double px = r * ((p0 * rr + p1) * rr + p2);
+	double qx = ((q0 * rr + q1) * rr + q2) * rr + q3;
+	double er = 1.0 + 2.0 * (px / (qx - px));
+
+	// multiply by 2^n by building the exponent directly
+	int64_t ni = int64_t(as_bits(t) - as_bits(shifter));
+	return er * as_double(uint64_t(ni + 1023) << 52);
+}
+
+
+// natural logarithm; returns NaN for negative arguments and -infinity for 0
+inline double vlog(double x)
+{
+	const double ln2hi = 6.93147180369123816490e-01;
+	const double ln2lo = 1.90821492927058770002e-10;
+	const double lg1 = 6.666666666666735130e-01;
+	const double lg2 = 3.999999999940941908e-01;
+	const double lg3 = 2.857142874366239149e-01;
+	const double lg4 = 2.222219843214978396e-01;
+	const double lg5 = 1.818357216161805012e-01;
+	const double lg6 = 1.531383769920937332e-01;
+	const double lg7 = 1.479819860511658591e-01;
+	const double sqrt2 = 1.41421356237309504880;
+
+	// bring subnormal numbers into the normal range
+	bool subnormal = x < std::numeric_limits<double>::min();
+	double xs = x * (subnormal ? 0x1p54 : 1.0);
+	double kadj = subnormal ? -54.0 : 0.0;
+
+	// split into exponent k and mantissa m in [sqrt(2)/2, sqrt(2))
+	uint64_t bits = as_bits(xs);
+	double k = as_double((bits >> 52) | 0x4330000000000000ULL) - (0x1p52 + 1023.0) + kadj;
+	double m = as_double((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	bool big = m > sqrt2;
+	m = m * (big ? 0.5 : 1.0);
+	k = k + (big ? 1.0 : 0.0);
+
+	double f = m - 1.0;
+	double s = f / (2.0 + f);
+	double z = s * s;
+	double w = z * z;
+	double t1 = w * (lg2 + w * (lg4 + w * lg6));
+	double t2 = z * (lg1 + w * (lg3 + w * (lg5 + w * lg7)));
+	double hfsq = 0.5 * f * f;
+	double result = k * ln2hi - ((hfsq - (s * (hfsq + t1 + t2) + k * ln2lo)) - f);
+
+	result = x == 0 ? -std::numeric_limits<double>::infinity() : result;
+	result = x == std::numeric_limits<double>::infinity() ? x : result;
+	result = x < 0 ? std::numeric_limits<double>::quiet_NaN() : result;
+	result = x != x ? x : result;
+	return result;
+}
+
+
+// log(1 + u), for u >= 0
+inline double vlog1p(double u)
+{
+	double w = 1.0 + u;
+	// first-order correction for the rounding error in 1 + u
+	return vlog(w) + (u - (w - 1.0)) / w;
+}
+
+
+// log(1 + exp(x)), computed without overflow
+inline double vsoftplus(double x)
+{
+	double ax = x < 0 ? -x : x;
+	double mx = x > 0 ? x : 0;
+	return mx + vlog1p(vexp(-ax));
+}
+
+} // !STMKernel namespace
+
+#endif
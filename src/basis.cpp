@@ -0,0 +1,248 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	basis.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include "../hdr/basis.hpp"
+#include "../hdr/input.hpp"
+
+namespace STMModel {
+
+CovariateBasis::CovariateBasis(BasisType type, size_t degree) : basisType(type),
+		polyDegree(degree), numVariables(0)
+{
+	if(polyDegree < 1)
+		throw std::runtime_error("CovariateBasis: the degree must be at least 1");
+}
+
+
+CovariateBasis::CovariateBasis(const STMInput::SerializationData & sd)
+{
+	basisType = BasisType(STMInput::str_convert<int>(sd.at("basisType")[0]));
+	polyDegree = STMInput::str_convert<size_t>(sd.at("basisDegree")[0]);
+	numVariables = STMInput::str_convert<size_t>(sd.at("basisVariables")[0]);
+	alpha = STMInput::str_convert<double>(sd.at("basisAlpha"));
+	beta = STMInput::str_convert<double>(sd.at("basisBeta"));
+	scale = STMInput::str_convert<double>(sd.at("basisScale"));
+	const size_t n = numVariables * polyDegree;
+	if(alpha.size() != n or beta.size() != n or scale.size() != n)
+		throw std::runtime_error("CovariateBasis: invalid resume data");
+	setup_raw_map();
+}
+
+
+void CovariateBasis::fit(const std::vector<double> & env, size_t nv,
+		const std::vector<double> & weight)
+{
+	const size_t n = weight.size(), d = polyDegree;
+	if(nv == 0 or env.size() != n * nv)
+		throw std::runtime_error("CovariateBasis: no environmental variables to fit");
+	numVariables = nv;
+	alpha.assign(nv * d, 0);
+	beta.assign(nv * d, 0);
+	scale.assign(nv * d, 1);
+	double totalWeight = 0;
+	for(const auto & w : weight)
+		totalWeight += w;
+
+	for(size_t v = 0; v < nv; v++)
+	{
+		std::vector<double> x (n);
+		for(size_t i = 0; i < n; i++)
+			x[i] = env[i * nv + v];
+		std::ostringstream varName;
+		varName << "env" << v + 1;
+
+		if(basisType == BasisType::Centred)
+		{
+			double mean = 0, var = 0;
+			for(size_t i = 0; i < n; i++)
+				mean += weight[i] * x[i];
+			mean /= totalWeight;
+			for(size_t i = 0; i < n; i++)
+				var += weight[i] * (x[i] - mean) * (x[i] - mean);
+			const double sd = std::sqrt(var / totalWeight);
+			if(not (sd > 0))
+				throw std::runtime_error("CovariateBasis: " + varName.str() +
+						" is constant and cannot be centred");
+			for(size_t p = 0; p < d; p++)
+			{
+				alpha[v * d + p] = mean;
+				scale[v * d + p] = std::pow(sd, double(p + 1));
+			}
+		}
+		else if(basisType == BasisType::Orthogonal)
+		{
+			std::vector<double> sorted (x);
+			std::sort(sorted.begin(), sorted.end());
+			const size_t numDistinct = std::unique(sorted.begin(), sorted.end()) -
+					sorted.begin();
+			if(numDistinct <= d)
+			{
+				std::ostringstream msg;
+				msg << "CovariateBasis: " << varName.str() << " has " << numDistinct <<
+						" distinct values; an orthogonal basis of degree " << d <<
+						" needs at least " << d + 1;
+				throw std::runtime_error(msg.str());
+			}
+
+			// Stieltjes procedure: alpha_p = <x P_p, P_p> / <P_p, P_p> and
+			// beta_p = <P_p, P_p> / <P_p-1, P_p-1>, weighted by multiplicity
+			std::vector<double> prev (n, 0), cur (n, 1), next (n);
+			double prevNorm = 0, curNorm = totalWeight;
+			for(size_t p = 0; p < d; p++)
+			{
+				double xNorm = 0;
+				for(size_t i = 0; i < n; i++)
+					xNorm += weight[i] * x[i] * cur[i] * cur[i];
+				const double a = xNorm / curNorm, b = p ? curNorm / prevNorm : 0;
+				double nextNorm = 0;
+				for(size_t i = 0; i < n; i++)
+				{
+					next[i] = (x[i] - a) * cur[i] - b * prev[i];
+					nextNorm += weight[i] * next[i] * next[i];
+				}
+				alpha[v * d + p] = a;
+				beta[v * d + p] = b;
+				scale[v * d + p] = std::sqrt(nextNorm / totalWeight);
+				prev.swap(cur);
+				cur.swap(next);
+				prevNorm = curNorm;
+				curNorm = nextNorm;
+			}
+		}
+	}
+	setup_raw_map();
+}
+
+
+void CovariateBasis::terms(const double * x, double * out) const
+{
+	const size_t d = polyDegree;
+	out[0] = 1;
+	for(size_t v = 0; v < numVariables; v++)
+	{
+		double prev = 0, cur = 1;
+		for(size_t p = 0; p < d; p++)
+		{
+			const size_t i = v * d + p;
+			const double next = (x[v] - alpha[i]) * cur - beta[i] * prev;
+			prev = cur;
+			cur = next;
+			out[1 + p * numVariables + v] = cur / scale[i];
+		}
+	}
+}
+
+
+void CovariateBasis::setup_raw_map()
+// expands each polynomial in powers of x with the same recurrence as terms()
+{
+	const size_t d = polyDegree, w = d + 1;
+	rawMap.assign(numVariables * w * w, 0);
+	for(size_t v = 0; v < numVariables; v++)
+	{
+		double * m = &rawMap[v * w * w];
+		std::vector<double> prev (w, 0), cur (w, 0), next (w);
+		cur[0] = m[0] = 1;
+		for(size_t p = 0; p < d; p++)
+		{
+			const size_t i = v * d + p;
+			for(size_t q = 0; q < w; q++)
+				next[q] = (q ? cur[q - 1] : 0) - alpha[i] * cur[q] - beta[i] * prev[q];
+			prev.swap(cur);
+			cur.swap(next);
+			for(size_t q = 0; q < w; q++)
+				m[(p + 1) * w + q] = cur[q] / scale[i];
+		}
+	}
+}
+
+
+void CovariateBasis::raw_coefficients(const double * coef, double * raw) const
+{
+	const size_t d = polyDegree, w = d + 1;
+	std::fill(raw, raw + num_terms(), 0.0);
+	raw[0] = coef[0];
+	for(size_t v = 0; v < numVariables; v++)
+	{
+		const double * m = &rawMap[v * w * w];
+		for(size_t p = 1; p <= d; p++)
+		{
+			const double c = coef[1 + (p - 1) * numVariables + v];
+			raw[0] += c * m[p * w];
+			for(size_t q = 1; q <= p; q++)
+				raw[1 + (q - 1) * numVariables + v] += c * m[p * w + q];
+		}
+	}
+}
+
+
+std::string CovariateBasis::serialize(char sep) const
+{
+	std::ostringstream result;
+	result << std::setprecision(std::numeric_limits<double>::max_digits10);
+	result << "basisType" << sep << int(basisType) << "\n";
+	result << "basisDegree" << sep << polyDegree << "\n";
+	result << "basisVariables" << sep << numVariables << "\n";
+	result << "basisAlpha";
+	for(const auto & a : alpha)
+		result << sep << a;
+	result << "\nbasisBeta";
+	for(const auto & b : beta)
+		result << sep << b;
+	result << "\nbasisScale";
+	for(const auto & s : scale)
+		result << sep << s;
+	result << "\n";
+	return result.str();
+}
+
+
+BasisType CovariateBasis::type_from_name(const std::string & name)
+{
+	if(name == "raw")
+		return BasisType::Raw;
+	if(name == "centred" or name == "centered")
+		return BasisType::Centred;
+	if(name == "orthogonal")
+		return BasisType::Orthogonal;
+	throw std::runtime_error("unknown covariate basis <" + name +
+			">; use raw, centred or orthogonal");
+}
+
+
+std::string CovariateBasis::type_name(BasisType type)
+{
+	switch(type)
+	{
+		case BasisType::Centred: return "centred";
+		case BasisType::Orthogonal: return "orthogonal";
+		default: return "raw";
+	}
+}
+
+} // !STMModel namespace
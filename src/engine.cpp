@@ -16,18 +16,15 @@
 #include <gsl/gsl_fit.h>
 
 namespace {
-	std::string timestamp()
-	{
-		time_t rawtime;
-		time(&rawtime);
-		struct tm * timeinfo = localtime(&rawtime);
-		char fmtTime [20];
-		strftime(fmtTime, 20, "%F %T", timeinfo);
-		std::string ts(fmtTime);
-		return ts;		
-	}
-
 	std::string engineVersion = "Metropolis1.5";
+
+	// adaptive Metropolis: samples per parameter before a block is proposed jointly, 
+	// samples between refreshes of the Cholesky factor, the regularization of the 
+	// covariance (relative to the mean variance), and the scale of the proposal
+	const int blockSamplesPerParameter = 10;
+	const int blockRefreshInterval = 100;
+	const double blockEpsilon = 1e-6;
+	const double blockScale = 2.38 * 2.38;
 	
 	
 	std::pair<double, int> weighted_mean(const std::vector<std::pair<double, int> > &x)
@@ -76,6 +73,181 @@ namespace {
 
 namespace STMEngine {
 
+SamplerType sampler_from_name(const std::string & name)
+{
+	if(name == "metropolis")
+		return SamplerType::Metropolis;
+	if(name == "adaptive")
+		return SamplerType::AdaptiveMetropolis;
+	if(name == "nuts")
+		return SamplerType::NUTS;
+	if(name == "nuts-dense")
+		return SamplerType::NUTSDense;
+	if(name == "mala")
+		return SamplerType::MALA;
+	if(name == "tempering")
+		return SamplerType::Tempering;
+	if(name == "ensemble")
+		return SamplerType::Ensemble;
+	throw std::runtime_error("Unknown sampler " + name + 
+			"; expected metropolis, adaptive, nuts, nuts-dense, mala, tempering or ensemble");
+}
+
+
+bool cholesky_factor(size_t d, std::vector<double> & a)
+{
+	for(size_t j = 0; j < d; j++)
+	{
+		double s = a[j * d + j];
+		for(size_t k = 0; k < j; k++)
+			s -= a[j * d + k] * a[j * d + k];
+		if(not (s > 0))
+			return false;
+		a[j * d + j] = std::sqrt(s);
+		for(size_t i = j + 1; i < d; i++)
+		{
+			double t = a[i * d + j];
+			for(size_t k = 0; k < j; k++)
+				t -= a[i * d + k] * a[j * d + k];
+			a[i * d + j] = t / a[j * d + j];
+		}
+		for(size_t k = j + 1; k < d; k++)
+			a[j * d + k] = 0;
+	}
+	return true;
+}
+
+
+bool shrunk_covariance(size_t d, const std::vector<std::vector<double> > & samples, 
+		bool dense, std::vector<double> & cov, std::vector<double> & factor)
+{
+	const double n = samples.size();
+	if(n < 2)
+		return false;
+	std::vector<double> mean (d, 0.0), result (d * d, 0.0);
+	for(const auto & x : samples)
+		for(size_t i = 0; i < d; i++)
+			mean[i] += x[i] / n;
+	for(const auto & x : samples)
+		for(size_t i = 0; i < d; i++)
+			for(size_t k = 0; k < d; k++)
+				if(dense or i == k)
+					result[i * d + k] += (x[i] - mean[i]) * (x[k] - mean[k]) / (n - 1);
+	for(size_t i = 0; i < d * d; i++)
+		result[i] *= n / (n + 5);
+	for(size_t i = 0; i < d; i++)
+		result[i * d + i] += 1e-3 * 5 / (n + 5);
+	std::vector<double> resultFactor (result);
+	if(not cholesky_factor(d, resultFactor))
+		return false;
+	cov.swap(result);
+	factor.swap(resultFactor);
+	return true;
+}
+
+
+/*
+	Implementation of ProposalBlock
+*/
+
+ProposalBlock::ProposalBlock(const std::string & label, 
+		const std::vector<STM::ParName> & names, const std::vector<size_t> & index) : 
+		blockLabel(label), parNames(names), parIndex(index), numSamples(0), 
+		proposalScale(1), mean(names.size(), 0.0), sumSquares(names.size() * names.size(), 0.0)
+{ }
+
+
+void ProposalBlock::add_sample(const STM::ParVector & values)
+{
+	const size_t d = parIndex.size();
+	numSamples++;
+	std::vector<double> before (d);
+	for(size_t i = 0; i < d; i++)
+	{
+		before[i] = values[parIndex[i]] - mean[i];
+		mean[i] += before[i] / numSamples;
+	}
+	for(size_t i = 0; i < d; i++)
+	{
+		const double after = values[parIndex[i]] - mean[i];
+		for(size_t k = 0; k < d; k++)
+			sumSquares[i * d + k] += after * before[k];
+	}
+}
+
+
+void ProposalBlock::refresh()
+{
+	const size_t d = parIndex.size();
+	if(numSamples < std::max<int>(2, blockSamplesPerParameter * d))
+		return;
+	double meanVariance = 0;
+	for(size_t i = 0; i < d; i++)
+		meanVariance += sumSquares[i * d + i] / (numSamples - 1) / d;
+	std::vector<double> cov (d * d);
+	for(size_t i = 0; i < d; i++)
+	{
+		for(size_t k = 0; k < d; k++)
+		{
+			// symmetrized, as the running sums may differ in the last bits
+			const double c = 0.5 * (sumSquares[i * d + k] + sumSquares[k * d + i]) / 
+					(numSamples - 1);
+			cov[i * d + k] = proposalScale * blockScale / d * 
+					(c + (i == k ? blockEpsilon * meanVariance : 0));
+		}
+	}
+	// keep the previous factor if the covariance is degenerate (e.g., a stuck chain)
+	if(meanVariance > 0 and cholesky_factor(d, cov))
+		cholesky.swap(cov);
+}
+
+
+void ProposalBlock::propose(gsl_rng * rng, STM::ParVector & values) const
+{
+	const size_t d = parIndex.size();
+	std::vector<double> z (d);
+	for(auto & zi : z)
+		zi = gsl_ran_gaussian(rng, 1.0);
+	for(size_t i = 0; i < d; i++)
+	{
+		double jump = 0;
+		for(size_t k = 0; k <= i; k++)
+			jump += cholesky[i * d + k] * z[k];
+		values[parIndex[i]] += jump;
+	}
+}
+
+
+std::string ProposalBlock::serialize(char sep) const
+{
+	std::ostringstream result;
+	result << std::setprecision(17);
+	result << "block_" << blockLabel << "_samples" << sep << numSamples << "\n";
+	result << "block_" << blockLabel << "_scale" << sep << proposalScale << "\n";
+	result << "block_" << blockLabel << "_mean";
+	for(const auto & v : mean)
+		result << sep << v;
+	result << "\nblock_" << blockLabel << "_sumSquares";
+	for(const auto & v : sumSquares)
+		result << sep << v;
+	result << "\n";
+	return result.str();
+}
+
+
+void ProposalBlock::unserialize(const STMInput::SerializationData & sd)
+{
+	const std::string key = "block_" + blockLabel;
+	numSamples = STMInput::str_convert<int>(sd.at(key + "_samples")[0]);
+	proposalScale = STMInput::str_convert<double>(sd.at(key + "_scale")[0]);
+	mean = STMInput::str_convert<double>(sd.at(key + "_mean"));
+	sumSquares = STMInput::str_convert<double>(sd.at(key + "_sumSquares"));
+	if(mean.size() != parIndex.size() or sumSquares.size() != mean.size() * mean.size())
+		throw std::runtime_error("ProposalBlock: wrong size of saved block " + blockLabel);
+	refresh();
+}
+
+
 
 /*
 	Implementation of public functions
@@ -84,7 +256,7 @@ namespace STMEngine {
 Metropolis::Metropolis(const std::vector<STMParameters::ParameterSettings> & inits, 
 		STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
 		EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, int burnin, 
-		bool doDIC, bool rngSetSeed, int rngSeed) :
+		bool doDIC, bool rngSetSeed, int rngSeed, SamplerType sampler) :
 // objects that are not owned by the object
 outputQueue(queue), likelihood(lhood),
 
@@ -95,7 +267,10 @@ posteriorOptions(outOpt), computeDIC(doDIC),
 
 // the parameters below have default values with no support for changing them
 minAdaptationLoops(5), maxAdaptationLoops(25), adaptationSampleSize(500), 
-outputBufferSize(500)
+outputBufferSize(500),
+
+// the sampler, and the state of its variants
+samplerType(sampler), inverseTemperature(1), adaptBlocks(false)
 {
 	// check pointers
 	if(!queue || !lhood)
@@ -110,12 +285,13 @@ outputBufferSize(500)
 		saveResumeData = true;
 		
 	// compute the log likelihood for the initial conditions
-	currentLL = likelihood->compute_log_likelihood(parameters);
+	currentLL = likelihood->reset_log_likelihood(parameters);
 		
 	// initialize thetaBar with parameter names
 	thetaBar.second = 0;
 	for(auto p : parameters.names())
 		thetaBar.first[p] = 0;
+	setup_blocks();
 	
 	if(saveResumeData) serialize_all();
 }
@@ -126,7 +302,8 @@ Metropolis::Metropolis(std::map<std::string, STMInput::SerializationData> & sd,
 		STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue) : 
 		likelihood(lhood), outputQueue(queue), parameters(sd.at("Parameters")),
 		posteriorOptions(sd.at("OutputOptions")), 
-		rng(gsl_rng_alloc(gsl_rng_mt19937), gsl_rng_free), saveResumeData(true)
+		rng(gsl_rng_alloc(gsl_rng_mt19937), gsl_rng_free), inverseTemperature(1), 
+		saveResumeData(true), adaptBlocks(false)
 {
 	STMInput::SerializationData esd = sd.at("Metropolis");
 	// check versions and return error if no match
@@ -148,8 +325,8 @@ Metropolis::Metropolis(std::map<std::string, STMInput::SerializationData> & sd,
 	thinSize = STMInput::str_convert<int>(esd.at("thinSize")[0]);
 	burnin = STMInput::str_convert<int>(esd.at("burnin")[0]);
 	adaptationSampleSize = STMInput::str_convert<int>(esd.at("adaptationSampleSize")[0]);
-	adaptationSampleSize = STMInput::str_convert<int>(esd.at("minAdaptationLoops")[0]);
-	adaptationSampleSize = STMInput::str_convert<int>(esd.at("maxAdaptationLoops")[0]);
+	minAdaptationLoops = STMInput::str_convert<int>(esd.at("minAdaptationLoops")[0]);
+	maxAdaptationLoops = STMInput::str_convert<int>(esd.at("maxAdaptationLoops")[0]);
 	rngSeed = STMInput::str_convert<unsigned long int>(esd.at("rngSeed")[0]);
 	rngSetSeed = STMInput::str_convert<bool>(esd.at("rngSetSeed")[0]);
 	outputLevel = EngineOutputLevel(STMInput::str_convert<int>(esd.at("outputLevel")[0]));
@@ -163,7 +340,17 @@ Metropolis::Metropolis(std::map<std::string, STMInput::SerializationData> & sd,
 		std::string pkey = "thetaBar_" + p;
 		thetaBar.first[p] = STMInput::str_convert<double>(esd.at(pkey)[0]);
 	}
-
+	try
+	{
+		samplerType = SamplerType(STMInput::str_convert<int>(esd.at("sampler")[0]));
+	}
+	catch (std::out_of_range &e)
+	{
+		samplerType = SamplerType::Metropolis;	// resume data written before -j existed
+	}
+	setup_blocks();
+	for(auto & block : blocks)
+		block.unserialize(esd);
 }
 
 
@@ -171,19 +358,31 @@ std::string Metropolis::version()
 { return engineVersion; }
 
 
+std::string Metropolis::timestamp()
+{
+	time_t rawtime;
+	time(&rawtime);
+	struct tm * timeinfo = localtime(&rawtime);
+	char fmtTime [20];
+	strftime(fmtTime, 20, "%F %T", timeinfo);
+	std::string ts(fmtTime);
+	return ts;		
+}
+
+
 void Metropolis::run_sampler(int n)
 {
 	set_up_rng();
 
-	if(not parameters.adapted())
+	if(not adapted())
 		auto_adapt();
 
 	int burninCompleted = parameters.iteration();
 	int numCompleted = 0;
-	// for safety, always start by re-computing the current likelihood
-	currentLL = likelihood->compute_log_likelihood(parameters);
 	bool computeDevianceNow = false;
 	while(numCompleted < n) {
+		// the block proposals are fixed once the burnin is over
+		adaptBlocks = burninCompleted < burnin;
 		int sampleSize;
 		if(burninCompleted < burnin)
 		{
@@ -210,6 +409,9 @@ void Metropolis::run_sampler(int n)
 			if(computeDIC)
 				prepare_deviance(); // this function takes care of clearing the old vector
 
+			// the deviance uses the sampled coefficients; the output is on the raw scale
+			for(auto & sample : currentSamples)
+				sample = likelihood->raw_scale(sample);
 			STMOutput::OutputBuffer buffer (currentSamples, parameters.names(),
 					STMOutput::OutputKeyType::posterior, posteriorOptions);
 			outputQueue->push(buffer);	// note that this may block if the queue is busy
@@ -341,6 +543,7 @@ void Metropolis::auto_adapt()
 	// disable thinning for the adaptation phase
 	int oldThin = thinSize;
 	thinSize = 1;
+	adaptBlocks = true;
 	
 	regression_adapt(10, 100); // use the first two loops to try a regression approach	
 	int nLoops = 2;
@@ -350,7 +553,20 @@ void Metropolis::auto_adapt()
 		nLoops++;
 		parameters.set_acceptance_rates(do_sample(adaptationSampleSize));
 
+		// blocks are scaled as a whole; their parameters share the block's acceptance rate
+		for(auto & block : blocks) {
+			if(not block.ready())
+				continue;
+			double rate = parameters.acceptance_rate(block.names()[0]);
+			double ratio = (rate == 0) ? 1e-2 : rate / parameters.optimal_acceptance_rate();
+			block.set_scale(std::min(1e3, std::max(1e-3, ratio * block.scale())));
+			block.refresh();
+		}
 		for(const auto & par : parNames) {
+			auto inBlock = [&par](const ProposalBlock & b) { return b.ready() and 
+					std::count(b.names().begin(), b.names().end(), par); };
+			if(std::any_of(blocks.begin(), blocks.end(), inBlock))
+				continue;
 			double ratio;
 			if(parameters.acceptance_rate(par) == 0) 
 				ratio = 1e-2;
@@ -370,6 +586,7 @@ void Metropolis::auto_adapt()
 		if(saveResumeData)
 			serialize_all();
 	}
+	adaptBlocks = false;
 	parameters.reset(); // adaptation samples are not included in the burnin period
 	if(outputLevel >= EngineOutputLevel::Normal) {
 		std::cerr << timestamp() << " Adaptation completed successfully" << std::endl;
@@ -433,6 +650,9 @@ std::string Metropolis::serialize(char sep) const
 	result << "thetaBar_sampSize" << sep << thetaBar.second << "\n";
 	for(const auto & theta : thetaBar.first)
 		result << "thetaBar_" << theta.first << sep << theta.second << "\n";
+	result << "sampler" << sep << int(samplerType) << "\n";
+	for(const auto & block : blocks)
+		result << block.serialize(sep);
 	
 	return result.str();
 }
@@ -452,6 +672,23 @@ std::map<STM::ParName, double> Metropolis::do_sample(int n, bool saveDeviance)
 	for(const auto & par : parNames)
 		numAccepted[par] = 0;
 
+	// parameters of blocks that are ready are proposed with their block
+	std::vector<const ProposalBlock *> readyBlocks;
+	for(const auto & block : blocks)
+	{
+		if(not block.ready())
+			continue;
+		readyBlocks.push_back(&block);
+		for(const auto & par : block.names())
+			parNames.erase(std::find(parNames.begin(), parNames.end(), par));
+	}
+	std::map<std::string, int> blockAccepted;
+
+	// the likelihood's cache must hold the current state; it is refreshed after adaptation,
+	// resuming, or when the state was set from outside (the exchanges of tempering)
+	if(not likelihood->is_current(parameters))
+		currentLL = likelihood->reset_log_likelihood(parameters);
+
 	for(int i = 0; i < n; i++)
 	{
 		for(int j = 0; j < thinSize; j++)
@@ -461,51 +698,69 @@ std::map<STM::ParName, double> Metropolis::do_sample(int n, bool saveDeviance)
 				STM::ParPair proposal = propose_parameter(par);
 				numAccepted[par] += select_parameter(proposal);
 			}
+			std::random_shuffle(readyBlocks.begin(), readyBlocks.end(), 
+					[this](int n){ return gsl_rng_uniform_int(rng.get(), n); });
+			for(const auto & block : readyBlocks)
+				blockAccepted[block->label()] += select_block(*block);
 		}
-		parameters.increment();
-		currentSamples.push_back(parameters.current_state());
-		if(saveDeviance)
-			sampleDeviance.push_back(std::pair<double, int>(-2 * currentLL, 1));
-
-		//		if desired, some debugging output
-		if(outputLevel >= EngineOutputLevel::Verbose) {
-			std::cerr << "  iteration " << parameters.iteration() - 1 << 
-					"    posterior probability: " << currentPosteriorProb <<
-					"    likelihood: " << currentLL << "\n";
-			if(outputLevel >= EngineOutputLevel::ExtraVerbose) {
-			std::ios_base::fmtflags oldflags = std::cerr.flags();
-				std::streamsize oldprecision = std::cerr.precision();
-
-				std::cerr << std::fixed << std::setprecision(3) << " ";
-				STM::ParMap st = parameters.current_state();
-				int coln = 0;
-				for(auto pa : st) {
-					std::cerr << std::setw(6) << pa.first << std::setw(8) << pa.second;
-					if(++coln >= 7) {
-						std::cerr << "\n ";
-						coln = 0;
-					}
-				}
-				std::cerr << std::endl;
-			
-				std::cerr.flags (oldflags);
-				std::cerr.precision (oldprecision);
-			}
-		}
-}
+		if(adaptBlocks)
+			update_blocks();
+		save_sample(saveDeviance);
+	}
 
 	std::map<STM::ParName, double> acceptanceRates;
 	for(const auto & par : parNames)
 		acceptanceRates[par] = double(numAccepted[par]) / (n*thinSize);
+	for(const auto & block : readyBlocks)
+		for(const auto & par : block->names())
+			acceptanceRates[par] = double(blockAccepted[block->label()]) / (n*thinSize);
 	return acceptanceRates;
 }
 
 
+void Metropolis::save_sample(bool saveDeviance)
+// records the current state as the next sample
+{
+	parameters.increment();
+	currentSamples.push_back(parameters.current_state());
+	if(saveDeviance)
+		sampleDeviance.push_back(std::pair<double, int>(-2 * currentLL, 1));
+
+	//		if desired, some debugging output
+	if(outputLevel >= EngineOutputLevel::Verbose) {
+		std::cerr << "  iteration " << parameters.iteration() - 1 << 
+				"    posterior probability: " << currentPosteriorProb <<
+				"    likelihood: " << currentLL << "\n";
+		if(outputLevel >= EngineOutputLevel::ExtraVerbose) {
+		std::ios_base::fmtflags oldflags = std::cerr.flags();
+			std::streamsize oldprecision = std::cerr.precision();
+
+			std::cerr << std::fixed << std::setprecision(3) << " ";
+			STM::ParMap st = parameters.current_state();
+			int coln = 0;
+			for(auto pa : st) {
+				std::cerr << std::setw(6) << pa.first << std::setw(8) << pa.second;
+				if(++coln >= 7) {
+					std::cerr << "\n ";
+					coln = 0;
+				}
+			}
+			std::cerr << std::endl;
+		
+			std::cerr.flags (oldflags);
+			std::cerr.precision (oldprecision);
+		}
+	}
+}
+
+
 STM::ParPair Metropolis::propose_parameter(const 
 		STM::ParName & par) const
 {
-	return STM::ParPair (par, parameters.current_state().at(par) + 
-			gsl_ran_gaussian(rng.get(), parameters.sampler_variance(par)));
+	const auto scale = proposalScale.find(par);
+	return STM::ParPair (par, parameters.at(par).second + 
+			gsl_ran_gaussian(rng.get(), parameters.sampler_variance(par) * 
+			(scale == proposalScale.end() ? 1.0 : scale->second)));
 }
 
 
@@ -514,7 +769,8 @@ int Metropolis::select_parameter(const STM::ParPair & p)
 {
 	STMParameters::STModelParameters proposal (parameters);
 	proposal.update(p);
-	double proposalLL = likelihood->compute_log_likelihood(proposal);
+	double proposalLL = likelihood->propose_log_likelihood(proposal, 
+			parameters.index(p.first));
 	
 	double proposalLogPosterior = log_posterior_prob(proposalLL, p);
 	double currentLogPosterior = log_posterior_prob(currentLL, parameters.at(p.first));
@@ -529,13 +785,87 @@ int Metropolis::select_parameter(const STM::ParPair & p)
 		currentPosteriorProb = proposalLogPosterior;
 		currentLL = proposalLL;
 		parameters.update(p);
+		likelihood->accept_proposal();
 		return 1;
 	} else {
+		likelihood->reject_proposal();
 		return 0;
 	}
 }
 
 
+int Metropolis::select_block(const ProposalBlock & block)
+// returns 1 if proposal is accepted, 0 otherwise; the priors of the other parameters cancel
+{
+	STMParameters::STModelParameters proposal (parameters);
+	STM::ParVector values (parameters.values());
+	block.propose(rng.get(), values);
+	double currentLogPrior = 0, proposalLogPrior = 0;
+	for(const auto & i : block.index())
+	{
+		proposal.update(i, values[i]);
+		currentLogPrior += likelihood->log_prior(parameters.at(parameters.names()[i]));
+		proposalLogPrior += likelihood->log_prior(proposal.at(parameters.names()[i]));
+	}
+	double proposalLL = likelihood->propose_log_likelihood(proposal, block.index());
+	double proposalLogPosterior = inverseTemperature * proposalLL + proposalLogPrior;
+	double acceptanceProb = exp(proposalLogPosterior - 
+			(inverseTemperature * currentLL + currentLogPrior));
+	if(std::isnan(acceptanceProb))
+		acceptanceProb = 0;
+
+	if(gsl_rng_uniform(rng.get()) < acceptanceProb) {
+		currentPosteriorProb = proposalLogPosterior;
+		currentLL = proposalLL;
+		for(const auto & i : block.index())
+			parameters.update(i, values[i]);
+		likelihood->accept_proposal();
+		return 1;
+	} else {
+		likelihood->reject_proposal();
+		return 0;
+	}
+}
+
+
+void Metropolis::setup_blocks()
+// with the adaptive sampler, one block per rate: its active coefficients, labelled by the
+// rate's prefix; parameters the model does not use are proposed one at a time
+{
+	blocks.clear();
+	if(samplerType != SamplerType::AdaptiveMetropolis)
+		return;
+	const auto & rates = likelihood->model_description().rates;
+	std::vector<std::vector<STM::ParName> > byRate (rates.size());
+	for(const auto & par : parameters.active_names())
+	{
+		size_t rate;
+		if(likelihood->parameter_rate(parameters, parameters.index(par), rate))
+			byRate.at(rate).push_back(par);
+	}
+	for(size_t r = 0; r < rates.size(); r++)
+	{
+		if(byRate[r].empty())
+			continue;
+		std::vector<size_t> index;
+		for(const auto & par : byRate[r])
+			index.push_back(parameters.index(par));
+		blocks.push_back(ProposalBlock(rates[r].prefix, byRate[r], index));
+	}
+}
+
+
+void Metropolis::update_blocks()
+{
+	for(auto & block : blocks)
+	{
+		block.add_sample(parameters.values());
+		if(not block.ready() or block.num_samples() % blockRefreshInterval == 0)
+			block.refresh();
+	}
+}
+
+
 void Metropolis::prepare_deviance()
 {
 	sampleDeviance.push_back(DBar);
@@ -562,7 +892,52 @@ void Metropolis::prepare_deviance()
 
 
 double Metropolis::log_posterior_prob(const double logl, const STM::ParPair & pair) const
-{ return logl + likelihood->log_prior(pair); }
+{ return inverseTemperature * logl + likelihood->log_prior(pair); }
+
+
+double Metropolis::log_posterior_gradient(const STMParameters::STModelParameters & params,
+		const std::vector<size_t> & index, std::vector<double> & gradient, 
+		double & logLikelihood) const
+{
+	STM::ParVector llGradient;
+	logLikelihood = likelihood->compute_log_likelihood_and_gradient(params, llGradient);
+	double logPosterior = logLikelihood;
+	gradient.resize(index.size());
+	for(size_t i = 0; i < index.size(); i++)
+	{
+		const STM::ParPair par = params.at(params.names()[index[i]]);
+		logPosterior += likelihood->log_prior(par);
+		gradient[i] = llGradient[index[i]] + likelihood->log_prior_gradient(par);
+	}
+	return std::isnan(logPosterior) ? -INFINITY : logPosterior;
+}
+
+std::vector<size_t> Metropolis::active_index() const
+{
+	std::vector<size_t> result;
+	for(const auto & par : parameters.active_names())
+		result.push_back(parameters.index(par));
+	return result;
+}
+
+
+std::vector<double> Metropolis::active_values(const std::vector<size_t> & index) const
+{
+	std::vector<double> result;
+	for(const auto i : index)
+		result.push_back(parameters.values()[i]);
+	return result;
+}
+
+
+void Metropolis::restart_iterations(const std::vector<size_t> & index, 
+		const std::vector<double> & values)
+{
+	parameters.reset();
+	for(size_t i = 0; i < index.size(); i++)
+		parameters.update(index[i], values[i]);
+}
+
 
 void Metropolis::set_up_rng()
 {
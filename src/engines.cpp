@@ -0,0 +1,106 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	engines.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <stdexcept>
+#include "../hdr/engines.hpp"
+#include "../hdr/nuts.hpp"
+#include "../hdr/mala.hpp"
+#include "../hdr/tempering.hpp"
+#include "../hdr/ensemble.hpp"
+#include "../hdr/input.hpp"
+
+namespace {
+	STMEngine::SamplerType saved_sampler(
+			const std::map<std::string, STMInput::SerializationData> & sd)
+	{
+		try
+		{
+			return STMEngine::SamplerType(STMInput::str_convert<int>(
+					sd.at("Metropolis").at("sampler")[0]));
+		}
+		catch (std::out_of_range &e)
+		{
+			return STMEngine::SamplerType::Metropolis;	// resume data written before -j
+		}
+	}
+}
+
+namespace STMEngine
+{
+
+Metropolis * make_engine(const std::vector<STMParameters::ParameterSettings> & inits,
+		STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+		EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, int burnin,
+		bool doDIC, bool rngSetSeed, int rngSeed, SamplerType sampler,
+		const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods)
+{
+	switch(sampler)
+	{
+		case SamplerType::NUTS:
+		case SamplerType::NUTSDense:
+			return new NUTS(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, 
+					rngSetSeed, rngSeed, sampler == SamplerType::NUTSDense);
+		case SamplerType::MALA:
+			return new MALA(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, 
+					rngSetSeed, rngSeed);
+		case SamplerType::Tempering:
+			return new ParallelTempering(inits, queue, lhood, replicaLikelihoods, outLevel, 
+					outOpt, thin, burnin, doDIC, rngSetSeed, rngSeed);
+		case SamplerType::Ensemble:
+			return new Ensemble(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, 
+					rngSetSeed, rngSeed);
+		default:
+			return new Metropolis(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC,
+					rngSetSeed, rngSeed, sampler);
+	}
+}
+
+
+Metropolis * make_engine(std::map<std::string, STMInput::SerializationData> & sd,
+		STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue,
+		const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods)
+{
+	switch(saved_sampler(sd))
+	{
+		case SamplerType::NUTS:
+		case SamplerType::NUTSDense:
+			return new NUTS(sd, lhood, queue);
+		case SamplerType::MALA:
+			return new MALA(sd, lhood, queue);
+		case SamplerType::Tempering:
+			return new ParallelTempering(sd, lhood, replicaLikelihoods, queue);
+		case SamplerType::Ensemble:
+			return new Ensemble(sd, lhood, queue);
+		default:
+			return new Metropolis(sd, lhood, queue);
+	}
+}
+
+
+size_t num_likelihoods(const std::map<std::string, STMInput::SerializationData> & sd)
+{
+	if(saved_sampler(sd) == SamplerType::Tempering)
+		return ParallelTempering::num_chains(sd.at("Metropolis"));
+	return 1;
+}
+
+} // namespace
@@ -0,0 +1,259 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	ensemble.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <gsl/gsl_randist.h>
+#include "../hdr/ensemble.hpp"
+#include "../hdr/likelihood.hpp"
+#include "../hdr/input.hpp"
+
+namespace {
+	// attempts to draw each starting walker with a finite posterior
+	const int maxStartAttempts = 100;
+}
+
+namespace STMEngine {
+
+const double Ensemble::stretchScale = 2.0;
+
+Ensemble::Ensemble(const std::vector<STMParameters::ParameterSettings> & inits,
+		STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+		EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, int burnin,
+		bool doDIC, bool rngSetSeed, int rngSeed) :
+		Metropolis(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, rngSetSeed,
+		rngSeed, SamplerType::Ensemble), activeIndex(active_index())
+{
+	if(saveResumeData)
+		serialize_all();
+}
+
+
+Ensemble::Ensemble(std::map<std::string, STMInput::SerializationData> & sd,
+		STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue) :
+		Metropolis(sd, lhood, queue), activeIndex(active_index())
+{
+	const STMInput::SerializationData & esd = sd.at("Metropolis");
+	const size_t d = activeIndex.size();
+	const size_t numWalkers = STMInput::str_convert<int>(esd.at("ensembleWalkers")[0]);
+	if(numWalkers == 0)
+		return;		// saved before the walkers were drawn
+	const std::vector<double> values = STMInput::str_convert<double>(
+			esd.at("ensembleValues"));
+	if(numWalkers != 2 * (d + 1) or values.size() != numWalkers * d)
+		throw std::runtime_error("Ensemble: the saved walkers do not match the parameters");
+	for(size_t k = 0; k < numWalkers; k++)
+		walkers.push_back(std::vector<double> (values.begin() + k * d,
+				values.begin() + (k + 1) * d));
+	walkerPosterior = log_posterior(walkers, walkerLL);
+}
+
+
+std::string Ensemble::serialize(char sep) const
+{
+	std::ostringstream result;
+	result << Metropolis::serialize(sep);
+	result << std::setprecision(17);
+	result << "ensembleWalkers" << sep << walkers.size() << "\n";
+	result << "ensembleValues";
+	for(const auto & x : walkers)
+		for(const auto & v : x)
+			result << sep << v;
+	result << "\n";
+	return result.str();
+}
+
+
+std::map<std::string, double> Ensemble::do_sample(int n, bool saveDeviance)
+// each iteration updates the two halves of the ensemble in turn; the walkers are drawn
+// when the sampler first runs. Returns the fraction of accepted moves, for every active
+// parameter
+{
+	if(walkers.empty())
+		start_walkers();
+	int numAccepted = 0;
+	for(int i = 0; i < n; i++)
+	{
+		for(int j = 0; j < thinSize; j++)
+			numAccepted += update_half(0) + update_half(1);
+		save_walkers(saveDeviance);
+	}
+
+	const double rate = double(numAccepted) / (n * thinSize * walkers.size());
+	if(outputLevel >= EngineOutputLevel::Talkative)
+		std::cerr << "    " << timestamp() << " acceptance rate " << rate << "\n";
+	std::map<std::string, double> acceptanceRates;
+	for(const auto & par : parameters.active_names())
+		acceptanceRates[par] = rate;
+	return acceptanceRates;
+}
+
+
+STMParameters::STModelParameters Ensemble::walker_parameters(
+		const std::vector<double> & x) const
+{
+	STMParameters::STModelParameters result (parameters);
+	for(size_t i = 0; i < activeIndex.size(); i++)
+		result.update(activeIndex[i], x[i]);
+	return result;
+}
+
+
+std::vector<double> Ensemble::log_posterior(const std::vector<std::vector<double> > & x,
+		std::vector<double> & logLikelihood) const
+// the log posterior of each point in x (-INFINITY if it is not a number), from a single
+// pass over the transitions
+{
+	std::vector<STMParameters::STModelParameters> pars;
+	for(const auto & xk : x)
+		pars.push_back(walker_parameters(xk));
+	logLikelihood = likelihood->compute_log_likelihood(pars);
+	std::vector<double> result (x.size());
+	for(size_t k = 0; k < x.size(); k++)
+	{
+		result[k] = inverseTemperature * logLikelihood[k];
+		for(const auto i : activeIndex)
+			result[k] += likelihood->log_prior(pars[k].at(parameters.names()[i]));
+		if(std::isnan(result[k]))
+			result[k] = -INFINITY;
+	}
+	return result;
+}
+
+
+void Ensemble::start_walkers()
+// each walker is drawn around the current values, at a normal distance with the sampler
+// variance of each parameter as its standard deviation, until its posterior is finite
+{
+	const size_t d = activeIndex.size();
+	const size_t numWalkers = 2 * (d + 1);
+	std::vector<double> sd (d);
+	for(size_t i = 0; i < d; i++)
+		sd[i] = parameters.sampler_variance(parameters.names()[activeIndex[i]]);
+
+	walkers.assign(numWalkers, std::vector<double> (d));
+	walkerPosterior.assign(numWalkers, -INFINITY);
+	walkerLL.assign(numWalkers, 0.0);
+	std::vector<size_t> pending;
+	for(size_t k = 0; k < numWalkers; k++)
+		pending.push_back(k);
+	for(int attempt = 0; attempt < maxStartAttempts and not pending.empty(); attempt++)
+	{
+		std::vector<std::vector<double> > x;
+		for(size_t k = 0; k < pending.size(); k++)
+		{
+			std::vector<double> xk (d);
+			for(size_t i = 0; i < d; i++)
+				xk[i] = parameters.values()[activeIndex[i]] +
+						gsl_ran_gaussian(rng.get(), sd[i]);
+			x.push_back(xk);
+		}
+		std::vector<double> ll;
+		const std::vector<double> lp = log_posterior(x, ll);
+		std::vector<size_t> stillPending;
+		for(size_t k = 0; k < pending.size(); k++)
+		{
+			if(std::isinf(lp[k]))
+			{
+				stillPending.push_back(pending[k]);
+				continue;
+			}
+			walkers[pending[k]] = x[k];
+			walkerPosterior[pending[k]] = lp[k];
+			walkerLL[pending[k]] = ll[k];
+		}
+		pending.swap(stillPending);
+	}
+	if(not pending.empty())
+		throw std::runtime_error("Ensemble: could not start the walkers at a finite "
+				"posterior around the initial values");
+}
+
+
+int Ensemble::update_half(size_t half)
+// stretch moves of the walkers of one half towards the other: walker k moves to
+// Y = X_j + z (X_k - X_j), for a walker j of the other half and g(z) proportional to 
+// 1 / sqrt(z) on [1 / a, a], with probability min(1, z^(d - 1) p(Y) / p(X_k)). The
+// proposals do not depend on each other, so their likelihoods come from a single batched
+// pass; returns the number accepted
+{
+	const size_t d = activeIndex.size();
+	const size_t halfSize = walkers.size() / 2;
+	const size_t first = half * halfSize, other = (1 - half) * halfSize;
+
+	std::vector<std::vector<double> > proposals (halfSize, std::vector<double> (d));
+	std::vector<double> z (halfSize);
+	for(size_t k = 0; k < halfSize; k++)
+	{
+		// z = ((a - 1) u + 1)^2 / a has the density g(z) on [1 / a, a]
+		const double u = gsl_rng_uniform(rng.get());
+		z[k] = std::pow((stretchScale - 1) * u + 1, 2) / stretchScale;
+		const std::vector<double> & xj = walkers[other +
+				gsl_rng_uniform_int(rng.get(), halfSize)];
+		const std::vector<double> & xk = walkers[first + k];
+		for(size_t i = 0; i < d; i++)
+			proposals[k][i] = xj[i] + z[k] * (xk[i] - xj[i]);
+	}
+
+	std::vector<double> proposalLL;
+	const std::vector<double> proposalPosterior = log_posterior(proposals, proposalLL);
+	int numAccepted = 0;
+	for(size_t k = 0; k < halfSize; k++)
+	{
+		if(std::isinf(proposalPosterior[k]))
+			continue;
+		const double logRatio = (d - 1.0) * std::log(z[k]) + proposalPosterior[k] -
+				walkerPosterior[first + k];
+		if(std::log(gsl_rng_uniform(rng.get())) >= logRatio)
+			continue;
+		walkers[first + k].swap(proposals[k]);
+		walkerPosterior[first + k] = proposalPosterior[k];
+		walkerLL[first + k] = proposalLL[k];
+		numAccepted++;
+	}
+	return numAccepted;
+}
+
+
+void Ensemble::save_walkers(bool saveDeviance)
+// every walker is a sample of the iteration; the engine's parameters are left at the
+// first walker
+{
+	for(size_t k = 0; k < walkers.size(); k++)
+	{
+		for(size_t i = 0; i < activeIndex.size(); i++)
+			parameters.update(activeIndex[i], walkers[k][i]);
+		currentSamples.push_back(parameters.current_state());
+		if(saveDeviance)
+			sampleDeviance.push_back(std::pair<double, int>(-2 * walkerLL[k], 1));
+	}
+	for(size_t i = 0; i < activeIndex.size(); i++)
+		parameters.update(activeIndex[i], walkers[0][i]);
+	parameters.increment();
+	currentLL = walkerLL[0];
+	currentPosteriorProb = walkerPosterior[0];
+}
+
+} // namespace
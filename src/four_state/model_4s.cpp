@@ -1,170 +1,209 @@
-#include "../../hdr/model.hpp"
+/*
+STModel-MCMC : model_4s.cpp
+	
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+	
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+	  
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+	
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+	
 
-namespace STM
-{
-	enum class StateTypes: char
-	{
-		T = 'T',
-		B = 'B',
-		M = 'M',
-		R = 'R'
-	};
-}
+*/
+
+#include "../../hdr/model_4s.hpp"
+#include "../../hdr/likelihood.hpp"
+#include <algorithm>
+#include <cmath>
 
 namespace STMModel
 {
 
-// static variable and function definition
-STM::PrevalenceModelTypes STMTransition::prevalenceModel = STM::PrevalenceModelTypes::Empirical;
-void STMTransition::set_prevalence_model(const STM::PrevalenceModelTypes &pr)
-{
-	// PrevalenceModelTypes::STM is not implemented in the 4-state model so we set it
-	// to empirical prevalence in that case
-	if(pr == STM::PrevalenceModelTypes::STM)
-		STMTransition::prevalenceModel = STM::PrevalenceModelTypes::Empirical;
-	else
-		STMTransition::prevalenceModel = pr;
+constexpr size_t FourStateModel::numStates;
+constexpr size_t FourStateModel::numRates;
+
+
+namespace {
+	std::vector<bool> valid_transitions()
+	{
+		std::vector<bool> valid (FourStateModel::numStates * FourStateModel::numStates, true);
+		valid[FourStateModel::transition_type(FourStateModel::T, FourStateModel::B)] = false;
+		valid[FourStateModel::transition_type(FourStateModel::B, FourStateModel::T)] = false;
+		return valid;
+	}
 }
 
 
-std::vector<char> State::state_names()
+const ModelDescription & FourStateModel::description()
 {
-	std::vector<char> result = {'T','B', 'M', 'R'};
-	return result;
+	// rates used by the transitions out of each state (in the order T, B, M, R)
+	static const ModelDescription desc = { 
+			"4state", 
+			{'T', 'B', 'M', 'R'}, 
+			{ {"alpha_b", "ab"}, {"alpha_t", "at"}, {"beta_b", "bb"}, {"beta_t", "bt"}, 
+					{"theta", "th"}, {"theta_t", "tt"}, {"epsilon", "e"} },
+			{ {beta_b, epsilon}, {beta_t, epsilon}, {theta, theta_t, epsilon}, 
+					{alpha_b, alpha_t} },
+			valid_transitions(),
+			true };
+	return desc;
 }
 
 
-std::map<STM::StateTypes, std::map<STM::StateTypes, TransProbFunction> > STMTransition::transitionFunctions;
-
 /*
-	This function encodes the four state model
-	It stores function generators in the transitionFunctions object
-	This object is a 2-D map, so that transitionFunctions[STM::StateTypes::A][STM::StateTypes::B]
-	contains a function generator
+	Equilibrium prevalence
+	With eR = 1 - eT - eB - eM, the fixed point of G(e) = e * P(e) is solved for 
+	(eT, eB, eM) with Newton's method, using the analytical Jacobian of G. All R 
+	(eR = 1) is always a fixed point, since R can only be colonized from occupied 
+	cells; it is the stable one only when the nontrivial equilibrium does not exist. 
+	Without a starting point, the cells first take coldSteps plain iterations 
+	e <- G(e) from equal prevalences, which move them towards the stable fixed point, 
+	before Newton's method is used. Newton steps are projected back onto the simplex, so 
+	they land exactly on the equilibria where a state is absent (such as T or B alone, 
+	when one outcompetes the other); a cell with a singular Jacobian takes a plain 
+	iteration instead
 	
-	when called (with a parameter e giving the expected values, i.e., prevalence) from a 
-	transition object, it returns a function taking a parameter set p as a parameter
-	
-	this function returns the transition probability from STM::StateTypes::A to STM::StateTypes::B
-	given the parameters and the prevalence
+	The cells are iterated in lock step, so that the loop over cells is vectorized;
+	iterations stop when every cell's residual is below tolerance, so the result 
+	depends only on which cells are solved together, not on the number of threads
 */
-void STMTransition::setup_transition_functions()
-{
-
-
-	// shorten the names for this function
-	using S = STM::StateTypes;
-	std::map<STM::StateTypes, std::map<STM::StateTypes, TransProbFunction> > &tf = 
-			STMTransition::transitionFunctions;
-
-	// T -> R, B -> R, M -> R
-	tf[S::T][S::R] = tf[S::B][S::R] = tf[S::M][S::R] = [](STM::ParMap &p, STM::StateMap &e) 
-	{ return p["epsilon"]; };
-	
-	// T -> M
-	tf[S::T][S::M] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return p["beta_b"] * (e.at(S::B) + e.at(S::M)) * (1.0 - tf[S::T][S::R](p, e)); };
-	
-	// T -> T
-	tf[S::T][S::T] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return 1.0 - tf[S::T][S::R](p, e) - tf[S::T][S::M](p, e); }; 
-
-	// B -> M
-	tf[S::B][S::M] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{  return p["beta_t"] * (e.at(S::T) + e.at(S::M)) * (1.0 - tf[S::B][S::R](p, e)); };
-
-	// B -> B
-	tf[S::B][S::B] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return 1.0 - tf[S::B][S::R](p, e) - tf[S::B][S::M](p, e); }; 
-
-	// M -> T
-	tf[S::M][S::T] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return p["theta"] * p["theta_t"] * (1.0 - tf[S::M][S::R](p, e)); }; 
-
-	// M -> B
-	tf[S::M][S::B] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return p["theta"] * (1 - p["theta_t"]) * (1.0 - tf[S::M][S::R](p, e)); }; 
-
-	// M -> M
-	tf[S::M][S::M] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return 1.0 - tf[S::M][S::T](p, e) - tf[S::M][S::B](p, e) - tf[S::M][S::R](p, e); };
-
-	// R -> T
-	tf[S::R][S::T] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{ return p["alpha_t"] * (e.at(S::M) + e.at(S::T)) *  
-				(1 - p["alpha_b"]*(e.at(S::B)+e.at(S::M))); 
-		};
-
-	// R -> B
-	tf[S::R][S::B] = [](STM::ParMap &p, STM::StateMap &e) 
-		{ return p["alpha_b"] * (e.at(S::M) + e.at(S::B)) * 
-				(1 - p["alpha_t"]*(e.at(S::T)+e.at(S::M)));
-		};
-
-	// R -> M
-	tf[S::R][S::M] = [](STM::ParMap &p, STM::StateMap &e) 
-		{ return p["alpha_b"] * (e.at(S::M) + e.at(S::B)) * 
-				(p["alpha_t"] * (e.at(S::M) + e.at(S::T)));
-		};
-
-	// R -> R
-	tf[S::R][S::R] = [&tf](STM::ParMap &p, STM::StateMap &e) 
-		{  return 1.0 - tf[S::R][S::T](p, e) - tf[S::R][S::B](p, e) - 
-				tf[S::R][S::M](p, e);
-		};
-}
-
+namespace {
+	const size_t coldSteps = 20;
+	const size_t maxSteps = 200;
+	const double tolerance = 1e-13;
 
+	// the rates of one cell that do not depend on the prevalence
+	struct CellRates
+	{
+		double s, at, ab, bt, bb, pMT, pMB, pMM;
+	};
 
-void State::self_check()
-{
-	using S = STM::StateTypes;
-	if(theState != S::T and theState != S::B and theState != S::M and theState != S::R)
-		invalid_state();
+	inline CellRates cell_rates(const STM::ParValue * const * rates, size_t k)
+	{
+		typedef FourStateModel M;
+		const double s = 1.0 - rates[M::epsilon][k], th = rates[M::theta][k];
+		const double tt = rates[M::theta_t][k];
+		return { s, rates[M::alpha_t][k], rates[M::alpha_b][k], rates[M::beta_t][k] * s, 
+				rates[M::beta_b][k] * s, th * tt * s, th * (1.0 - tt) * s, (1.0 - th) * s };
+	}
+
+	// one plain iteration, G(e), from the prevalence (t, b, m)
+	inline void iterate(const CellRates & c, double t, double b, double m, double & gT, 
+			double & gB, double & gM)
+	{
+		const double r = 1.0 - t - b - m;
+		const double colT = c.at * (t + m), colB = c.ab * (b + m);
+		const double mT = c.bb * (b + m), mB = c.bt * (t + m);
+		gT = t * (c.s - mT) + m * c.pMT + r * colT * (1.0 - colB);
+		gB = b * (c.s - mB) + m * c.pMB + r * colB * (1.0 - colT);
+		gM = t * mT + b * mB + m * c.pMM + r * colT * colB;
+	}
+
+	inline double max_abs(double x, double y, double z)
+	{ return std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z))); }
 }
 
 
-
-
-STM::ParMap STMTransition::generate_transform_rates(const STM::ParMap & p) const
+void FourStateModel::equilibrium(size_t n, const STM::ParValue * const * rates, 
+		STM::ParValue * prev, bool warm)
 {
-	STM::ParMap transformLogitParams;
-	transformLogitParams["alpha_b"] = p.at("ab0") + p.at("ab1")*env1 + p.at("ab2")*env2 + 
-			p.at("ab3")*pow(env1,2) + p.at("ab4")*pow(env2,2) + p.at("ab5")*pow(env1,3) + 
-			p.at("ab6")*pow(env2,3);
-			
-	transformLogitParams["alpha_t"] = p.at("at0") + p.at("at1")*env1 + p.at("at2")*env2 + 
-			p.at("at3")*pow(env1,2) + p.at("at4")*pow(env2,2) + p.at("at5")*pow(env1,3) + 
-			p.at("at6")*pow(env2,3);
-
-	transformLogitParams["beta_b"] = p.at("bb0") + p.at("bb1")*env1 + p.at("bb2")*env2 + 
-			p.at("bb3")*pow(env1,2) + p.at("bb4")*pow(env2,2) + p.at("bb5")*pow(env1,3) + 
-			p.at("bb6")*pow(env2,3);
-
-	transformLogitParams["beta_t"] = p.at("bt0") + p.at("bt1")*env1 + p.at("bt2")*env2 + 
-			p.at("bt3")*pow(env1,2) + p.at("bt4")*pow(env2,2) + p.at("bt5")*pow(env1,3) + 
-			p.at("bt6")*pow(env2,3);
-
-	transformLogitParams["theta"] = p.at("th0") + p.at("th1")*env1 + p.at("th2")*env2 + 
-			p.at("th3")*pow(env1,2) + p.at("th4")*pow(env2,2) + p.at("th5")*pow(env1,3) + 
-			p.at("th6")*pow(env2,3);
-
-	transformLogitParams["theta_t"] = p.at("tt0") + p.at("tt1")*env1 +  p.at("tt2")*env2 + 
-			p.at("tt3")*pow(env1,2) + p.at("tt4")*pow(env2,2) + p.at("tt5")*pow(env1,3) + 
-			p.at("tt6")*pow(env2,3);
-
-	transformLogitParams["epsilon"] = p.at("e0") + p.at("e1")*env1 + p.at("e2")*env2 + 
-			p.at("e3")*pow(env1,2) + p.at("e4")*pow(env2,2) + p.at("e5")*pow(env1,3) + 
-			p.at("e6")*pow(env2,3);
-	
-	return transformLogitParams;
+	const size_t NS = numStates;
+	STM::ParValue eT [chunkSize], eB [chunkSize], eM [chunkSize];
+	for(size_t j0 = 0; j0 < n; j0 += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, n - j0);
+		STM::ParValue * pr = prev + j0 * NS;
+		for(size_t j = 0; j < len; j++)
+		{
+			eT[j] = warm ? pr[j * NS + T] : 0.25;
+			eB[j] = warm ? pr[j * NS + B] : 0.25;
+			eM[j] = warm ? pr[j * NS + M] : 0.25;
+		}
+
+		for(size_t step = 0; step < maxSteps; step++)
+		{
+			const bool newton = warm or step >= coldSteps;
+			double maxResidual = 0;
+			#pragma omp simd reduction(max:maxResidual)
+			for(size_t j = 0; j < len; j++)
+			{
+				const CellRates c = cell_rates(rates, j0 + j);
+				const double t = eT[j], b = eB[j], m = eM[j], r = 1.0 - t - b - m;
+				double gT, gB, gM;
+				iterate(c, t, b, m, gT, gB, gM);
+				const double fT = gT - t, fB = gB - b, fM = gM - m;
+
+				// Jacobian of G(e) - e
+				const double colT = c.at * (t + m), colB = c.ab * (b + m);
+				const double mT = c.bb * (b + m), mB = c.bt * (t + m);
+				const double pTT = c.s - mT, pBB = c.s - mB;
+				const double pRT = colT * (1.0 - colB), pRB = colB * (1.0 - colT);
+				const double pRM = colT * colB;
+				const double jTT = pTT - pRT + r * c.at * (1.0 - colB) - 1.0;
+				const double jTB = -t * c.bb - pRT - r * colT * c.ab;
+				const double jTM = -t * c.bb + c.pMT - pRT + r * (c.at * (1.0 - colB) - 
+						colT * c.ab);
+				const double jBT = -b * c.bt - pRB - r * colB * c.at;
+				const double jBB = pBB - pRB + r * c.ab * (1.0 - colT) - 1.0;
+				const double jBM = -b * c.bt + c.pMB - pRB + r * (c.ab * (1.0 - colT) - 
+						colB * c.at);
+				const double jMT = mT + b * c.bt - pRM + r * c.at * colB;
+				const double jMB = t * c.bb + mB - pRM + r * colT * c.ab;
+				const double jMM = t * c.bb + b * c.bt + c.pMM - pRM + r * (c.at * colB + 
+						colT * c.ab) - 1.0;
+
+				// Newton step: solve J d = -f by Cramer's rule
+				const double cT = jBB * jMM - jBM * jMB;
+				const double cB = jBM * jMT - jBT * jMM;
+				const double cM = jBT * jMB - jBB * jMT;
+				const double det = jTT * cT + jTB * cB + jTM * cM;
+				const double dT = -(fT * cT + fB * (jTM * jMB - jTB * jMM) + 
+						fM * (jTB * jBM - jTM * jBB)) / det;
+				const double dB = -(fT * cB + fB * (jTT * jMM - jTM * jMT) + 
+						fM * (jTM * jBT - jTT * jBM)) / det;
+				const double dM = -(fT * cM + fB * (jTB * jMT - jTT * jMB) + 
+						fM * (jTT * jBB - jTB * jBT)) / det;
+
+				// project the Newton step back onto the simplex
+				const double pT = std::max(0.0, t + dT), pB = std::max(0.0, b + dB);
+				const double pM = std::max(0.0, m + dM), tot = pT + pB + pM;
+				const double norm = tot > 1.0 ? 1.0 / tot : 1.0;
+
+				// cells that have converged keep their values, so that solving again from
+				// a solution returns exactly the same prevalence
+				const double res = max_abs(fT, fB, fM);
+				const bool done = res < tolerance;
+				const bool useNewton = newton and std::isfinite(dT + dB + dM);
+				eT[j] = done ? t : (useNewton ? pT * norm : gT);
+				eB[j] = done ? b : (useNewton ? pB * norm : gB);
+				eM[j] = done ? m : (useNewton ? pM * norm : gM);
+				maxResidual = std::max(maxResidual, res);
+			}
+			if(newton and maxResidual < tolerance)
+				break;
+		}
+
+		for(size_t j = 0; j < len; j++)
+		{
+			pr[j * NS + T] = eT[j];
+			pr[j * NS + B] = eB[j];
+			pr[j * NS + M] = eM[j];
+			pr[j * NS + R] = std::max(0.0, 1.0 - eT[j] - eB[j] - eM[j]);
+		}
+	}
 }
 
+} // !namespace STMModel
 
-void STMTransition::compute_stm_prevalence(const STM::ParMap &rates)
-{
-	// stm prevalence is not implemented in the 4-state model as it is not solvable
-	return;
-}
 
-}
\ No newline at end of file
+// the likelihood of the four state model is compiled here
+template class STMLikelihood::ModelLikelihood<STMModel::FourStateModel>;
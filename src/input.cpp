@@ -47,7 +47,21 @@ std::vector<std::string> SerializationData::at(const std::string & key) const
 
 
 STMInputHelper::STMInputHelper (const char * filename, InputType type, 
-		char delim): prevalenceBaseName("prevalence")
+		char delim): prevalenceBaseName("prevalence"), model(nullptr)
+{
+	read_file(filename, type, delim);
+}
+
+
+STMInputHelper::STMInputHelper (const char * filename, InputType type, 
+		const STMModel::ModelDescription & model, char delim): 
+		prevalenceBaseName("prevalence"), model(&model)
+{
+	read_file(filename, type, delim);
+}
+
+
+void STMInputHelper::read_file(const char * filename, InputType type, char delim)
 {
 	switch(type)
 	{
@@ -66,6 +80,8 @@ STMInputHelper::STMInputHelper (const char * filename, InputType type,
 
 void STMInputHelper::setup_transitions(const char * filename, char delim)
 {
+	if(not model)
+		throw std::runtime_error("STMInputHelper: reading transitions requires the model");
 	std::ifstream transFile;
 	transFile.open(filename);
 	if(not transFile.is_open())
@@ -190,6 +206,28 @@ std::vector<STMModel::STMTransition> STMInputHelper::transitions()
 { return trans; }
 
 
+size_t STMInputHelper::compact_transitions()
+// merges identical transitions into a single record with a multiplicity
+// the order of first appearance is preserved; returns the number of unique transitions
+{
+	std::map<STMModel::STMTransition, size_t> uniqueIndex;
+	std::vector<STMModel::STMTransition> compacted;
+	for(const auto & tr : trans)
+	{
+		auto pos = uniqueIndex.find(tr);
+		if(pos == uniqueIndex.end())
+		{
+			uniqueIndex[tr] = compacted.size();
+			compacted.push_back(tr);
+		}
+		else
+			compacted[pos->second].merge(tr);
+	}
+	trans = compacted;
+	return trans.size();
+}
+
+
 
 std::map<std::string, int> STMInputHelper::get_col_numbers(std::vector<std::string> cNames)
 {
@@ -296,12 +334,13 @@ void STMInputHelper::display_transition_help() const
 	std::cerr << "Note that the first row must contain column names, and names much match exactly\n";
 	std::cerr << "        initial -- the initial state of the plot\n";
 	std::cerr << "        final -- the final state of the plot\n";
-	std::cerr << "        env1 -- the first environmental variable (temperature)\n";
-	std::cerr << "        env2 -- the second environmental variable (precipitation)\n";
+	std::cerr << "        env1, env2, ... -- the environmental variables (e.g., temperature and\n";
+	std::cerr << "            precipitation); at least env1 is required, and the columns are read\n";
+	std::cerr << "            up to the first missing number\n";
 	std::cerr << "        interval -- number of years between the two samples\n";
 	
 	
-	std::vector<char> states = STMModel::State::state_names();
+	std::vector<char> states = model->stateNames;
 	std::cerr << "Prevalence columns: at least " << states.size() - 1 << " of the ";
 	std::cerr << states.size() << " are required\n";
 	for(auto st : states)
@@ -318,7 +357,7 @@ std::map<char, double> STMInputHelper::read_prevalence(std::vector<std::string>
 {
 	// build a map of prevalence values
 	std::map<char, double> prevalence;
-	std::vector<char> states = STMModel::State::state_names();
+	std::vector<char> states = model->stateNames;
 	std::vector<char> notFound;
 	std::out_of_range lastOOR ("");
 	for(auto st : states)
@@ -353,17 +392,32 @@ void STMInputHelper::read_transitions(std::ifstream &file, char delim)
 	std::vector<std::string> line;
 	int ln = 0;
 
+	// environmental variables are the columns env1, env2, ... up to the first missing one
+	std::vector<int> envCols;
+	for(int v = 1; ; v++)
+	{
+		std::ostringstream envName;
+		envName << "env" << v;
+		auto col = transColIndices.find(envName.str());
+		if(col == transColIndices.end())
+			break;
+		envCols.push_back(col->second);
+	}
+	if(envCols.empty())
+		throw std::out_of_range("env1");
+
+	std::vector<double> env (envCols.size());
 	while(get_next_line(file, line, delim)) {
 		++ln;
 		if(line.empty()) continue;
 		std::map<char, double> prev = read_prevalence(line);
 		char initial = str_convert<char>(line.at(transColIndices.at("initial")));
 		char final = str_convert<char>(line.at(transColIndices.at("final")));
-		double env1 = str_convert<double>(line.at(transColIndices.at("env1")));
-		double env2 = str_convert<double>(line.at(transColIndices.at("env2")));
+		for(size_t v = 0; v < envCols.size(); v++)
+			env[v] = str_convert<double>(line.at(envCols[v]));
 		int interval = str_convert<int>(line.at(transColIndices.at("interval")));
 
-		trans.push_back(STMModel::STMTransition(initial, final, env1, env2, prev, interval));
+		trans.push_back(STMModel::STMTransition(*model, initial, final, env, prev, interval));
 	}
 }
 
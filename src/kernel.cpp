@@ -0,0 +1,54 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	kernel.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Runtime selection of the likelihood kernel
+	Define STM_NO_SIMD when building without the AVX2 and AVX-512 versions of
+	kernel_isa.cpp (e.g., on non-x86 machines); see the makefile.
+*/
+
+#include "../hdr/kernel.hpp"
+
+namespace STMKernel {
+
+namespace generic { const Kernel & kernel(); }
+#ifndef STM_NO_SIMD
+namespace avx2 { const Kernel & kernel(); }
+namespace avx512 { const Kernel & kernel(); }
+#endif
+
+
+const Kernel & kernel()
+{
+	static const Kernel & k = []() -> const Kernel &
+	{
+	#ifndef STM_NO_SIMD
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx512f"))
+			return avx512::kernel();
+		if(__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+			return avx2::kernel();
+	#endif
+		return generic::kernel();
+	}();
+	return k;
+}
+
+} // !STMKernel namespace
@@ -0,0 +1,164 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	kernel_isa.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	Batch functions of the likelihood kernel (see kernel.hpp)
+	This file is compiled once per instruction set, with STM_KERNEL_ISA set to the
+	name of the instruction set (e.g., -DSTM_KERNEL_ISA=avx2 -mavx2); see the makefile.
+	The loops are written so that the compiler vectorizes them for whatever instruction
+	set it is targeting.
+*/
+
+#include <limits>
+#include <cmath>
+#include "../hdr/kernel.hpp"
+#include "../hdr/vecmath.hpp"
+
+#ifndef STM_KERNEL_ISA
+#define STM_KERNEL_ISA generic
+#endif
+
+#define STM_STR(x) #x
+#define STM_XSTR(x) STM_STR(x)
+
+namespace STMKernel {
+namespace STM_KERNEL_ISA {
+
+void interval_rates(const double * logit, double ratio, size_t n, double * rate)
+// 1 - inv_logit(x) = 1/(1 + exp(x)), so (1 - inv_logit(x))^ratio = exp(-ratio * softplus(x))
+{
+	if(ratio == 1.0)
+	{
+		#pragma omp simd
+		for(size_t i = 0; i < n; i++)
+			rate[i] = 1.0 / (1.0 + vexp(-logit[i]));
+	}
+	else
+	{
+		#pragma omp simd
+		for(size_t i = 0; i < n; i++)
+			rate[i] = 1.0 - vexp(-ratio * vsoftplus(logit[i]));
+	}
+}
+
+
+void interval_rates_gradient(const double * logit, double ratio, size_t n, double * rate,
+		double * slope)
+// with q = (1 - inv_logit(x))^ratio, rate = 1 - q and d rate / dx = ratio * inv_logit(x) * q
+{
+	if(ratio == 1.0)
+	{
+		#pragma omp simd
+		for(size_t i = 0; i < n; i++)
+		{
+			rate[i] = 1.0 / (1.0 + vexp(-logit[i]));
+			slope[i] = rate[i] * (1.0 - rate[i]);
+		}
+	}
+	else
+	{
+		#pragma omp simd
+		for(size_t i = 0; i < n; i++)
+		{
+			const double q = vexp(-ratio * vsoftplus(logit[i]));
+			rate[i] = 1.0 - q;
+			slope[i] = ratio * q / (1.0 + vexp(-logit[i]));
+		}
+	}
+}
+
+
+template<typename T>
+void update_logits(const double * logit, double delta, const T * term, size_t n,
+		double * result)
+{
+	#pragma omp simd
+	for(size_t i = 0; i < n; i++)
+		result[i] = logit[i] + delta * double(term[i]);
+}
+
+
+template<typename T>
+void multiply(const T * a, size_t lda, size_t n, size_t inner, const double * b,
+		size_t numColumns, double * c)
+{
+	for(size_t j = 0; j < numColumns; j++)
+	{
+		const double * bj = b + j * inner;
+		double * cj = c + j * n;
+		#pragma omp simd
+		for(size_t i = 0; i < n; i++)
+			cj[i] = bj[0] * double(a[i]);
+		for(size_t k = 1; k < inner; k++)
+		{
+			const T * ak = a + k * lda;
+			#pragma omp simd
+			for(size_t i = 0; i < n; i++)
+				cj[i] += bj[k] * double(ak[i]);
+		}
+	}
+}
+
+
+template<typename T>
+void transpose_multiply(const T * a, size_t lda, size_t n, size_t inner, const double * x,
+		double * c)
+{
+	for(size_t k = 0; k < inner; k++)
+	{
+		const T * ak = a + k * lda;
+		double sum = 0;
+		#pragma omp simd reduction(+:sum)
+		for(size_t i = 0; i < n; i++)
+			sum += double(ak[i]) * x[i];
+		c[k] += sum;
+	}
+}
+
+
+template<typename T>
+double sum_log(const double * lik, const T * weight, size_t n)
+{
+	const double lower = std::numeric_limits<double>::denorm_min();
+	const double upper = 1.0 - std::numeric_limits<double>::epsilon() / 2;
+	double sum = 0;
+	#pragma omp simd reduction(+:sum)
+	for(size_t i = 0; i < n; i++)
+	{
+		// guard against infinite likelihoods
+		double l = lik[i] == 0 ? lower : lik[i];
+		l = l == 1 ? upper : l;
+		sum += double(weight[i]) * vlog(l);
+	}
+	return sum;
+}
+
+
+const Kernel & kernel()
+{
+	static const Kernel k = { STM_XSTR(STM_KERNEL_ISA), interval_rates, 
+			interval_rates_gradient, update_logits<double>, multiply<double>, 
+			transpose_multiply<double>, sum_log<double>, update_logits<float>, 
+			multiply<float>, transpose_multiply<float>, sum_log<float> };
+	return k;
+}
+
+} // !STM_KERNEL_ISA namespace
+} // !STMKernel namespace
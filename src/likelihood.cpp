@@ -21,40 +21,72 @@
 	
 
 
-	This program takes advantage of the openMP library to speed execution on multi-core
-	systems. See the makefile and associated documentation for instructions on building
-	for multi-threaded usage. The global constant S_NUM_THREADS defines how many threads
-	to use; for ideal performance, this should be 1 or 2 less than the number of physical
-	CPU cores on your machine; the value used here (11) was tested for optimum performance
-	on an 12-core Mac Pro.
+	The likelihood is computed in parallel by a persistent pool of worker threads (see 
+	threadpool.hpp); the number of threads is set with the -c option. For ideal 
+	performance, this should be no more than the number of physical CPU cores on the 
+	machine.
 
 */
 
 #include <cmath>
 #include <algorithm>
-#include <omp.h>
 #include <iostream>
 #include <gsl/gsl_randist.h>
 #include "../hdr/likelihood.hpp"
+#include "../hdr/kernel.hpp"
 #include "../hdr/parameters.hpp"
 #include "../hdr/input.hpp"
 
 using std::vector;
 
+namespace {
+	// number of parameter sets whose logits are computed together in a batch
+	const size_t batchTile = 8;
+
+	// pairwise sum of x[0..n) in a fixed tree; the rounding error of each addition 
+	// (Knuth's two-sum) is carried up the tree in err
+	void tree_sum(const double * x, size_t n, double & sum, double & err)
+	{
+		if(n <= 1)
+		{
+			sum = n ? x[0] : 0;
+			err = 0;
+			return;
+		}
+		double s1, e1, s2, e2;
+		tree_sum(x, n / 2, s1, e1);
+		tree_sum(x + n / 2, n - n / 2, s2, e2);
+		sum = s1 + s2;
+		double b = sum - s1;
+		err = e1 + e2 + ((s1 - (sum - b)) + (s2 - b));
+	}
+}
+
 namespace STMLikelihood {
 
-Likelihood::Likelihood(const std::vector<STMModel::STMTransition> & transitionData, 
+Likelihood::Likelihood(const STMModel::ModelDescription & model,
+		const std::vector<STMModel::STMTransition> & transitionData, 
 		const std::string & transitionDataOriginFile, 
 		const std::map<std::string, PriorDist> & pr, unsigned int numThreads,
-		int parameterInterval) : transitions(transitionData), priors(pr), 
-		transitionFileName(transitionDataOriginFile), likelihoodThreads(numThreads), 
-		targetInterval(parameterInterval)
-{ }
+		int parameterInterval, STM::PrevalenceModelTypes prevModel, 
+		const STMModel::CovariateBasis & basis, bool singlePrecision, 
+		STMModel::RowOrder order, bool exactIntervals, unsigned int firstCpu) : 
+		transitions(transitionData, model, prevModel, basis, singlePrecision, order,
+		exactIntervals), 
+		targetInterval(parameterInterval), 
+		priors(pr), likelihoodThreads(numThreads), firstCpu(firstCpu), reproducible(false), 
+		firstTouch(true),
+		transitionFileName(transitionDataOriginFile)
+{
+	transitions.set_target_interval(targetInterval);
+	setup_threads();
+}
 
 
-Likelihood::Likelihood(STMInput::SerializationData sd, const std::vector<std::string> &parNames,
-		const std::vector<STMModel::STMTransition> & transitionData) : 
-		transitions(transitionData)
+Likelihood::Likelihood(const STMModel::ModelDescription & model, 
+		const STMInput::SerializationData & sd, const std::vector<std::string> &parNames,
+		const std::vector<STMModel::STMTransition> & transitionData, unsigned int firstCpu) : 
+		firstCpu(firstCpu), firstTouch(true)
 {
 	transitionFileName = sd.at("transitionFileName")[0];
 	likelihoodThreads = STMInput::str_convert<int>(sd.at("likelihoodThreads")[0]);
@@ -62,19 +94,173 @@ Likelihood::Likelihood(STMInput::SerializationData sd, const std::vector<std::st
 	std::vector<double> prSD = STMInput::str_convert<double>(sd.at("priorSD"));
 	std::vector<int> prFam = STMInput::str_convert<int>(sd.at("priorFamily"));
 	targetInterval = STMInput::str_convert<unsigned int>(sd.at("targetInterval")[0]);
+	try
+	{ 
+		reproducible = STMInput::str_convert<bool>(sd.at("reproducible")[0]); 
+	}
+	catch (std::out_of_range &e)
+	{
+		reproducible = false;	// resume data written before this option existed
+	}
 
-	STMModel::STMTransition::set_prevalence_model(STM::PrevalenceModelTypes(STMInput::str_convert<int>(sd.at("prevalenceModel")[0])));
-	if(STMModel::STMTransition::get_prevalence_model() != STM::PrevalenceModelTypes::Empirical)
+	STM::PrevalenceModelTypes prevModel = STM::PrevalenceModelTypes(
+			STMInput::str_convert<int>(sd.at("prevalenceModel")[0]));
+	STMModel::CovariateBasis basis;
+	try
+	{
+		basis = STMModel::CovariateBasis(sd);
+	}
+	catch (std::out_of_range &e)
 	{
-		for(auto tr : transitions)
-			tr.set_global_prevalence();
+		// resume data written before the basis was configurable: raw cubic, 2 variables
 	}
+	bool singlePrecision;
+	try
+	{
+		singlePrecision = STMInput::str_convert<bool>(sd.at("singlePrecision")[0]);
+	}
+	catch (std::out_of_range &e)
+	{
+		singlePrecision = false;
+	}
+	STMModel::RowOrder order;
+	try
+	{
+		order = STMModel::RowOrder(STMInput::str_convert<int>(sd.at("rowOrder")[0]));
+	}
+	catch (std::out_of_range &e)
+	{
+		order = STMModel::RowOrder::File;	// resume data written before rows were sorted
+	}
+	bool exactIntervals;
+	try
+	{
+		exactIntervals = STMInput::str_convert<bool>(sd.at("exactIntervals")[0]);
+	}
+	catch (std::out_of_range &e)
+	{
+		exactIntervals = false;
+	}
+	transitions = STMModel::TransitionTable(transitionData, model, prevModel, basis,
+			singlePrecision, order, exactIntervals);
+	transitions.set_target_interval(targetInterval);
 
 	for(int i = 0; i < parNames.size(); i++)
 	{
 		priors[parNames[i]] = PriorDist (prMean.at(i), prSD.at(i), 
 				PriorFamilies(prFam.at(i)));
 	}
+	setup_threads();
+}
+
+
+void Likelihood::setup_threads()
+// divides each block into one slice per worker; slices are aligned to the chunk size so
+// that a chunk is never shared between two workers
+{
+	pool.reset(new STMThreads::ThreadPool(likelihoodThreads, firstCpu));
+	const size_t numThreads = pool->size();
+	const size_t numBlocks = transitions.num_blocks();
+	sliceOffset.clear();
+	allBlocks.clear();
+	chunkOffset.assign(1, 0);
+	for(size_t b = 0; b < numBlocks; b++)
+	{
+		const size_t begin = transitions.block_begin(b);
+		const size_t end = transitions.block_end(b);
+		const size_t numChunks = (end - begin + STMModel::chunkSize - 1) / STMModel::chunkSize;
+		chunkOffset.push_back(chunkOffset.back() + numChunks);
+		const size_t chunksPerThread = (numChunks + numThreads - 1) / numThreads;
+		for(size_t w = 0; w <= numThreads; w++)
+			sliceOffset.push_back(std::min(end, begin + w * chunksPerThread * 
+					STMModel::chunkSize));
+		allBlocks.push_back(b);
+	}
+	transitions.place_rows(sliceOffset, firstTouch ? pool.get() : nullptr);
+
+	chunkSums.clear();
+	partialSums.clear();
+}
+
+
+void Likelihood::set_first_touch(bool f)
+{
+	firstTouch = f;
+	transitions.place_rows(sliceOffset, firstTouch ? pool.get() : nullptr);
+}
+
+
+void Likelihood::sum_blocks(const std::vector<size_t> & blocks, size_t width,
+		std::vector<double> & blockSums, const SliceFunction & sliceSum)
+// sliceSum(begin, end, sums) computes width sums over the transitions in [begin, end)
+// for each block b in blocks, sets blockSums[b * width + j] to the total of the j-th sum 
+// over all of the slices of b
+{
+	const size_t numThreads = pool->size();
+	const size_t numBlocks = transitions.num_blocks();
+	if(reproducible)
+	{
+		if(chunkSums.size() < chunkOffset.back() * width)
+			chunkSums.resize(chunkOffset.back() * width);
+		pool->run([&](unsigned int w)
+		{
+			for(const auto & b : blocks)
+			{
+				const size_t * slice = &sliceOffset[b * (numThreads + 1) + w];
+				for(size_t first = slice[0]; first < slice[1]; first += STMModel::chunkSize)
+				{
+					size_t chunk = chunkOffset[b] + 
+							(first - transitions.block_begin(b)) / STMModel::chunkSize;
+					sliceSum(first, std::min(first + STMModel::chunkSize, slice[1]), 
+							&chunkSums[chunk * width]);
+				}
+			}
+		});
+
+		std::vector<double> column;
+		for(const auto & b : blocks)
+		{
+			const size_t numChunks = chunkOffset[b + 1] - chunkOffset[b];
+			column.resize(numChunks);
+			for(size_t j = 0; j < width; j++)
+			{
+				for(size_t c = 0; c < numChunks; c++)
+					column[c] = chunkSums[(chunkOffset[b] + c) * width + j];
+				double sum, err;
+				tree_sum(column.data(), numChunks, sum, err);
+				blockSums[b * width + j] = sum + err;
+			}
+		}
+		return;
+	}
+
+	// each worker's partial sums are on their own cache lines
+	const size_t lineSize = 64 / sizeof(double);
+	const size_t stride = (numBlocks * width + lineSize - 1) / lineSize * lineSize;
+	if(partialSums.size() < numThreads * stride)
+		partialSums.resize(numThreads * stride);
+	pool->run([&](unsigned int w)
+	{
+		for(const auto & b : blocks)
+		{
+			const size_t * slice = &sliceOffset[b * (numThreads + 1) + w];
+			double * sums = &partialSums[w * stride + b * width];
+			if(slice[0] < slice[1])
+				sliceSum(slice[0], slice[1], sums);
+			else
+				std::fill(sums, sums + width, 0.0);
+		}
+	});
+	for(const auto & b : blocks)
+	{
+		for(size_t j = 0; j < width; j++)
+		{
+			double & sum = blockSums[b * width + j];
+			sum = 0;
+			for(size_t w = 0; w < numThreads; w++)
+				sum += partialSums[w * stride + b * width + j];
+		}
+	}
 }
 
 
@@ -82,10 +268,16 @@ std::string Likelihood::serialize(char s, const std::vector<STM::ParName> & parN
 {
 	std::ostringstream result;
 
+	result << "model" << s << transitions.model_description().name << "\n";
 	result << "transitionFileName" << s << transitionFileName << "\n";
 	result << "likelihoodThreads" << s << likelihoodThreads << "\n";
 	result << "targetInterval" << s << targetInterval << "\n";
-	result << "prevalenceModel" << s << int(STMModel::STMTransition::get_prevalence_model()) << "\n";
+	result << "reproducible" << s << reproducible << "\n";
+	result << "prevalenceModel" << s << int(transitions.prevalence_model()) << "\n";
+	result << "singlePrecision" << s << transitions.single_precision() << "\n";
+	result << "rowOrder" << s << int(transitions.row_order()) << "\n";
+	result << "exactIntervals" << s << transitions.exact_intervals() << "\n";
+	result << transitions.basis().serialize(s);
 
 	STM::ParMap prMean, prSD;
 	std::map<std::string, PriorFamilies> prFam;
@@ -115,28 +307,504 @@ std::string Likelihood::serialize(char s, const std::vector<STM::ParName> & parN
 
 double Likelihood::compute_log_likelihood(const STMParameters::STModelParameters & params)
 {
+	check_parameter_layout(params);
+	const STM::ParVector & par = params.values();
+	std::vector<STM::ParValue> prev;
+	if(uses_cells())
+	{
+		// start from the cached state's prevalence, if there is one
+		prev = cellPrevalence;
+		compute_prevalence(par, not prev.empty(), prev);
+	}
+	std::vector<double> blockSums (transitions.num_blocks());
+	if(uses_matrices())
+	{
+		std::vector<STM::ParValue> matrices;
+		compute_matrices(par, prev.data(), matrices);
+		sum_blocks(allBlocks, 1, blockSums, [&](size_t begin, size_t end, double * sum)
+				{ *sum = matrix_slice(begin, end, matrices.data()); });
+	}
+	else
+		sum_blocks(allBlocks, 1, blockSums, [&](size_t begin, size_t end, double * sum)
+				{ *sum = compute_slice(begin, end, par, prev.data()); });
+
 	double sumlogl = 0;
+	for(const auto & bl : blockSums)
+		sumlogl += bl;
+	return sumlogl;
+}
 
-	omp_set_num_threads(likelihoodThreads);
-	{
-	#pragma omp parallel for default(shared) reduction(+:sumlogl)
-		for(int i = 0; i < transitions.size(); i++)
-		{
-			STMModel::STMTransition & dat = transitions.at(i);
-			long double lik = dat.transition_prob(params.current_state(), targetInterval);
-			// guard against infinite likelihoods
-			if(lik == 0)
-				lik = nextafter(0,1);
-			else if(lik == 1)
-				lik = nextafter(1,0);
-			sumlogl += std::log(lik);
-		} // ! for i
-	} // !parallel for
-	
+
+std::vector<double> Likelihood::compute_log_likelihood(
+		const std::vector<STMParameters::STModelParameters> & params)
+{
+	if(params.empty())
+		return std::vector<double> ();
+	if(uses_matrices())
+	{
+		// the matrices of each set are computed in turn; there is no shared product
+		std::vector<double> sumlogl;
+		for(const auto & p : params)
+			sumlogl.push_back(compute_log_likelihood(p));
+		return sumlogl;
+	}
+	check_parameter_layout(params[0]);
+	const size_t numSets = params.size();
+	const size_t numCoef = transitions.num_rates() * transitions.num_terms();
+	std::vector<double> coef (numSets * numCoef);
+	for(size_t k = 0; k < numSets; k++)
+		transitions.coefficient_matrix(params[k].values(), &coef[k * numCoef]);
+
+	std::vector<STM::ParValue> prev;
+	if(uses_cells())
+	{
+		const size_t cellValues = cellPrevalence.size();
+		const bool warm = not cellPrevalence.empty();
+		prev.resize(numSets * transitions.num_cells() * transitions.model_description().
+				num_states());
+		for(size_t k = 0; k < numSets; k++)
+		{
+			if(warm)
+				std::copy(cellPrevalence.begin(), cellPrevalence.end(), 
+						prev.begin() + k * cellValues);
+			compute_prevalence(&coef[k * numCoef], warm, 
+					&prev[k * prev.size() / numSets]);
+		}
+	}
+
+	std::vector<double> blockSums (transitions.num_blocks() * numSets);
+	sum_blocks(allBlocks, numSets, blockSums, [&](size_t begin, size_t end, double * sums)
+			{ compute_batch_slice(begin, end, coef, numSets, prev.data(), sums); });
+
+	std::vector<double> sumlogl (numSets, 0);
+	for(size_t b = 0; b < transitions.num_blocks(); b++)
+	{
+		for(size_t k = 0; k < numSets; k++)
+			sumlogl[k] += blockSums[b * numSets + k];
+	}
+	return sumlogl;
+}
+
+
+double Likelihood::compute_log_likelihood_and_gradient(
+		const STMParameters::STModelParameters & params, STM::ParVector & gradient)
+{
+	if(uses_matrices())
+		throw std::runtime_error("Likelihood: the gradient is not available with exact " 
+				"intervals");
+	check_parameter_layout(params);
+	const STM::ParVector & par = params.values();
+	const size_t numStates = transitions.model_description().num_states();
+	const size_t numCoef = transitions.num_rates() * transitions.num_terms();
+	std::vector<STM::ParValue> prev, rowDPrev;
+	if(uses_cells())
+	{
+		prev = cellPrevalence;
+		compute_prevalence(par, not prev.empty(), prev);
+		rowDPrev.resize(transitions.size() * numStates);
+	}
+
+	// the first of each block's sums is the likelihood, the others its gradient
+	const size_t width = 1 + numCoef;
+	std::vector<double> blockSums (transitions.num_blocks() * width);
+	sum_blocks(allBlocks, width, blockSums, [&](size_t begin, size_t end, double * sums)
+			{ gradient_slice(begin, end, par, prev.data(), 
+			uses_cells() ? rowDPrev.data() : nullptr, sums); });
+
+	double sumlogl = 0;
+	std::vector<double> coefGrad (numCoef, 0);
+	for(size_t b = 0; b < transitions.num_blocks(); b++)
+	{
+		sumlogl += blockSums[b * width];
+		for(size_t i = 0; i < numCoef; i++)
+			coefGrad[i] += blockSums[b * width + 1 + i];
+	}
+
+	if(uses_cells())
+	{
+		// through the equilibrium prevalence, in the fixed batches of compute_prevalence
+		std::vector<STM::ParValue> cellDPrev (transitions.num_cells() * numStates);
+		transitions.sum_by_cell(rowDPrev.data(), cellDPrev.data());
+		std::vector<double> coef (numCoef);
+		transitions.coefficient_matrix(par, coef.data());
+		const size_t numCells = transitions.num_cells();
+		const size_t numBatches = (numCells + STMModel::chunkSize - 1) / STMModel::chunkSize;
+		const size_t numThreads = pool->size();
+		std::vector<double> batchGrad (numBatches * numCoef, 0);
+		pool->run([&](unsigned int w)
+		{
+			for(size_t b = w; b < numBatches; b += numThreads)
+			{
+				const size_t first = b * STMModel::chunkSize;
+				cell_prevalence_gradient(first, std::min(STMModel::chunkSize, 
+						numCells - first), coef.data(), prev.data(), cellDPrev.data(), 
+						&batchGrad[b * numCoef]);
+			}
+		});
+		for(size_t b = 0; b < numBatches; b++)
+			for(size_t i = 0; i < numCoef; i++)
+				coefGrad[i] += batchGrad[b * numCoef + i];
+	}
+
+	gradient.assign(par.size(), 0.0);
+	transitions.parameter_gradient(coefGrad.data(), gradient);
+	return sumlogl;
+}
+
+
+double Likelihood::reset_log_likelihood(const STMParameters::STModelParameters & params)
+{
+	check_parameter_layout(params);
+	currentPars = params.values();
+	blockLogLik.resize(transitions.num_blocks());
+	if(uses_matrices())
+	{
+		if(uses_cells())
+			compute_prevalence(currentPars, not cellPrevalence.empty(), cellPrevalence);
+		compute_matrices(currentPars, cellPrevalence.data(), intervalMatrices);
+		sum_blocks(allBlocks, 1, blockLogLik, [&](size_t begin, size_t end, double * sum)
+				{ *sum = matrix_slice(begin, end, intervalMatrices.data()); });
+		double sumlogl = 0;
+		for(const auto & bl : blockLogLik)
+			sumlogl += bl;
+		return sumlogl;
+	}
+	if(logits.empty() and not firstTouch)
+	{
+		logits.assign(transitions.num_rates() * transitions.size(), 0.0);
+		proposalLogits.assign(transitions.size(), 0.0);
+	}
+	// otherwise left unset, for each worker to write its own rows first
+	logits.resize(transitions.num_rates() * transitions.size());
+	proposalLogits.resize(transitions.size());
+	if(uses_cells())
+		compute_prevalence(currentPars, not cellPrevalence.empty(), cellPrevalence);
+	sum_blocks(allBlocks, 1, blockLogLik, [&](size_t begin, size_t end, double * sum)
+			{ *sum = cache_log_likelihood(begin, end); });
+
+	double sumlogl = 0;
+	for(const auto & bl : blockLogLik)
+		sumlogl += bl;
+	return sumlogl;
+}
+
+
+double Likelihood::propose_log_likelihood(const STMParameters::STModelParameters & proposal, 
+		size_t par)
+{ return propose_log_likelihood(proposal, std::vector<size_t> (1, par)); }
+
+
+double Likelihood::propose_log_likelihood(const STMParameters::STModelParameters & proposal, 
+		const std::vector<size_t> & pars)
+{
+	if(blockLogLik.empty())
+		throw std::runtime_error("Likelihood: proposal made before reset_log_likelihood");
+	proposalBlockLogLik = blockLogLik;
+	proposalPars = pars;
+	proposalValues.clear();
+	for(const auto & par : pars)
+		proposalValues.push_back(proposal.values().at(par));
+
+	// the terms of the rate changed by the proposal; unused parameters are skipped
+	LogitUpdate update;
+	update.rate = transitions.num_rates();
+	for(size_t i = 0; i < pars.size(); i++)
+	{
+		size_t rate, term;
+		if(not transitions.parameter_term(pars[i], rate, term))
+			continue;
+		if(update.rate < transitions.num_rates() and rate != update.rate)
+			throw std::runtime_error("Likelihood: the parameters of a proposal must be " 
+					"coefficients of the same rate");
+		if(update.rate == transitions.num_rates())
+			proposalBlocks = transitions.dependent_blocks(pars[i]);
+		update.rate = rate;
+		update.term.push_back(term);
+		update.delta.push_back(proposalValues[i] - currentPars[pars[i]]);
+	}
+	proposalRate = update.rate;
+
+	if(proposalRate < transitions.num_rates())
+	{
+		if(uses_cells())
+		{
+			proposalCellPrevalence = cellPrevalence;
+			compute_prevalence(proposal.values(), true, proposalCellPrevalence);
+		}
+		if(uses_matrices())
+		{
+			compute_matrices(proposal.values(), proposalCellPrevalence.data(), 
+					proposalIntervalMatrices);
+			sum_blocks(proposalBlocks, 1, proposalBlockLogLik, 
+					[&](size_t begin, size_t end, double * sum) 
+					{ *sum = matrix_slice(begin, end, proposalIntervalMatrices.data()); });
+		}
+		else
+			sum_blocks(proposalBlocks, 1, proposalBlockLogLik, 
+					[&](size_t begin, size_t end, double * sum) 
+					{ *sum = sum_log_likelihood(begin, end, &update); });
+	}
+
+	double sumlogl = 0;
+	for(const auto & bl : proposalBlockLogLik)
+		sumlogl += bl;
+	return sumlogl;
+}
+
+
+void Likelihood::accept_proposal()
+{
+	blockLogLik.swap(proposalBlockLogLik);
+	for(size_t i = 0; i < proposalPars.size(); i++)
+		currentPars.at(proposalPars[i]) = proposalValues[i];
+	if(proposalRate < transitions.num_rates())
+	{
+		cellPrevalence.swap(proposalCellPrevalence);
+		if(uses_matrices())
+		{
+			intervalMatrices.swap(proposalIntervalMatrices);
+			return;
+		}
+		// only the blocks that use the rate; see logits
+		double * rateLogits = &logits[proposalRate * transitions.size()];
+		for(const auto & b : proposalBlocks)
+		{
+			std::copy(proposalLogits.begin() + transitions.block_begin(b), 
+					proposalLogits.begin() + transitions.block_end(b), 
+					rateLogits + transitions.block_begin(b));
+		}
+	}
+}
+
+
+void Likelihood::reject_proposal()
+{ }
+
+
+bool Likelihood::is_current(const STMParameters::STModelParameters & params) const
+{ return not currentPars.empty() and params.values() == currentPars; }
+
+
+bool Likelihood::parameter_rate(const STMParameters::STModelParameters & params, size_t par,
+		size_t & rate)
+{
+	check_parameter_layout(params);
+	size_t term;
+	return transitions.parameter_term(par, rate, term);
+}
+
+
+void Likelihood::check_parameter_layout(const STMParameters::STModelParameters & params)
+{
+	// parameter names are fixed for the life of the program, so their positions in the
+	// parameter vector are resolved only once
+	if(not transitions.has_parameter_layout())
+		transitions.set_parameter_layout(params.names());
+}
+
+
+double Likelihood::sum_log_likelihood(size_t begin, size_t end, const LogitUpdate * update)
+// sums the log likelihood of the transitions in [begin, end) from the cached logits
+// if update is not null, the logits of update->rate are first changed by 
+// update->delta[k] * term update->term[k] for each k, and the result is saved in 
+// proposalLogits
+{
+	double sumlogl = 0;
+	const size_t n = transitions.size();
+	const size_t numRates = transitions.num_rates();
+
+	for(size_t first = begin; first < end; first += STMModel::chunkSize)
+	{
+		const size_t len = std::min(STMModel::chunkSize, end - first);
+		const STM::ParValue * lg [STMModel::maxRates];
+		for(size_t r = 0; r < numRates; r++)
+			lg[r] = &logits[r * n + first];
+		if(update)
+		{
+			STM::ParValue * result = &proposalLogits[first];
+			transitions.update_logits(update->term[0], update->delta[0], first, len, 
+					lg[update->rate], result);
+			for(size_t k = 1; k < update->term.size(); k++)
+				transitions.update_logits(update->term[k], update->delta[k], first, len, 
+						result, result);
+			lg[update->rate] = result;
+		}
+		sumlogl += chunk_log_likelihood(first, len, lg, 
+				update ? proposalCellPrevalence.data() : cellPrevalence.data());
+	}
 	return sumlogl;
 }
 
 
+double Likelihood::cache_log_likelihood(size_t begin, size_t end)
+// computes and caches the logits of the transitions in [begin, end) for the current 
+// parameters, then sums their log likelihood
+{
+	const size_t n = transitions.size();
+	const size_t numRates = transitions.num_rates();
+	for(size_t first = begin; first < end; first += STMModel::chunkSize)
+	{
+		STM::ParValue * lg [STMModel::maxRates];
+		for(size_t r = 0; r < numRates; r++)
+			lg[r] = &logits[r * n + first];
+		transitions.compute_logits(first, std::min(STMModel::chunkSize, end - first), 
+				currentPars, lg);
+	}
+	return sum_log_likelihood(begin, end);
+}
+
+
+double Likelihood::compute_slice(size_t begin, size_t end, const STM::ParVector & par, 
+		const STM::ParValue * cellPrev) const
+// sums the log likelihood of the transitions in [begin, end) without using the cache
+{
+	double sumlogl = 0;
+	const size_t numRates = transitions.num_rates();
+	for(size_t first = begin; first < end; first += STMModel::chunkSize)
+	{
+		const size_t len = std::min(STMModel::chunkSize, end - first);
+		STM::ParValue chunkLogits [STMModel::maxRates][STMModel::chunkSize];
+		STM::ParValue * lg [STMModel::maxRates];
+		for(size_t r = 0; r < numRates; r++)
+			lg[r] = chunkLogits[r];
+		transitions.compute_logits(first, len, par, lg);
+		sumlogl += chunk_log_likelihood(first, len, lg, cellPrev);
+	}
+	return sumlogl;
+}
+
+
+
+void Likelihood::compute_batch_slice(size_t begin, size_t end, const std::vector<double> & coef,
+		size_t numSets, const STM::ParValue * cellPrev, double * sums) const
+// sums the log likelihood of the transitions in [begin, end) for each of numSets parameter
+// sets, whose coefficients are in coef (see TransitionTable::coefficient_matrix); with 
+// the analytical prevalence, cellPrev holds the prevalence of each set, one after another
+{
+	const size_t cellValues = transitions.num_cells() * 
+			transitions.model_description().num_states();
+	const size_t numRates = transitions.num_rates();
+	const size_t numCoef = numRates * transitions.num_terms();
+	const size_t tile = std::min(numSets, batchTile);
+	std::vector<STM::ParValue> batchLogits (tile * numRates * STMModel::chunkSize);
+	std::fill(sums, sums + numSets, 0.0);
+
+	for(size_t first = begin; first < end; first += STMModel::chunkSize)
+	{
+		const size_t len = std::min(STMModel::chunkSize, end - first);
+		for(size_t k0 = 0; k0 < numSets; k0 += tile)
+		{
+			const size_t nk = std::min(tile, numSets - k0);
+			transitions.compute_logits(first, len, &coef[k0 * numCoef], nk * numRates, 
+					batchLogits.data());
+			for(size_t k = 0; k < nk; k++)
+			{
+				const STM::ParValue * lg [STMModel::maxRates];
+				for(size_t r = 0; r < numRates; r++)
+					lg[r] = &batchLogits[(k * numRates + r) * len];
+				sums[k0 + k] += chunk_log_likelihood(first, len, lg, 
+						cellPrev ? cellPrev + (k0 + k) * cellValues : nullptr);
+			}
+		}
+	}
+}
+
+
+
+void Likelihood::gradient_slice(size_t begin, size_t end, const STM::ParVector & par, 
+		const STM::ParValue * cellPrev, STM::ParValue * dPrev, double * sums) const
+// sums[0] is the log likelihood of the transitions in [begin, end), as in compute_slice, 
+// and sums[1...] its gradient with respect to the coefficients; with the analytical 
+// prevalence, dPrev receives the derivatives with respect to the prevalence of each row
+{
+	const size_t numRates = transitions.num_rates();
+	const size_t numStates = transitions.model_description().num_states();
+	std::fill(sums, sums + 1 + numRates * transitions.num_terms(), 0.0);
+	for(size_t first = begin; first < end; first += STMModel::chunkSize)
+	{
+		const size_t len = std::min(STMModel::chunkSize, end - first);
+		STM::ParValue chunkLogits [STMModel::maxRates][STMModel::chunkSize];
+		STM::ParValue chunkDLogit [STMModel::maxRates][STMModel::chunkSize];
+		STM::ParValue * lg [STMModel::maxRates], * dl [STMModel::maxRates];
+		for(size_t r = 0; r < numRates; r++)
+		{
+			lg[r] = chunkLogits[r];
+			dl[r] = chunkDLogit[r];
+		}
+		transitions.compute_logits(first, len, par, lg);
+		sums[0] += chunk_log_likelihood_gradient(first, len, lg, cellPrev, dl, 
+				dPrev ? dPrev + first * numStates : nullptr);
+		transitions.coefficient_gradient(first, len, dl, sums + 1);
+	}
+}
+
+
+double Likelihood::matrix_slice(size_t begin, size_t end, const STM::ParValue * matrices) 
+		const
+// sums the log likelihood of the transitions in [begin, end) from the matrices of their 
+// intervals, by chunks as in compute_slice
+{
+	double sumlogl = 0;
+	for(size_t first = begin; first < end; first += STMModel::chunkSize)
+		sumlogl += transitions.matrix_log_likelihood(first, 
+				std::min(STMModel::chunkSize, end - first), matrices);
+	return sumlogl;
+}
+
+
+void Likelihood::compute_matrices(const STM::ParVector & par, const STM::ParValue * cellPrev,
+		std::vector<STM::ParValue> & matrices)
+// the transition matrices of every interval of every matrix cell, in fixed batches of 
+// chunkSize cells as in compute_prevalence
+{
+	std::vector<double> coef (transitions.num_rates() * transitions.num_terms());
+	transitions.coefficient_matrix(par, coef.data());
+	const size_t numStates = transitions.model_description().num_states();
+	matrices.resize(transitions.num_matrix_entries() * numStates * numStates);
+	const size_t numCells = transitions.num_matrix_cells();
+	const size_t numBatches = (numCells + STMModel::chunkSize - 1) / STMModel::chunkSize;
+	const size_t numThreads = pool->size();
+	pool->run([&](unsigned int w)
+	{
+		for(size_t b = w; b < numBatches; b += numThreads)
+		{
+			const size_t first = b * STMModel::chunkSize;
+			cell_matrices(first, std::min(STMModel::chunkSize, numCells - first), 
+					coef.data(), cellPrev, matrices.data());
+		}
+	});
+}
+
+
+void Likelihood::compute_prevalence(const STM::ParVector & par, bool warm, 
+		std::vector<STM::ParValue> & prev)
+{
+	std::vector<double> coef (transitions.num_rates() * transitions.num_terms());
+	transitions.coefficient_matrix(par, coef.data());
+	prev.resize(transitions.num_cells() * transitions.model_description().num_states());
+	compute_prevalence(coef.data(), warm, prev.data());
+}
+
+
+void Likelihood::compute_prevalence(const double * coef, bool warm, STM::ParValue * prev)
+// the equilibrium prevalence of every cell; with warm, prev holds the starting values
+// the cells are solved in fixed batches of chunkSize, dealt to the workers in turn, so 
+// that the result does not depend on the number of threads
+{
+	const size_t numCells = transitions.num_cells();
+	const size_t numBatches = (numCells + STMModel::chunkSize - 1) / STMModel::chunkSize;
+	const size_t numThreads = pool->size();
+	pool->run([&](unsigned int w)
+	{
+		for(size_t b = w; b < numBatches; b += numThreads)
+		{
+			const size_t first = b * STMModel::chunkSize;
+			cell_prevalence(first, std::min(STMModel::chunkSize, numCells - first), coef, 
+					warm, prev);
+		}
+	});
+}
+
 
 double Likelihood::log_prior(const std::pair<std::string, double> & param) const
 {
@@ -157,4 +825,44 @@ double Likelihood::log_prior(const std::pair<std::string, double> & param) const
 }
 
 
+double Likelihood::log_prior_gradient(const std::pair<std::string, double> & param) const
+{
+	const PriorDist & prior = priors.at(param.first);
+	const double x = param.second - prior.mean;
+	const double var = prior.sd * prior.sd;
+	if(prior.family == PriorFamilies::Normal)
+		return -x / var;
+	else if(prior.family == PriorFamilies::Cauchy)
+		return -2 * x / (var + x * x);
+	else
+		throw(std::runtime_error("Invalid prior distribution specified"));
+}
+
+
+STM::ParMap Likelihood::raw_scale(const STM::ParMap & sample) const
+{
+	const STMModel::CovariateBasis & basis = transitions.basis();
+	if(basis.type() == STMModel::BasisType::Raw)
+		return sample;
+	STM::ParMap result (sample);
+	const size_t numTerms = transitions.num_terms();
+	std::vector<double> coef (numTerms), raw (numTerms);
+	std::vector<std::string> names (numTerms);
+	for(const auto & rate : transitions.model_description().rates)
+	{
+		for(size_t k = 0; k < numTerms; k++)
+		{
+			std::ostringstream name;
+			name << rate.prefix << k;
+			names[k] = name.str();
+			coef[k] = sample.at(names[k]);
+		}
+		basis.raw_coefficients(coef.data(), raw.data());
+		for(size_t k = 0; k < numTerms; k++)
+			result.at(names[k]) = raw[k];
+	}
+	return result;
+}
+
+
 } //!namespace Likelihood
@@ -1,15 +1,19 @@
 #include <thread>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <iostream>
 #include <unistd.h> // for getopt
 #include <cstdlib> // atoi
 
 #include "../hdr/engine.hpp"
+#include "../hdr/engines.hpp"
 #include "../hdr/output.hpp"
 #include "../hdr/input.hpp"
 #include "../hdr/parameters.hpp"
 #include "../hdr/likelihood.hpp"
 #include "../hdr/model.hpp"
+#include "../hdr/models.hpp"
 #include "../hdr/stmtypes.hpp"
 
 struct ModelSettings 
@@ -26,7 +30,16 @@ struct ModelSettings
 	bool resume;
 	const char * resumeFile;
 	bool DIC;
+	bool compactTransitions;
+	bool reproducible;
+	bool singlePrecision;
+	bool exactIntervals;
+	std::string modelName;
 	STM::PrevalenceModelTypes prevMethod;
+	STMModel::BasisType basisType;
+	int basisDegree;
+	STMEngine::SamplerType sampler;
+	int numReplicas;
 	
 	STMEngine::EngineOutputLevel verbose;
 	
@@ -34,7 +47,11 @@ struct ModelSettings
 			maxIterations(100), verbose(STMEngine::EngineOutputLevel::Normal), thin(1), 
 			burnin(0), targetInterval(1), numThreads(8), outDir("."), resume(false),
 			outMethod(STMOutput::OutputMethodType::CSV), resumeFile("resumeData.txt"),
-			prevMethod(STM::PrevalenceModelTypes::Empirical), DIC(false) 
+			prevMethod(STM::PrevalenceModelTypes::Empirical), DIC(false), 
+			compactTransitions(false), reproducible(false), singlePrecision(false), 
+			exactIntervals(false), modelName("2state"),
+			basisType(STMModel::BasisType::Raw), basisDegree(3), 
+			sampler(STMEngine::SamplerType::Metropolis), numReplicas(4)
 			{ }
 };
 
@@ -53,18 +70,6 @@ int main(int argc, char ** argv)
 	std::map<std::string, STMInput::SerializationData> resumeData;
 	std::vector<STMParameters::ParameterSettings> inits;
 
-	try {
-		STMInput::STMInputHelper inp (settings.transFileName, STMInput::InputType::transitions);
-		transitionData = inp.transitions();
-		std::cerr << "Loaded transition data\n";
-	}
-	catch (std::runtime_error &e) {
-		std::cerr << e.what() << '\n';
-		exit(1);
-	}
-
-	STMLikelihood::Likelihood * likelihood = nullptr;
-	
 	if(settings.resume)
 	{
 		try
@@ -79,9 +84,50 @@ int main(int argc, char ** argv)
 			std::cerr << "  " << settings.resumeFile << "\n";
 			exit(1);
 		}
-		
-		likelihood = new STMLikelihood::Likelihood (resumeData.at("Likelihood"), 
-				resumeData.at("Parameters").at("parNames"), transitionData);
+		// the model is saved with the resume data; older files rely on -m
+		try
+		{
+			settings.modelName = resumeData.at("Likelihood").at("model").at(0);
+		}
+		catch (std::out_of_range &e) { }
+	}
+
+	const STMModel::ModelDescription * model = nullptr;
+	try {
+		model = &STMModel::find_model(settings.modelName);
+		std::cerr << "Using the " << model->name << " model\n";
+		STMInput::STMInputHelper inp (settings.transFileName, STMInput::InputType::transitions,
+				*model);
+		std::cerr << "Loaded transition data\n";
+		if(settings.compactTransitions)
+		{
+			size_t numRead = inp.transitions().size();
+			size_t numUnique = inp.compact_transitions();
+			std::cerr << "Compacted " << numRead << " transitions into " << numUnique << 
+					" unique records\n";
+		}
+		transitionData = inp.transitions();
+	}
+	catch (std::runtime_error &e) {
+		std::cerr << e.what() << '\n';
+		exit(1);
+	}
+
+	// parallel tempering has a likelihood for each chain, sharing the threads; each 
+	// likelihood's threads are pinned to the CPUs after those of the previous one
+	std::vector<STMLikelihood::Likelihood *> likelihoods;
+	unsigned int firstCpu = 0;
+	
+	if(settings.resume)
+	{
+		size_t numLikelihoods = STMEngine::num_likelihoods(resumeData);
+		for(size_t i = 0; i < numLikelihoods; i++)
+		{
+			likelihoods.push_back(STMLikelihood::make_likelihood(*model, 
+					resumeData.at("Likelihood"), resumeData.at("Parameters").at("parNames"), 
+					transitionData, firstCpu));
+			firstCpu += likelihoods.back()->num_threads();
+		}
 		std::cerr << "Built likelihood\n";
 	} else // not resuming
 	{
@@ -96,11 +142,32 @@ int main(int argc, char ** argv)
 			std::cerr << e.what() << '\n';
 			exit(1);
 		}
-		likelihood = new STMLikelihood::Likelihood 
-			(transitionData, settings.transFileName, priors, settings.numThreads,
-					 settings.targetInterval);
+		int numLikelihoods = 1, numThreads = settings.numThreads;
+		if(settings.sampler == STMEngine::SamplerType::Tempering)
+		{
+			numLikelihoods = settings.numReplicas;
+			numThreads = std::max(1, settings.numThreads / numLikelihoods);
+		}
+		for(int i = 0; i < numLikelihoods; i++)
+		{
+			likelihoods.push_back(STMLikelihood::make_likelihood(*model, transitionData, 
+					settings.transFileName, priors, numThreads, settings.targetInterval,
+					settings.prevMethod, 
+					STMModel::CovariateBasis(settings.basisType, settings.basisDegree),
+					settings.singlePrecision, STMModel::RowOrder::Locality, 
+					settings.exactIntervals, firstCpu));
+			firstCpu += likelihoods.back()->num_threads();
+		}
 		std::cerr << "Built likelihood\n";
 	}
+	// the likelihood keeps its own copy of the transitions
+	std::vector<STMModel::STMTransition>().swap(transitionData);
+	if(settings.reproducible)
+		for(auto & l : likelihoods)
+			l->set_reproducible(true);
+	STMLikelihood::Likelihood * likelihood = likelihoods[0];
+	std::vector<STMLikelihood::Likelihood *> replicaLikelihoods (likelihoods.begin() + 1, 
+			likelihoods.end());
 
 	
 	STMOutput::OutputQueue * outQueue = new STMOutput::OutputQueue;
@@ -109,8 +176,9 @@ int main(int argc, char ** argv)
 	bool engineFinished = false;
 	if(settings.resume)
 	{
-		std::thread engineThread (&STMEngine::Metropolis::run_sampler, 
-				STMEngine::Metropolis(resumeData, likelihood, outQueue), 
+		std::unique_ptr<STMEngine::Metropolis> engine (STMEngine::make_engine(resumeData,
+				likelihood, outQueue, replicaLikelihoods));
+		std::thread engineThread (&STMEngine::Metropolis::run_sampler, engine.get(),
 				settings.maxIterations);
 		std::cerr << "Engine resumed successfully\n";
 		std::thread outputThread (&STMOutput::OutputWorkerThread::start,
@@ -125,10 +193,13 @@ int main(int argc, char ** argv)
 		outputThread.join();
 	} else
 	{
-		std::thread engineThread (&STMEngine::Metropolis::run_sampler, 
-				STMEngine::Metropolis(inits, outQueue, likelihood, settings.verbose, 
+		std::unique_ptr<STMEngine::Metropolis> engine (STMEngine::make_engine(inits, outQueue,
+				likelihood, settings.verbose, 
 				STMOutput::OutputOptions(settings.outDir, settings.outMethod), settings.thin, 
-				settings.burnin, settings.DIC), settings.maxIterations);
+				settings.burnin, settings.DIC, false, 0, settings.sampler, 
+				replicaLikelihoods));
+		std::thread engineThread (&STMEngine::Metropolis::run_sampler, engine.get(),
+				settings.maxIterations);
 		std::cerr << "Engine started successfully\n";
 		std::thread outputThread (&STMOutput::OutputWorkerThread::start,
 				STMOutput::OutputWorkerThread(outQueue, &engineFinished));
@@ -145,7 +216,8 @@ int main(int argc, char ** argv)
 	
 	// any remaining cleanup
 	delete outQueue;
-	delete likelihood;
+	for(auto & l : likelihoods)
+		delete l;
 	
 	return 0;
 }
@@ -154,7 +226,7 @@ int main(int argc, char ** argv)
 void parse_args(int argc, char **argv, ModelSettings & s)
 {
 	int thearg;
-	while((thearg = getopt(argc, argv, "hsagdr:p:t:o:n:i:b:l:c:v:")) != -1)
+	while((thearg = getopt(argc, argv, "hsagduxfyj:m:r:p:t:o:n:i:b:l:c:v:e:k:T:")) != -1)
 	{
 		switch(thearg)
 		{
@@ -166,15 +238,37 @@ void parse_args(int argc, char **argv, ModelSettings & s)
 				break;
 			case 'a':
 				s.prevMethod = STM::PrevalenceModelTypes::STM;
-				STMModel::STMTransition::set_prevalence_model(STM::PrevalenceModelTypes::STM);
 				break;
 			case 'g':
 				s.prevMethod = STM::PrevalenceModelTypes::Global;
-				STMModel::STMTransition::set_prevalence_model(STM::PrevalenceModelTypes::Global);
 				break;
 			case 'd':
 				s.DIC = true;
 				break;
+			case 'u':
+				s.compactTransitions = true;
+				break;
+			case 'x':
+				s.reproducible = true;
+				break;
+			case 'f':
+				s.singlePrecision = true;
+				break;
+			case 'y':
+				s.exactIntervals = true;
+				break;
+			case 'j':
+				try {
+					s.sampler = STMEngine::sampler_from_name(optarg);
+				}
+				catch (std::runtime_error &e) {
+					std::cerr << e.what() << '\n';
+					print_help();
+				}
+				break;
+			case 'm':
+				s.modelName = optarg;
+				break;
 			case 'r':
 				s.resume = true;
 				s.resumeFile = optarg;
@@ -206,11 +300,38 @@ void parse_args(int argc, char **argv, ModelSettings & s)
 			case 'v':
 				s.verbose = STMEngine::EngineOutputLevel(atoi(optarg));
 				break;
+			case 'e':
+				try {
+					s.basisType = STMModel::CovariateBasis::type_from_name(optarg);
+				}
+				catch (std::runtime_error &e) {
+					std::cerr << e.what() << '\n';
+					print_help();
+				}
+				break;
+			case 'k':
+				s.basisDegree = atoi(optarg);
+				if(s.basisDegree < 1)
+					print_help();
+				break;
+			case 'T':
+				s.numReplicas = atoi(optarg);
+				if(s.numReplicas < 2)
+					print_help();
+				break;
 			case '?':
 				print_help();
 				break;
 		}
 	}
+	// the gradient is not available with exact intervals
+	if(s.exactIntervals and (s.sampler == STMEngine::SamplerType::NUTS or 
+			s.sampler == STMEngine::SamplerType::NUTSDense or 
+			s.sampler == STMEngine::SamplerType::MALA))
+	{
+		std::cerr << "The gradient samplers (nuts, nuts-dense and mala) cannot be used with -y\n";
+		print_help();
+	}
 }
 
 void print_help()
@@ -218,9 +339,51 @@ void print_help()
 	std::cerr << "Command line options:\n";
 	std::cerr << "    -h:             display this help\n";
 	std::cerr << "    -s:             output to standard out (default is CSV files)\n";
+	std::cerr << "    -m <model>:     the state model: 2state (default), 4state, or a model file declaring the\n";
+	std::cerr << "                         states, rates and transition probabilities (e.g., models/4state.stm)\n";
+	std::cerr << "                         when resuming, the model saved with the resume data is used\n";
 	std::cerr << "    -a:             Instead of the empirical prevalence (default), use the analytical solution\n";
+	std::cerr << "                         (the model's equilibrium prevalence in each climate cell)\n";
 	std::cerr << "    -g:             Instead of the empirical prevalence (default), use global (i.e., no) prevalence\n";
 	std::cerr << "    -d:             Compute DIC (adds significant overhead)\n";
+	std::cerr << "    -u:             merge identical transitions into weighted unique records when loading\n";
+	std::cerr << "                         the likelihood is unchanged, but faster when transitions are repeated\n";
+	std::cerr << "    -e <basis>:     the polynomial basis of the environmental variables in the rates:\n";
+	std::cerr << "                         raw (default; powers of env1, env2, ...), centred (powers of the\n";
+	std::cerr << "                         standardized variables) or orthogonal (orthogonal polynomials)\n";
+	std::cerr << "                         initial values and priors are on the scale of the basis, but the\n";
+	std::cerr << "                         posterior is written on the raw scale; saved with the resume data\n";
+	std::cerr << "    -k <integer>:   degree of the polynomial in each environmental variable (default 3)\n";
+	std::cerr << "                         the coefficients of each rate are then <prefix>0 ... <prefix>K\n";
+	std::cerr << "                         with K = degree * (number of environmental variables)\n";
+	std::cerr << "    -x:             make the likelihood bit-identical for any number of threads (-c)\n";
+	std::cerr << "                         adds a small overhead; saved with the resume data\n";
+	std::cerr << "    -f:             store the transitions in single precision, for large datasets\n";
+	std::cerr << "                         halves the memory read by each likelihood evaluation; the\n";
+	std::cerr << "                         likelihood itself is still computed in double precision, with a\n";
+	std::cerr << "                         relative error of about 1e-7 (see make precision_report)\n";
+	std::cerr << "                         saved with the resume data\n";
+	std::cerr << "    -y:             exact transition probabilities over each interval, from the powers\n";
+	std::cerr << "                         of the one-step (-l) transition matrix of each climate cell,\n";
+	std::cerr << "                         instead of scaling the rates; every interval must be a multiple\n";
+	std::cerr << "                         of -l; saved with the resume data\n";
+	std::cerr << "    -j <sampler>:   the sampler; saved with the resume data\n";
+	std::cerr << "                         metropolis (default): one parameter at a time\n";
+	std::cerr << "                         adaptive: the coefficients of each rate proposed together, from\n";
+	std::cerr << "                         their covariance in the chain, learned during adaptation and burnin\n";
+	std::cerr << "                         nuts or nuts-dense: the no-U-turn sampler, with a diagonal or dense\n";
+	std::cerr << "                         mass matrix learned in a warm-up before burnin; not with -y\n";
+	std::cerr << "                         mala: all parameters proposed together along the gradient,\n";
+	std::cerr << "                         preconditioned by their covariance learned during adaptation;\n";
+	std::cerr << "                         not with -y\n";
+	std::cerr << "                         tempering: parallel tempering, -T chains at a ladder of\n";
+	std::cerr << "                         temperatures exchanging their states; the chains run\n";
+	std::cerr << "                         concurrently, each with its share of the -c threads, and only\n";
+	std::cerr << "                         the coldest is saved\n";
+	std::cerr << "                         ensemble: the affine-invariant ensemble sampler, 2 (d + 1)\n";
+	std::cerr << "                         walkers for d parameters, with stretch moves; no adaptation,\n";
+	std::cerr << "                         and every walker is saved at each iteration\n";
+	std::cerr << "    -T <chains>:    number of chains for -j tempering, at least 2 (default 4)\n";
 	std::cerr << "    -r <filname>:   resume the sampler from the file indicated\n";
 	std::cerr << "                         note that the transitionData are not saved with the resume data\n";		
 	std::cerr << "                         so reloading it with the -t option is required\n";		
@@ -0,0 +1,262 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	mala.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <gsl/gsl_randist.h>
+#include "../hdr/mala.hpp"
+#include "../hdr/likelihood.hpp"
+#include "../hdr/input.hpp"
+
+namespace STMEngine {
+
+const double MALA::optimalAcceptance = 0.574;
+const std::vector<double> MALA::acceptanceInterval = {0.4, 0.75};
+
+MALA::MALA(const std::vector<STMParameters::ParameterSettings> & inits,
+		STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+		EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, int burnin,
+		bool doDIC, bool rngSetSeed, int rngSeed) :
+		Metropolis(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, rngSetSeed,
+		rngSeed, SamplerType::MALA), activeIndex(active_index()), stepSize(1), 
+		adaptationDone(false)
+{
+	theta = active_values(activeIndex);
+	const size_t d = activeIndex.size();
+	preconditioner.assign(d * d, 0.0);
+	for(size_t i = 0; i < d; i++)
+	{
+		const double sd = parameters.sampler_variance(parameters.names()[activeIndex[i]]);
+		preconditioner[i * d + i] = sd * sd;
+	}
+	preconditionerFactor = preconditioner;
+	if(not cholesky_factor(d, preconditionerFactor))
+		throw std::runtime_error("MALA: the sampler variances must be positive");
+	currentPosteriorProb = log_posterior_gradient(parameters, activeIndex, grad, currentLL);
+	if(saveResumeData)
+		serialize_all();
+}
+
+
+MALA::MALA(std::map<std::string, STMInput::SerializationData> & sd,
+		STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue) :
+		Metropolis(sd, lhood, queue), activeIndex(active_index())
+{
+	const STMInput::SerializationData & esd = sd.at("Metropolis");
+	stepSize = STMInput::str_convert<double>(esd.at("malaStepSize")[0]);
+	adaptationDone = STMInput::str_convert<bool>(esd.at("malaAdapted")[0]);
+	preconditioner = STMInput::str_convert<double>(esd.at("malaPreconditioner"));
+
+	theta = active_values(activeIndex);
+	const size_t d = activeIndex.size();
+	if(preconditioner.size() != d * d)
+		throw std::runtime_error("MALA: the saved preconditioner does not match the parameters");
+	preconditionerFactor = preconditioner;
+	if(not cholesky_factor(d, preconditionerFactor))
+		throw std::runtime_error("MALA: the saved preconditioner is not positive definite");
+	currentPosteriorProb = log_posterior_gradient(parameters, activeIndex, grad, currentLL);
+}
+
+
+std::string MALA::serialize(char sep) const
+{
+	std::ostringstream result;
+	result << Metropolis::serialize(sep);
+	result << std::setprecision(17);
+	result << "malaStepSize" << sep << stepSize << "\n";
+	result << "malaAdapted" << sep << adaptationDone << "\n";
+	result << "malaPreconditioner";
+	for(const auto & v : preconditioner)
+		result << sep << v;
+	result << "\n";
+	return result.str();
+}
+
+
+void MALA::auto_adapt()
+// loops of adaptationSampleSize iterations, as Metropolis: after each loop but the 
+// first with an acceptance rate of at least 0.1, A is the shrunk covariance of its 
+// samples and eps is scaled towards optimalAcceptance (Roberts and Rosenthal 1998); 
+// both are fixed once the rate is inside acceptanceInterval, after minAdaptationLoops
+// estimates of A
+{
+	if(outputLevel >= EngineOutputLevel::Normal)
+		std::cerr << timestamp() << " Starting automatic adaptation" << std::endl;
+
+	// disable thinning for the adaptation phase
+	int oldThin = thinSize;
+	thinSize = 1;
+
+	const size_t d = activeIndex.size();
+	int nLoops = 0;
+	int nEstimates = 0;
+	std::vector<std::vector<double> > samples;
+	while(not adaptationDone and nLoops < maxAdaptationLoops)
+	{
+		nLoops++;
+		const double rate = do_sample(adaptationSampleSize).begin()->second;
+
+		// the first loop moves the chain away from the inits, and loops with few accepted
+		// proposals say little about the covariance; their samples are not used
+		const bool estimate = nLoops > 1 and rate >= 0.1;
+		if(estimate)
+		{
+			// the first estimate comes from a poorly scaled chain; later ones pool the
+			// samples of all the loops since
+			if(nEstimates == 1)
+				samples.clear();
+			for(const auto & s : currentSamples)
+			{
+				std::vector<double> x (d);
+				for(size_t i = 0; i < d; i++)
+					x[i] = s.at(parameters.names()[activeIndex[i]]);
+				samples.push_back(x);
+			}
+			// A; the previous one is kept if the estimate is not positive definite
+			shrunk_covariance(d, samples, true, preconditioner, preconditionerFactor);
+		}
+
+		// eps^2 is scaled as the sampler variances are in Metropolis; with the first
+		// estimate of A, it restarts from the optimal scaling for a Gaussian target
+		if(estimate and nEstimates == 0)
+			stepSize = 1.65 * std::pow(double(d), -1.0 / 6);
+		else
+			stepSize *= std::sqrt((rate == 0) ? 1e-2 : rate / optimalAcceptance);
+		nEstimates += estimate;
+		adaptationDone = nEstimates >= minAdaptationLoops and 
+				rate >= acceptanceInterval[0] and rate <= acceptanceInterval[1];
+
+		if(outputLevel >= EngineOutputLevel::Talkative)
+		{
+			std::cerr << "    " << timestamp() << " iter " << parameters.iteration() <<
+					"   acceptance rate " << rate << "   step size " << stepSize << "\n";
+		}
+		currentSamples.clear();
+		if(saveResumeData)
+			serialize_all();
+	}
+	adaptationDone = true;
+
+	restart_iterations(activeIndex, theta);
+	if(saveResumeData)
+		serialize_all();
+	if(outputLevel >= EngineOutputLevel::Normal)
+		std::cerr << timestamp() << " Adaptation completed successfully" << std::endl;
+
+	thinSize = oldThin;
+}
+
+
+std::map<std::string, double> MALA::do_sample(int n, bool saveDeviance)
+// returns the acceptance rate of the iterations, for every active parameter
+{
+	int numAccepted = 0;
+	for(int i = 0; i < n; i++)
+	{
+		for(int j = 0; j < thinSize; j++)
+			numAccepted += step();
+		save_sample(saveDeviance);
+	}
+	std::map<std::string, double> acceptanceRates;
+	for(const auto & par : parameters.active_names())
+		acceptanceRates[par] = double(numAccepted) / (n * thinSize);
+	return acceptanceRates;
+}
+
+
+void MALA::drift(const std::vector<double> & x, const std::vector<double> & g, 
+		std::vector<double> & mean) const
+// mean = x + (eps^2 / 2) A g
+{
+	const size_t d = x.size();
+	mean = x;
+	for(size_t i = 0; i < d; i++)
+		for(size_t k = 0; k < d; k++)
+			mean[i] += 0.5 * stepSize * stepSize * preconditioner[i * d + k] * g[k];
+}
+
+
+double MALA::log_proposal_density(const std::vector<double> & x, 
+		const std::vector<double> & mean) const
+// log N(x; mean, eps^2 A), up to a constant: solves L z = (x - mean) / eps
+{
+	const size_t d = x.size();
+	std::vector<double> z (d);
+	double result = 0;
+	for(size_t i = 0; i < d; i++)
+	{
+		z[i] = (x[i] - mean[i]) / stepSize;
+		for(size_t k = 0; k < i; k++)
+			z[i] -= preconditionerFactor[i * d + k] * z[k];
+		z[i] /= preconditionerFactor[i * d + i];
+		result -= 0.5 * z[i] * z[i];
+	}
+	return result;
+}
+
+
+bool MALA::step()
+// one joint proposal, theta' = theta + (eps^2 / 2) A grad(theta) + eps L z with 
+// z ~ N(0, I), and the Hastings ratio of the asymmetric proposal; returns true if it is
+// accepted
+{
+	const size_t d = activeIndex.size();
+	std::vector<double> mean, proposal (d), z (d);
+	drift(theta, grad, mean);
+	for(auto & zi : z)
+		zi = gsl_ran_gaussian(rng.get(), 1.0);
+	for(size_t i = 0; i < d; i++)
+	{
+		proposal[i] = mean[i];
+		for(size_t k = 0; k <= i; k++)
+			proposal[i] += stepSize * preconditionerFactor[i * d + k] * z[k];
+	}
+
+	STMParameters::STModelParameters proposalPars (parameters);
+	for(size_t i = 0; i < d; i++)
+		proposalPars.update(activeIndex[i], proposal[i]);
+	std::vector<double> proposalGrad;
+	double proposalLL;
+	const double proposalPosterior = log_posterior_gradient(proposalPars, activeIndex,
+			proposalGrad, proposalLL);
+	if(std::isinf(proposalPosterior))
+		return false;
+
+	std::vector<double> reverseMean;
+	drift(proposal, proposalGrad, reverseMean);
+	const double logRatio = proposalPosterior - currentPosteriorProb + 
+			log_proposal_density(theta, reverseMean) - log_proposal_density(proposal, mean);
+	if(std::log(gsl_rng_uniform(rng.get())) >= logRatio)
+		return false;
+
+	theta.swap(proposal);
+	grad.swap(proposalGrad);
+	parameters = proposalPars;
+	currentLL = proposalLL;
+	currentPosteriorProb = proposalPosterior;
+	return true;
+}
+
+} // namespace
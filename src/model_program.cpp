@@ -0,0 +1,739 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	model_program.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include "../hdr/model_program.hpp"
+
+namespace STMModel
+{
+
+/*
+	Recursive descent parser of the expressions, emitting the instructions in postfix
+	order:
+		expression = term { (+ | -) term }
+		term = factor { (* | /) factor }
+		factor = - factor | number | rate | [state] | ( expression )
+*/
+class ExpressionProgram::Parser
+{
+	public:
+	Parser(const std::string & expression, const ModelDescription & model,
+			ExpressionProgram & program) : text(expression), pos(0), model(model),
+			program(program) {}
+
+	void parse()
+	{
+		expression();
+		skip_space();
+		if(pos < text.size())
+			error("unexpected <" + text.substr(pos, 1) + ">");
+	}
+
+	private:
+	void expression()
+	{
+		term();
+		while(accept('+') or accept('-'))
+		{
+			const char op = text[pos - 1];
+			term();
+			program.emit(op == '+' ? OpCode::Add : OpCode::Subtract);
+		}
+	}
+
+	void term()
+	{
+		factor();
+		while(accept('*') or accept('/'))
+		{
+			const char op = text[pos - 1];
+			factor();
+			program.emit(op == '*' ? OpCode::Multiply : OpCode::Divide);
+		}
+	}
+
+	void factor()
+	{
+		skip_space();
+		if(accept('-'))
+		{
+			factor();
+			program.emit(OpCode::Negate);
+		}
+		else if(accept('('))
+		{
+			expression();
+			if(not accept(')'))
+				error("missing )");
+		}
+		else if(accept('['))
+		{
+			skip_space();
+			if(pos >= text.size())
+				error("missing state after [");
+			program.emit(OpCode::Prevalence, model.state_index(text[pos++]));
+			if(not accept(']'))
+				error("missing ]");
+		}
+		else if(pos < text.size() and (std::isdigit(text[pos]) or text[pos] == '.'))
+		{
+			size_t len;
+			const double value = std::stod(text.substr(pos), &len);
+			pos += len;
+			program.emit(OpCode::Constant, 0, value);
+		}
+		else if(pos < text.size() and (std::isalpha(text[pos]) or text[pos] == '_'))
+		{
+			const size_t first = pos;
+			while(pos < text.size() and (std::isalnum(text[pos]) or text[pos] == '_'))
+				pos++;
+			const std::string name = text.substr(first, pos - first);
+			auto rate = std::find_if(model.rates.begin(), model.rates.end(),
+					[&](const RateDefinition & r) { return r.name == name; });
+			if(rate == model.rates.end())
+				error("unknown rate <" + name + ">");
+			program.emit(OpCode::Rate, rate - model.rates.begin());
+		}
+		else
+			error("expected a number, a rate, a [state] or (");
+	}
+
+	bool accept(char c)
+	{
+		skip_space();
+		if(pos < text.size() and text[pos] == c)
+		{
+			pos++;
+			return true;
+		}
+		return false;
+	}
+
+	void skip_space()
+	{
+		while(pos < text.size() and std::isspace(text[pos]))
+			pos++;
+	}
+
+	void error(const std::string & msg) const
+	{
+		throw std::runtime_error("invalid expression <" + text + ">: " + msg);
+	}
+
+	const std::string & text;
+	size_t pos;
+	const ModelDescription & model;
+	ExpressionProgram & program;
+};
+
+
+ExpressionProgram::ExpressionProgram(const std::string & expression,
+		const ModelDescription & model) : depth(0)
+{
+	try
+	{
+		Parser(expression, model, *this).parse();
+	}
+	catch (StateException &e)
+	{
+		throw std::runtime_error("invalid expression <" + expression + ">: " + e.what());
+	}
+}
+
+
+void ExpressionProgram::emit(OpCode op, size_t index, double value)
+// appends an instruction, folding operations on constants into a single constant
+{
+	const size_t n = code.size();
+	if(op == OpCode::Negate and n >= 1 and code[n - 1].op == OpCode::Constant)
+	{
+		code[n - 1].value = -code[n - 1].value;
+		return;
+	}
+	if(op != OpCode::Constant and op != OpCode::Rate and op != OpCode::Prevalence and
+			op != OpCode::Negate and n >= 2 and code[n - 1].op == OpCode::Constant and
+			code[n - 2].op == OpCode::Constant)
+	{
+		const double a = code[n - 2].value, b = code[n - 1].value;
+		code.pop_back();
+		code.back().value = op == OpCode::Add ? a + b : op == OpCode::Subtract ? a - b :
+				op == OpCode::Multiply ? a * b : a / b;
+		return;
+	}
+	code.push_back({op, index, value});
+
+	// the depth of the stack after each instruction
+	size_t d = 0;
+	for(const auto & in : code)
+	{
+		if(in.op == OpCode::Constant or in.op == OpCode::Rate or in.op == OpCode::Prevalence)
+			d++;
+		else if(in.op != OpCode::Negate)
+			d--;
+		depth = std::max(depth, d);
+	}
+	if(depth > maxDepth)
+		throw std::runtime_error("ExpressionProgram: expression is nested too deeply");
+}
+
+
+void ExpressionProgram::evaluate(size_t n, const STM::ParValue * const * rates,
+		const STM::ParValue * prevalence, size_t numStates, STM::ParValue * result) const
+// the stack holds pointers to the operands of each batch, so that rates are used where
+// they are rather than copied; values computed by the program are kept in buffer
+{
+	STM::ParValue buffer [maxDepth][chunkSize];
+	const STM::ParValue * stack [maxDepth];
+	for(size_t first = 0; first < n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, n - first);
+		size_t top = 0;
+		for(const auto & in : code)
+		{
+			STM::ParValue * out = buffer[top];
+			switch(in.op)
+			{
+				case OpCode::Constant:
+					std::fill(out, out + len, in.value);
+					stack[top++] = out;
+					break;
+				case OpCode::Rate:
+					stack[top++] = rates[in.index] + first;
+					break;
+				case OpCode::Prevalence:
+				{
+					const STM::ParValue * e = prevalence + first * numStates + in.index;
+					for(size_t j = 0; j < len; j++)
+						out[j] = e[j * numStates];
+					stack[top++] = out;
+					break;
+				}
+				case OpCode::Negate:
+				{
+					const STM::ParValue * a = stack[top - 1];
+					out = buffer[top - 1];
+					#pragma omp simd
+					for(size_t j = 0; j < len; j++)
+						out[j] = -a[j];
+					stack[top - 1] = out;
+					break;
+				}
+				default:
+				{
+					const STM::ParValue * a = stack[top - 2], * b = stack[top - 1];
+					out = buffer[top - 2];
+					if(in.op == OpCode::Add)
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+							out[j] = a[j] + b[j];
+					}
+					else if(in.op == OpCode::Subtract)
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+							out[j] = a[j] - b[j];
+					}
+					else if(in.op == OpCode::Multiply)
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+							out[j] = a[j] * b[j];
+					}
+					else
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+							out[j] = a[j] / b[j];
+					}
+					stack[--top - 1] = out;
+				}
+			}
+		}
+		std::copy(stack[0], stack[0] + len, result + first);
+	}
+}
+
+
+void ExpressionProgram::derivative(size_t n, const STM::ParValue * const * rates,
+		const STM::ParValue * prevalence, size_t numStates, bool wrtRate, size_t index, 
+		STM::ParValue * result) const
+// forward mode: each entry of the stack holds a value and its derivative
+{
+	STM::ParValue value [maxDepth][chunkSize], slope [maxDepth][chunkSize];
+	for(size_t first = 0; first < n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, n - first);
+		size_t top = 0;
+		for(const auto & in : code)
+		{
+			STM::ParValue * v = value[top], * d = slope[top];
+			switch(in.op)
+			{
+				case OpCode::Constant:
+					std::fill(v, v + len, in.value);
+					std::fill(d, d + len, 0.0);
+					top++;
+					break;
+				case OpCode::Rate:
+					std::copy(rates[in.index] + first, rates[in.index] + first + len, v);
+					std::fill(d, d + len, (wrtRate and in.index == index) ? 1.0 : 0.0);
+					top++;
+					break;
+				case OpCode::Prevalence:
+				{
+					const STM::ParValue * e = prevalence + first * numStates + in.index;
+					for(size_t j = 0; j < len; j++)
+						v[j] = e[j * numStates];
+					std::fill(d, d + len, (not wrtRate and in.index == index) ? 1.0 : 0.0);
+					top++;
+					break;
+				}
+				case OpCode::Negate:
+				{
+					v = value[top - 1];
+					d = slope[top - 1];
+					#pragma omp simd
+					for(size_t j = 0; j < len; j++)
+					{
+						v[j] = -v[j];
+						d[j] = -d[j];
+					}
+					break;
+				}
+				default:
+				{
+					STM::ParValue * a = value[top - 2], * da = slope[top - 2];
+					const STM::ParValue * b = value[top - 1], * db = slope[top - 1];
+					if(in.op == OpCode::Add)
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+						{
+							a[j] += b[j];
+							da[j] += db[j];
+						}
+					}
+					else if(in.op == OpCode::Subtract)
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+						{
+							a[j] -= b[j];
+							da[j] -= db[j];
+						}
+					}
+					else if(in.op == OpCode::Multiply)
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+						{
+							da[j] = da[j] * b[j] + a[j] * db[j];
+							a[j] *= b[j];
+						}
+					}
+					else
+					{
+						#pragma omp simd
+						for(size_t j = 0; j < len; j++)
+						{
+							da[j] = (da[j] * b[j] - a[j] * db[j]) / (b[j] * b[j]);
+							a[j] /= b[j];
+						}
+					}
+					top--;
+				}
+			}
+		}
+		std::copy(slope[0], slope[0] + len, result + first);
+	}
+}
+
+
+bool ExpressionProgram::uses_rate(size_t rate) const
+{
+	for(const auto & in : code)
+		if(in.op == OpCode::Rate and in.index == rate)
+			return true;
+	return false;
+}
+
+
+bool ExpressionProgram::uses_prevalence(size_t state) const
+{
+	for(const auto & in : code)
+		if(in.op == OpCode::Prevalence and in.index == state)
+			return true;
+	return false;
+}
+
+
+std::string ExpressionProgram::str() const
+{
+	const char * names [] = {"const", "rate", "prev", "add", "sub", "mul", "div", "neg"};
+	std::ostringstream result;
+	for(const auto & in : code)
+	{
+		result << names[int(in.op)];
+		if(in.op == OpCode::Constant)
+			result << " " << in.value;
+		else if(in.op == OpCode::Rate or in.op == OpCode::Prevalence)
+			result << " " << in.index;
+		result << "\n";
+	}
+	return result.str();
+}
+
+
+
+ProgramModel::ProgramModel(const std::string & fileName)
+{
+	std::ifstream file (fileName);
+	if(not file.is_open())
+		throw std::runtime_error("could not open the model file <" + fileName + ">");
+	desc.name = fileName;
+	desc.hasSTMPrevalence = false;
+
+	std::vector<std::string> expressions;
+	std::string line;
+	int lineNumber = 0;
+	while(std::getline(file, line))
+	{
+		lineNumber++;
+		try
+		{
+			parse_line(line.substr(0, line.find('#')), expressions);
+		}
+		catch (std::runtime_error &e)
+		{
+			std::ostringstream msg;
+			msg << fileName << ", line " << lineNumber << ": " << e.what();
+			throw std::runtime_error(msg.str());
+		}
+	}
+
+	const size_t NS = desc.num_states(), NR = desc.num_rates();
+	if(NS < 2 or NR < 1)
+		throw std::runtime_error(fileName + ": a model needs at least two states and a rate");
+	if(NS > maxStates or NR > maxRates)
+		throw std::runtime_error(fileName + ": the model has too many states or rates");
+	expressions.resize(NS * NS);
+	desc.validTransitions.assign(NS * NS, false);
+	desc.rateDependencies.assign(NS, std::vector<size_t> ());
+	programs.resize(NS * NS);
+	for(size_t type = 0; type < NS * NS; type++)
+	{
+		if(expressions[type].empty())
+			continue;
+		programs[type] = ExpressionProgram(expressions[type], desc);
+		desc.validTransitions[type] = true;
+		auto & dep = desc.rateDependencies[type / NS];
+		for(size_t r = 0; r < NR; r++)
+			if(programs[type].uses_rate(r) and
+					std::find(dep.begin(), dep.end(), r) == dep.end())
+				dep.push_back(r);
+	}
+	for(auto & dep : desc.rateDependencies)
+		std::sort(dep.begin(), dep.end());
+	check_probabilities();
+}
+
+
+void ProgramModel::parse_line(const std::string & line,
+		std::vector<std::string> & expressions)
+{
+	std::istringstream words (line);
+	std::string keyword;
+	if(not (words >> keyword))
+		return;
+	if(keyword == "states")
+	{
+		if(not desc.stateNames.empty())
+			throw std::runtime_error("the states are declared twice");
+		std::string st;
+		while(words >> st)
+		{
+			if(st.size() != 1)
+				throw std::runtime_error("state names must be single characters");
+			if(std::find(desc.stateNames.begin(), desc.stateNames.end(), st[0]) !=
+					desc.stateNames.end())
+				throw std::runtime_error("state " + st + " is declared twice");
+			desc.stateNames.push_back(st[0]);
+		}
+	}
+	else if(keyword == "rate")
+	{
+		RateDefinition rate;
+		if(not (words >> rate.name >> rate.prefix))
+			throw std::runtime_error("expected: rate <name> <parameter prefix>");
+		// coefficients are named prefix + term number, so a prefix ending in a digit could
+		// name the coefficient of another rate (g1 + 0 is g + 10)
+		if(std::isdigit(rate.prefix.back()))
+			throw std::runtime_error("the parameter prefix of rate " + rate.name + 
+					" ends in a digit");
+		for(const auto & r : desc.rates)
+			if(r.name == rate.name or r.prefix == rate.prefix)
+				throw std::runtime_error("rate " + rate.name + " is declared twice");
+		desc.rates.push_back(rate);
+	}
+	else if(keyword == "equilibrium")
+	{
+		std::string method;
+		if(not (words >> method) or method != "iterate")
+			throw std::runtime_error("expected: equilibrium iterate");
+		desc.hasSTMPrevalence = true;
+	}
+	else
+	{
+		// <initial> -> <final> = <expression>
+		const size_t arrow = line.find("->"), equals = line.find('=');
+		std::string initial, final, rest;
+		std::istringstream lhs (line.substr(0, equals));
+		if(arrow == std::string::npos or equals == std::string::npos or equals < arrow or
+				not (lhs >> initial >> rest >> final) or rest != "->" or initial.size() != 1
+				or final.size() != 1)
+			throw std::runtime_error("expected states, rate, equilibrium, or a transition "
+					"(<initial> -> <final> = <expression>)");
+		if(desc.stateNames.empty())
+			throw std::runtime_error("the states must be declared before the transitions");
+		const size_t NS = desc.num_states();
+		expressions.resize(NS * NS);
+		std::string & expr = expressions[desc.state_index(initial[0]) * NS +
+				desc.state_index(final[0])];
+		if(not expr.empty())
+			throw std::runtime_error("transition " + initial + " -> " + final +
+					" is declared twice");
+		expr = line.substr(equals + 1);
+		if(expr.find_first_not_of(" \t\r") == std::string::npos)
+			throw std::runtime_error("missing expression");
+	}
+}
+
+
+void ProgramModel::check_probabilities() const
+// the probabilities out of each state must sum to 1, at random rates and prevalences
+{
+	const size_t NS = desc.num_states(), NR = desc.num_rates(), n = 64;
+	std::mt19937 rng (20141201);
+	std::uniform_real_distribution<double> unif (0.0, 1.0);
+	std::vector<std::vector<STM::ParValue> > rateCols (NR, std::vector<STM::ParValue> (n));
+	std::vector<STM::ParValue> prev (n * NS), prob (n), sum (n);
+	const STM::ParValue * rates [maxRates];
+	for(size_t r = 0; r < NR; r++)
+	{
+		for(auto & v : rateCols[r])
+			v = unif(rng);
+		rates[r] = rateCols[r].data();
+	}
+	for(size_t j = 0; j < n; j++)
+	{
+		double tot = 0;
+		for(size_t s = 0; s < NS; s++)
+			tot += (prev[j * NS + s] = unif(rng));
+		for(size_t s = 0; s < NS; s++)
+			prev[j * NS + s] /= tot;
+	}
+
+	for(size_t initial = 0; initial < NS; initial++)
+	{
+		std::fill(sum.begin(), sum.end(), 0.0);
+		bool any = false;
+		for(size_t final = 0; final < NS; final++)
+		{
+			if(not desc.valid_transition(initial, final))
+				continue;
+			any = true;
+			transition_probs(initial * NS + final, n, rates, prev.data(), prob.data());
+			for(size_t j = 0; j < n; j++)
+				sum[j] += prob[j];
+		}
+		for(size_t j = 0; any and j < n; j++)
+		{
+			if(not (std::fabs(sum[j] - 1.0) < 1e-9))
+			{
+				std::ostringstream msg;
+				msg << desc.name << ": the probabilities of the transitions from state " <<
+						desc.stateNames[initial] << " sum to " << sum[j] << " rather than 1";
+				throw std::runtime_error(msg.str());
+			}
+		}
+	}
+}
+
+
+void ProgramModel::transition_probs(size_t type, size_t n,
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence,
+		STM::ParValue * prob) const
+{
+	if(type >= programs.size() or programs[type].empty())
+		throw std::runtime_error("ProgramModel: invalid transition type");
+	programs[type].evaluate(n, rates, prevalence, desc.num_states(), prob);
+}
+
+
+void ProgramModel::transition_gradient(size_t type, size_t n, 
+		const STM::ParValue * const * rates, const STM::ParValue * prevalence, 
+		STM::ParValue * prob, STM::ParValue * const * dRate, STM::ParValue * const * dPrev) 
+		const
+{
+	transition_probs(type, n, rates, prevalence, prob);
+	const ExpressionProgram & program = programs[type];
+	const size_t NS = desc.num_states();
+	for(size_t r = 0; r < desc.num_rates(); r++)
+	{
+		if(program.uses_rate(r))
+			program.derivative(n, rates, prevalence, NS, true, r, dRate[r]);
+		else
+			std::fill(dRate[r], dRate[r] + n, 0.0);
+	}
+	for(size_t s = 0; dPrev and s < NS; s++)
+	{
+		if(program.uses_prevalence(s))
+			program.derivative(n, rates, prevalence, NS, false, s, dPrev[s]);
+		else
+			std::fill(dPrev[s], dPrev[s] + n, 0.0);
+	}
+}
+
+
+void ProgramModel::step(size_t n, const STM::ParValue * const * rates, 
+		const STM::ParValue * prev, STM::ParValue * next, STM::ParValue * dNext) const
+// one plain iteration, next = G(prev) = prev * P(prev), for n cells; if dNext is given,
+// also the derivatives dG(final) / de(s), at dNext[(j * NS + final) * NS + s]
+{
+	const size_t NS = desc.num_states();
+	STM::ParValue prob [chunkSize], dProb [chunkSize];
+	std::fill(next, next + n * NS, 0.0);
+	if(dNext)
+		std::fill(dNext, dNext + n * NS * NS, 0.0);
+	for(size_t type = 0; type < NS * NS; type++)
+	{
+		if(programs[type].empty())
+			continue;
+		const size_t initial = type / NS, final = type % NS;
+		programs[type].evaluate(n, rates, prev, NS, prob);
+		for(size_t j = 0; j < n; j++)
+			next[j * NS + final] += prev[j * NS + initial] * prob[j];
+		if(not dNext)
+			continue;
+		for(size_t j = 0; j < n; j++)
+			dNext[(j * NS + final) * NS + initial] += prob[j];
+		for(size_t s = 0; s < NS; s++)
+		{
+			if(not programs[type].uses_prevalence(s))
+				continue;
+			programs[type].derivative(n, rates, prev, NS, false, s, dProb);
+			for(size_t j = 0; j < n; j++)
+				dNext[(j * NS + final) * NS + s] += prev[j * NS + initial] * dProb[j];
+		}
+	}
+}
+
+
+void ProgramModel::equilibrium(size_t n, const STM::ParValue * const * rates,
+		STM::ParValue * prev, bool warm) const
+/*
+	The fixed point of G(e) = e * P(e), on the same path as FourStateModel::equilibrium,
+	so that both find the same fixed point where there are several: from equal
+	prevalences (or the warm values), coldSteps plain iterations, then Newton's method
+	on F(e) = G(e) - e in the free states, with the Jacobian from the derivatives of
+	the programs. The last state of the file is the dependent one, like R in the four
+	state model. Newton steps are projected back onto the simplex, and a cell whose step
+	is not finite takes a plain iteration instead. Cells whose residual is below
+	tolerance keep their values, so that solving again from the solution changes nothing
+*/
+{
+	const size_t NS = desc.num_states(), NR = desc.num_rates(), NF = NS - 1;
+	const size_t coldSteps = 20, maxSteps = 200;
+	const double tolerance = 1e-13;
+	std::vector<STM::ParValue> g (chunkSize * NS), dG (chunkSize * NS * NS);
+	for(size_t first = 0; first < n; first += chunkSize)
+	{
+		const size_t len = std::min(chunkSize, n - first);
+		STM::ParValue * e = prev + first * NS;
+		const STM::ParValue * cellRates [maxRates];
+		for(size_t r = 0; r < NR; r++)
+			cellRates[r] = rates[r] + first;
+		if(not warm)
+			std::fill(e, e + len * NS, 1.0 / NS);
+		for(size_t j = 0; j < len; j++)
+			e[j * NS + NF] = 1.0 - std::accumulate(e + j * NS, e + j * NS + NF, 0.0);
+
+		for(size_t k = 0; k < maxSteps; k++)
+		{
+			const bool newton = warm or k >= coldSteps;
+			step(len, cellRates, e, g.data(), newton ? dG.data() : nullptr);
+			double maxResidual = 0;
+			for(size_t j = 0; j < len; j++)
+			{
+				STM::ParValue * ej = e + j * NS;
+				const STM::ParValue * gj = &g[j * NS];
+				double f [maxStates], residual = 0;
+				for(size_t c = 0; c < NF; c++)
+				{
+					f[c] = gj[c] - ej[c];
+					residual = std::max(residual, std::fabs(f[c]));
+				}
+				maxResidual = std::max(maxResidual, residual);
+				if(residual < tolerance)
+					continue;
+
+				// Jacobian of F, with the dependent state moving against each free state
+				double x [maxStates], tot = 0;
+				bool useNewton = false;
+				if(newton)
+				{
+					const STM::ParValue * dGj = &dG[j * NS * NS];
+					double jac [maxStates * maxStates];
+					for(size_t r = 0; r < NF; r++)
+						for(size_t c = 0; c < NF; c++)
+							jac[r * NF + c] = dGj[r * NS + c] - dGj[r * NS + NF] - 
+									(r == c ? 1.0 : 0.0);
+					useNewton = solve_linear(NF, jac, f);
+					for(size_t c = 0; c < NF; c++)
+					{
+						useNewton = useNewton and std::isfinite(f[c]);
+						x[c] = std::max(0.0, ej[c] - f[c]);
+						tot += x[c];
+					}
+				}
+				const double norm = tot > 1.0 ? 1.0 / tot : 1.0;
+				for(size_t c = 0; c < NF; c++)
+					ej[c] = useNewton ? x[c] * norm : gj[c];
+				ej[NF] = 1.0 - std::accumulate(ej, ej + NF, 0.0);
+			}
+			if(newton and maxResidual < tolerance)
+				break;
+		}
+		for(size_t j = 0; j < len; j++)
+			e[j * NS + NF] = std::max(0.0, e[j * NS + NF]);
+	}
+}
+
+} // !STMModel namespace
@@ -0,0 +1,140 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	models.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+
+	To add a model, write its policy class (see model_2s.hpp), instantiate its 
+	ModelLikelihood in the model's source file, and add it to the lists below. Models 
+	read from a model file (see model_program.hpp) are kept in loaded_models() for the 
+	rest of the run
+*/
+
+#include <sstream>
+#include <stdexcept>
+#include <memory>
+#include <list>
+#include <fstream>
+#include "../hdr/models.hpp"
+#include "../hdr/model_2s.hpp"
+#include "../hdr/model_4s.hpp"
+#include "../hdr/model_program.hpp"
+#include "../hdr/input.hpp"
+
+// instantiated in the source file of each model
+extern template class STMLikelihood::ModelLikelihood<STMModel::TwoStateModel>;
+extern template class STMLikelihood::ModelLikelihood<STMModel::FourStateModel>;
+
+namespace STMModel
+{
+
+namespace {
+	std::list<std::unique_ptr<ProgramModel> > & loaded_models()
+	{
+		static std::list<std::unique_ptr<ProgramModel> > models;
+		return models;
+	}
+}
+
+
+const ProgramModel * find_program_model(const ModelDescription & model)
+{
+	for(const auto & m : loaded_models())
+		if(&m->description() == &model)
+			return m.get();
+	return nullptr;
+}
+
+
+const ModelDescription & find_model(const std::string & name)
+{
+	if(name == TwoStateModel::description().name)
+		return TwoStateModel::description();
+	if(name == FourStateModel::description().name)
+		return FourStateModel::description();
+	for(const auto & m : loaded_models())
+		if(m->description().name == name)
+			return m->description();
+
+	std::ifstream file (name);
+	if(file.is_open())
+	{
+		loaded_models().emplace_back(new ProgramModel(name));
+		return loaded_models().back()->description();
+	}
+
+	std::ostringstream msg;
+	msg << "unknown model <" << name << ">; available models are:";
+	for(const auto & m : model_names())
+		msg << " " << m;
+	msg << ", or the name of a model file";
+	throw std::runtime_error(msg.str());
+}
+
+
+std::vector<std::string> model_names()
+{
+	return { TwoStateModel::description().name, FourStateModel::description().name };
+}
+
+} // !STMModel namespace
+
+
+namespace STMLikelihood
+{
+
+Likelihood * make_likelihood(const STMModel::ModelDescription & model,
+		const std::vector<STMModel::STMTransition> & transitionData,
+		const std::string & transitionDataOriginFile,
+		const std::map<std::string, PriorDist> & pr, unsigned int numThreads,
+		int parameterInterval, STM::PrevalenceModelTypes prevModel, 
+		const STMModel::CovariateBasis & basis, bool singlePrecision, 
+		STMModel::RowOrder order, bool exactIntervals, unsigned int firstCpu)
+{
+	if(&model == &STMModel::TwoStateModel::description())
+		return new ModelLikelihood<STMModel::TwoStateModel> (transitionData, 
+				transitionDataOriginFile, pr, numThreads, parameterInterval, prevModel, 
+				basis, singlePrecision, order, exactIntervals, firstCpu);
+	if(&model == &STMModel::FourStateModel::description())
+		return new ModelLikelihood<STMModel::FourStateModel> (transitionData, 
+				transitionDataOriginFile, pr, numThreads, parameterInterval, prevModel, 
+				basis, singlePrecision, order, exactIntervals, firstCpu);
+	if(const STMModel::ProgramModel * pm = STMModel::find_program_model(model))
+		return new ProgramLikelihood(*pm, transitionData, transitionDataOriginFile, pr, 
+				numThreads, parameterInterval, prevModel, basis, singlePrecision, order, 
+				exactIntervals, firstCpu);
+	throw std::runtime_error("make_likelihood: no likelihood for model " + model.name);
+}
+
+
+Likelihood * make_likelihood(const STMModel::ModelDescription & model,
+		const STMInput::SerializationData & sd, const std::vector<std::string> &parNames,
+		const std::vector<STMModel::STMTransition> & transitionData, unsigned int firstCpu)
+{
+	if(&model == &STMModel::TwoStateModel::description())
+		return new ModelLikelihood<STMModel::TwoStateModel> (sd, parNames, transitionData,
+				firstCpu);
+	if(&model == &STMModel::FourStateModel::description())
+		return new ModelLikelihood<STMModel::FourStateModel> (sd, parNames, transitionData,
+				firstCpu);
+	if(const STMModel::ProgramModel * pm = STMModel::find_program_model(model))
+		return new ProgramLikelihood(*pm, sd, parNames, transitionData, firstCpu);
+	throw std::runtime_error("make_likelihood: no likelihood for model " + model.name);
+}
+
+} // !STMLikelihood namespace
@@ -0,0 +1,432 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	nuts.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <gsl/gsl_randist.h>
+#include "../hdr/nuts.hpp"
+#include "../hdr/likelihood.hpp"
+#include "../hdr/input.hpp"
+
+namespace {
+	// a change in the joint log density beyond which the trajectory is divergent
+	const double maxEnergyError = 1000;
+
+	// dual averaging constants (Hoffman and Gelman 2014)
+	const double stepGamma = 0.05;
+	const double stepT0 = 10;
+	const double stepKappa = 0.75;
+
+	// warm-up windows, as in Stan: the first and last iterations only tune the step size,
+	// and the mass matrix is estimated in between, in windows of doubling size
+	const int initialBuffer = 75;
+	const int terminalBuffer = 50;
+	const int firstWindow = 25;
+}
+
+namespace STMEngine {
+
+NUTS::NUTS(const std::vector<STMParameters::ParameterSettings> & inits,
+		STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+		EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, int burnin,
+		bool doDIC, bool rngSetSeed, int rngSeed, bool denseMetric) :
+		Metropolis(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, rngSetSeed,
+		rngSeed, denseMetric ? SamplerType::NUTSDense : SamplerType::NUTS),
+		activeIndex(active_index()), denseMetric(denseMetric), stepSize(0.1), 
+		warmupIterations(1000), maxTreeDepth(10), targetAcceptance(0.8), warmedUp(false), 
+		numTransitions(0), numDivergent(0), sumTreeDepth(0)
+{
+	const size_t d = activeIndex.size();
+	current.theta = active_values(activeIndex);
+	current.r.assign(d, 0.0);
+	inverseMetric.assign(d * d, 0.0);
+	for(size_t i = 0; i < d; i++)
+		inverseMetric[i * d + i] = 1;
+	metricFactor = inverseMetric;
+	evaluate(current);
+	if(saveResumeData)
+		serialize_all();
+}
+
+
+NUTS::NUTS(std::map<std::string, STMInput::SerializationData> & sd,
+		STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue) :
+		Metropolis(sd, lhood, queue), activeIndex(active_index()), numTransitions(0), 
+		numDivergent(0), sumTreeDepth(0)
+{
+	const STMInput::SerializationData & esd = sd.at("Metropolis");
+	denseMetric = samplerType == SamplerType::NUTSDense;
+	stepSize = STMInput::str_convert<double>(esd.at("nutsStepSize")[0]);
+	warmupIterations = STMInput::str_convert<int>(esd.at("nutsWarmupIterations")[0]);
+	maxTreeDepth = STMInput::str_convert<int>(esd.at("nutsMaxTreeDepth")[0]);
+	targetAcceptance = STMInput::str_convert<double>(esd.at("nutsTargetAcceptance")[0]);
+	warmedUp = STMInput::str_convert<bool>(esd.at("nutsWarmedUp")[0]);
+	inverseMetric = STMInput::str_convert<double>(esd.at("nutsInverseMetric"));
+
+	const size_t d = activeIndex.size();
+	current.theta = active_values(activeIndex);
+	current.r.assign(d, 0.0);
+	if(inverseMetric.size() != d * d)
+		throw std::runtime_error("NUTS: the saved mass matrix does not match the parameters");
+	metricFactor = inverseMetric;
+	if(not cholesky_factor(d, metricFactor))
+		throw std::runtime_error("NUTS: the saved mass matrix is not positive definite");
+	evaluate(current);
+}
+
+
+std::string NUTS::serialize(char sep) const
+{
+	std::ostringstream result;
+	result << Metropolis::serialize(sep);
+	result << std::setprecision(17);
+	result << "nutsStepSize" << sep << stepSize << "\n";
+	result << "nutsWarmupIterations" << sep << warmupIterations << "\n";
+	result << "nutsMaxTreeDepth" << sep << maxTreeDepth << "\n";
+	result << "nutsTargetAcceptance" << sep << targetAcceptance << "\n";
+	result << "nutsWarmedUp" << sep << warmedUp << "\n";
+	result << "nutsInverseMetric";
+	for(const auto & v : inverseMetric)
+		result << sep << v;
+	result << "\n";
+	return result.str();
+}
+
+
+void NUTS::auto_adapt()
+// warmupIterations iterations, not saved: the step size is tuned by dual averaging 
+// towards targetAcceptance throughout, and the inverse mass matrix is the shrunk
+// covariance of each window (its diagonal only with -j nuts); both are then fixed, the
+// step size at the dual averaging's average
+{
+	if(outputLevel >= EngineOutputLevel::Normal)
+		std::cerr << timestamp() << " Starting NUTS warm-up" << std::endl;
+
+	// the windows of the mass matrix; short warm-ups are split in the same proportions
+	int initial = initialBuffer, terminal = terminalBuffer, window = firstWindow;
+	if(initial + window + terminal > warmupIterations)
+	{
+		initial = 0.15 * warmupIterations;
+		terminal = 0.1 * warmupIterations;
+		window = warmupIterations - initial - terminal;
+	}
+	const int adaptEnd = warmupIterations - terminal;
+	int windowEnd = initial + window;
+	if(windowEnd + 2 * window > adaptEnd)
+		windowEnd = adaptEnd;
+
+	find_step_size();
+	restart_step_size();
+	std::vector<std::vector<double> > windowSamples;
+	numTransitions = numDivergent = sumTreeDepth = 0;
+	double sumAcceptance = 0;
+	for(int i = 0; i < warmupIterations; i++)
+	{
+		const double acceptance = transition();
+		sumAcceptance += acceptance;
+		adapt_step_size(acceptance);
+		if(i >= initial and i < adaptEnd)
+		{
+			windowSamples.push_back(current.theta);
+			if(i + 1 == windowEnd)
+			{
+				// the inverse mass matrix; the previous one is kept if the estimate is
+				// not positive definite
+				shrunk_covariance(activeIndex.size(), windowSamples, denseMetric, 
+						inverseMetric, metricFactor);
+				windowSamples.clear();
+				find_step_size();
+				restart_step_size();
+				window *= 2;
+				windowEnd = i + 1 + window;
+				if(windowEnd + 2 * window > adaptEnd)
+					windowEnd = adaptEnd;
+			}
+		}
+
+		if((i + 1) % adaptationSampleSize == 0 or i + 1 == warmupIterations)
+		{
+			if(outputLevel >= EngineOutputLevel::Talkative)
+			{
+				std::cerr << "    " << timestamp() << " warm-up iteration " << i + 1 <<
+						"   step size " << stepSize << "   mean acceptance " <<
+						sumAcceptance / numTransitions << "   mean tree depth " <<
+						double(sumTreeDepth) / numTransitions << "   divergent " <<
+						numDivergent << "\n";
+			}
+			numTransitions = numDivergent = sumTreeDepth = 0;
+			sumAcceptance = 0;
+		}
+	}
+	stepSize = std::exp(logStepBar);
+	warmedUp = true;
+
+	restart_iterations(activeIndex, current.theta);
+	currentSamples.clear();
+	if(saveResumeData)
+		serialize_all();
+	if(outputLevel >= EngineOutputLevel::Normal)
+		std::cerr << timestamp() << " Warm-up completed, step size " << stepSize << std::endl;
+}
+
+
+std::map<std::string, double> NUTS::do_sample(int n, bool saveDeviance)
+// returns the mean acceptance statistic of the iterations, for every active parameter
+{
+	double sumAcceptance = 0;
+	for(int i = 0; i < n; i++)
+	{
+		for(int j = 0; j < thinSize; j++)
+			sumAcceptance += transition();
+		save_sample(saveDeviance);
+	}
+	if(outputLevel >= EngineOutputLevel::Talkative)
+	{
+		std::cerr << "    " << timestamp() << " mean acceptance " << sumAcceptance / 
+				numTransitions << "   mean tree depth " << double(sumTreeDepth) / 
+				numTransitions << "   divergent " << numDivergent << "\n";
+	}
+	numTransitions = numDivergent = sumTreeDepth = 0;
+	std::map<std::string, double> acceptanceRates;
+	for(const auto & par : parameters.active_names())
+		acceptanceRates[par] = sumAcceptance / (n * thinSize);
+	return acceptanceRates;
+}
+
+
+void NUTS::evaluate(Point & point)
+// the log posterior of point.theta and its gradient
+{
+	STMParameters::STModelParameters p (parameters);
+	for(size_t i = 0; i < activeIndex.size(); i++)
+		p.update(activeIndex[i], point.theta[i]);
+	point.logPosterior = log_posterior_gradient(p, activeIndex, point.grad, 
+			point.logLikelihood);
+}
+
+
+double NUTS::joint(const Point & point) const
+// the log posterior minus the kinetic energy, r^T M^-1 r / 2
+{
+	std::vector<double> v;
+	velocity(point.r, v);
+	double kinetic = 0;
+	for(size_t i = 0; i < v.size(); i++)
+		kinetic += point.r[i] * v[i];
+	return point.logPosterior - 0.5 * kinetic;
+}
+
+
+void NUTS::velocity(const std::vector<double> & r, std::vector<double> & v) const
+// v = M^-1 r
+{
+	const size_t d = r.size();
+	v.assign(d, 0.0);
+	for(size_t i = 0; i < d; i++)
+	{
+		if(not denseMetric)
+			v[i] = inverseMetric[i * d + i] * r[i];
+		else
+			for(size_t k = 0; k < d; k++)
+				v[i] += inverseMetric[i * d + k] * r[k];
+	}
+}
+
+
+void NUTS::draw_momentum(std::vector<double> & r)
+// r ~ N(0, M): solves L^T r = z, with M^-1 = L L^T
+{
+	const size_t d = activeIndex.size();
+	r.resize(d);
+	for(auto & ri : r)
+		ri = gsl_ran_gaussian(rng.get(), 1.0);
+	for(size_t i = d; i-- > 0; )
+	{
+		for(size_t k = i + 1; k < d; k++)
+			r[i] -= metricFactor[k * d + i] * r[k];
+		r[i] /= metricFactor[i * d + i];
+	}
+}
+
+
+void NUTS::leapfrog(Point & point, double eps)
+{
+	const size_t d = point.theta.size();
+	std::vector<double> v;
+	for(size_t i = 0; i < d; i++)
+		point.r[i] += 0.5 * eps * point.grad[i];
+	velocity(point.r, v);
+	for(size_t i = 0; i < d; i++)
+		point.theta[i] += eps * v[i];
+	evaluate(point);
+	for(size_t i = 0; i < d; i++)
+		point.r[i] += 0.5 * eps * point.grad[i];
+}
+
+
+bool NUTS::no_uturn(const Point & minus, const Point & plus) const
+{
+	std::vector<double> vMinus, vPlus;
+	velocity(minus.r, vMinus);
+	velocity(plus.r, vPlus);
+	double dotMinus = 0, dotPlus = 0;
+	for(size_t i = 0; i < minus.theta.size(); i++)
+	{
+		const double span = plus.theta[i] - minus.theta[i];
+		dotMinus += span * vMinus[i];
+		dotPlus += span * vPlus[i];
+	}
+	return dotMinus >= 0 and dotPlus >= 0;
+}
+
+
+NUTS::Subtree NUTS::build_tree(const Point & start, double logSlice, int direction,
+		int depth, double joint0)
+// the 2^depth points after start in the given direction (Hoffman and Gelman, algorithm 6)
+{
+	if(depth == 0)
+	{
+		Subtree tree;
+		tree.proposal = start;
+		leapfrog(tree.proposal, direction * stepSize);
+		const double j = joint(tree.proposal);
+		tree.numValid = (logSlice <= j) ? 1 : 0;
+		tree.divergent = not (logSlice < j + maxEnergyError);
+		tree.valid = not tree.divergent;
+		const double a = std::exp(j - joint0);
+		tree.sumAcceptance = std::isnan(a) ? 0 : std::min(1.0, a);
+		tree.numAcceptance = 1;
+		tree.minus = tree.plus = tree.proposal;
+		return tree;
+	}
+
+	Subtree tree = build_tree(start, logSlice, direction, depth - 1, joint0);
+	if(not tree.valid)
+		return tree;
+	Subtree next = build_tree(direction < 0 ? tree.minus : tree.plus, logSlice, direction,
+			depth - 1, joint0);
+	if(direction < 0)
+		tree.minus = next.minus;
+	else
+		tree.plus = next.plus;
+	if(tree.numValid + next.numValid > 0 and gsl_rng_uniform(rng.get()) <
+			next.numValid / (tree.numValid + next.numValid))
+		tree.proposal = next.proposal;
+	tree.sumAcceptance += next.sumAcceptance;
+	tree.numAcceptance += next.numAcceptance;
+	tree.divergent = next.divergent;
+	tree.valid = next.valid and no_uturn(tree.minus, tree.plus);
+	tree.numValid += next.numValid;
+	return tree;
+}
+
+
+double NUTS::transition()
+// one iteration: the trajectory is doubled forwards or backwards in time with the 
+// leapfrog integrator until it turns back on itself (or maxTreeDepth doublings), and the
+// next state drawn from it with the slice sampler of the efficient NUTS. Returns its
+// acceptance statistic (the mean Metropolis acceptance probability of the points of the
+// last doubling), which the step size is tuned on
+{
+	draw_momentum(current.r);
+	const double joint0 = joint(current);
+	const double logSlice = joint0 + std::log(gsl_rng_uniform_pos(rng.get()));
+
+	Point minus = current, plus = current;
+	double numValid = 1;
+	bool valid = true;
+	int depth = 0;
+	Subtree tree;
+	while(valid and depth < maxTreeDepth)
+	{
+		const int direction = gsl_rng_uniform(rng.get()) < 0.5 ? -1 : 1;
+		tree = build_tree(direction < 0 ? minus : plus, logSlice, direction, depth, joint0);
+		if(direction < 0)
+			minus = tree.minus;
+		else
+			plus = tree.plus;
+		if(tree.valid and gsl_rng_uniform(rng.get()) < tree.numValid / numValid)
+			current = tree.proposal;
+		numValid += tree.numValid;
+		valid = tree.valid and no_uturn(minus, plus);
+		depth++;
+	}
+
+	for(size_t i = 0; i < activeIndex.size(); i++)
+		parameters.update(activeIndex[i], current.theta[i]);
+	currentLL = current.logLikelihood;
+	currentPosteriorProb = current.logPosterior;
+	numTransitions++;
+	sumTreeDepth += depth;
+	if(tree.divergent)
+		numDivergent++;
+	return tree.sumAcceptance / tree.numAcceptance;
+}
+
+
+void NUTS::find_step_size()
+// doubles or halves the step size until the acceptance probability of a single leapfrog
+// step crosses 0.5 (Hoffman and Gelman, algorithm 4)
+{
+	Point start = current;
+	draw_momentum(start.r);
+	const double joint0 = joint(start);
+	auto log_ratio = [&]()
+	{
+		Point p = start;
+		leapfrog(p, stepSize);
+		const double lr = joint(p) - joint0;
+		return std::isnan(lr) ? -INFINITY : lr;
+	};
+	double logRatio = log_ratio();
+	const int direction = logRatio > std::log(0.5) ? 1 : -1;
+	for(int k = 0; k < 100 and direction * logRatio > -direction * std::log(2.0); k++)
+	{
+		stepSize *= std::pow(2.0, direction);
+		logRatio = log_ratio();
+	}
+}
+
+
+void NUTS::restart_step_size()
+{
+	muStep = std::log(10 * stepSize);
+	hBar = 0;
+	logStepBar = 0;
+	numStepUpdates = 0;
+}
+
+
+void NUTS::adapt_step_size(double acceptance)
+{
+	const double m = ++numStepUpdates;
+	hBar = (1 - 1 / (m + stepT0)) * hBar + (targetAcceptance - acceptance) / (m + stepT0);
+	const double logStep = muStep - std::sqrt(m) / stepGamma * hBar;
+	const double eta = std::pow(m, -stepKappa);
+	logStepBar = eta * logStep + (1 - eta) * logStepBar;
+	stepSize = std::exp(logStep);
+}
+
+} // namespace
@@ -37,6 +37,7 @@ namespace STMParameters
 std::vector<STM::ParName> STModelParameters::parNames;
 std::vector<STM::ParName> STModelParameters::activeParNames;
 std::map<STM::ParName, ParameterSettings> STModelParameters::parSettings;
+std::map<STM::ParName, size_t> STModelParameters::parIndex;
 double STModelParameters::optimalAcceptanceRate = 0.234;
 std::vector<double> STModelParameters::targetAcceptanceInterval = {0.15, 0.5};
 const double STModelParameters::varianceMax = 1e3;
@@ -61,6 +62,7 @@ void STModelParameters::set_up_par_settings(const std::vector<ParameterSettings>
 			parSettings[par.name] = par;
 		if(std::find(parNames.begin(), parNames.end(), par.name) == parNames.end())
 		{
+			parIndex[par.name] = parNames.size();
 			parNames.push_back(par.name);
 			if(not par.isConstant) activeParNames.push_back(par.name);
 		}
@@ -90,9 +92,11 @@ STModelParameters::STModelParameters(STMInput::SerializationData & sd)
 	{
 		ParameterSettings ps (names[i], inits[i], isConstant[i], var[i], accept[i]);
 		newPars.push_back(ps);
-		parameterValues[names[i]] = vals[i];
 	}
 	set_up_par_settings(newPars);
+	parameterValues.resize(parNames.size());
+	for(int i = 0; i < names.size(); i++)
+		update(index(names[i]), vals[i]);
 	
 	STModelParameters::targetAcceptanceInterval = STMInput::str_convert<double>(sd.at("targetAcceptanceInterval"));
 	iterationCount = STMInput::str_convert<double>(sd.at("iterationCount")[0]);
@@ -136,7 +140,7 @@ std::string STModelParameters::serialize(char s) const
 	result << "iterationCount" << s << iteration();
 	
 	result << "\nparameterValues";
-	for(const auto & pn : pNames) result << s << parameterValues.at(pn);
+	for(const auto & v : parameterValues) result << s << v;
 	result << "\n";
 
 	return result.str();
@@ -259,8 +263,9 @@ bool STModelParameters::adapted(STM::ParName par) const
 
 void STModelParameters::reset()
 {
-	for(const auto & p : names())
-		parameterValues[p] = parSettings[p].initialValue;
+	parameterValues.resize(parNames.size());
+	for(size_t i = 0; i < parNames.size(); i++)
+		parameterValues[i] = parSettings[parNames[i]].initialValue;
 	iterationCount = 0;
 }
 
@@ -289,16 +294,33 @@ int STModelParameters::iteration() const
 { return iterationCount; }
 
 
-const STM::ParMap & STModelParameters::current_state() const
+const STM::ParVector & STModelParameters::values() const
 { return parameterValues; }
 
 
+size_t STModelParameters::index(const STM::ParName & par) const
+{ return parIndex.at(par); }
+
+
+STM::ParMap STModelParameters::current_state() const
+{
+	STM::ParMap result;
+	for(size_t i = 0; i < parNames.size(); i++)
+		result[parNames[i]] = parameterValues[i];
+	return result;
+}
+
+
 void STModelParameters::update(const STM::ParPair & par)
-{ parameterValues.at(par.first) = par.second; }
+{ parameterValues.at(index(par.first)) = par.second; }
+
+
+void STModelParameters::update(size_t index, STM::ParValue val)
+{ parameterValues.at(index) = val; }
 
 
 STM::ParPair STModelParameters::at(const STM::ParName & p) const
-{ return STM::ParPair (p, parameterValues.at(p)); }
+{ return STM::ParPair (p, parameterValues.at(index(p))); }
 
 
 } // !namespace Parameters
\ No newline at end of file
@@ -0,0 +1,342 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	tempering.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <gsl/gsl_rng.h>
+#include "../hdr/tempering.hpp"
+#include "../hdr/likelihood.hpp"
+#include "../hdr/input.hpp"
+#include "../hdr/threadpool.hpp"
+
+namespace {
+	// the temperature of the hottest chain, and the number of iterations between exchanges
+	const double maxTemperature = 100;
+	const int swapInterval = 5;
+
+	// the adaptation of the ladder decays as ladderT0 / (ladderLag * (t + ladderT0)), for
+	// t rounds of exchanges (Vousden et al. 2016)
+	const double ladderLag = 100;
+	const double ladderT0 = 1000;
+
+	// the log of the proposal scales of the hot chains moves by scaleGain * (acceptance 
+	// rate - optimal rate) in the first round of exchanges, decaying as the ladder's
+	const double scaleGain = 0.1;
+}
+
+namespace STMEngine {
+
+/*
+	A hot chain: a Metropolis sampler that saves nothing, with public access to what the
+	exchanges need
+*/
+class ParallelTempering::Replica : public Metropolis
+{
+	public:
+	Replica(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+			int thin) :
+			Metropolis(inits, queue, lhood, EngineOutputLevel::Quiet, 
+			STMOutput::OutputOptions(), thin, 0, false, false, 0, SamplerType::Tempering) {}
+	Replica(std::map<std::string, STMInput::SerializationData> & sd,
+			STMLikelihood::Likelihood * const lhood, STMOutput::OutputQueue * const queue) :
+			Metropolis(sd, lhood, queue)
+	{
+		saveResumeData = false;
+		outputLevel = EngineOutputLevel::Quiet;
+		computeDIC = false;
+	}
+
+	// with a gain, the proposal scales are tuned from the acceptance rates of the samples
+	void sample(int n, double gain = 0)
+	{
+		const std::map<std::string, double> rates = do_sample(n);
+		currentSamples.clear();
+		for(const auto & rate : rates)
+			proposalScale[rate.first] *= std::exp(gain * (rate.second - 
+					parameters.optimal_acceptance_rate()));
+	}
+	void seed(unsigned long int s) { gsl_rng_set(rng.get(), s); }
+	void set_temperature(double t) { inverseTemperature = 1 / t; }
+	void set_proposal_scale(double s)
+	{
+		for(const auto & par : parameters.names())
+			proposalScale[par] = s;
+	}
+	double log_likelihood() const { return currentLL; }
+	const STM::ParVector & values() const { return parameters.values(); }
+	void set_state(const STM::ParVector & values, double logLikelihood)
+	{
+		for(size_t i = 0; i < values.size(); i++)
+			parameters.update(i, values[i]);
+		currentLL = logLikelihood;
+	}
+
+	std::string save(size_t chain, char sep) const
+	{
+		std::ostringstream result;
+		result << std::setprecision(17);
+		const std::string key = "replica_" + std::to_string(chain) + "_";
+		result << key << "currentLL" << sep << currentLL << "\n";
+		result << key << "values";
+		for(const auto & v : parameters.values())
+			result << sep << v;
+		result << "\n" << key << "proposalScale";
+		for(const auto & par : parameters.names())
+			result << sep << proposalScale.at(par);
+		result << "\n";
+		return result.str();
+	}
+	void load(const STMInput::SerializationData & sd, size_t chain)
+	{
+		const std::string key = "replica_" + std::to_string(chain) + "_";
+		set_state(STMInput::str_convert<double>(sd.at(key + "values")), 
+				STMInput::str_convert<double>(sd.at(key + "currentLL")[0]));
+		try
+		{
+			const std::vector<double> scale = STMInput::str_convert<double>(
+					sd.at(key + "proposalScale"));
+			for(size_t i = 0; i < scale.size(); i++)
+				proposalScale[parameters.names()[i]] = scale[i];
+		}
+		catch (std::out_of_range &e)
+		{
+			set_proposal_scale(1);	// resume data written before the scales were tuned
+		}
+	}
+};
+
+
+ParallelTempering::ParallelTempering(
+		const std::vector<STMParameters::ParameterSettings> & inits,
+		STMOutput::OutputQueue * const queue, STMLikelihood::Likelihood * const lhood,
+		const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods,
+		EngineOutputLevel outLevel, STMOutput::OutputOptions outOpt, int thin, int burnin,
+		bool doDIC, bool rngSetSeed, int rngSeed) :
+		Metropolis(inits, queue, lhood, outLevel, outOpt, thin, burnin, doDIC, rngSetSeed,
+		rngSeed, SamplerType::Tempering), numSwapRounds(0), adapting(false)
+{
+	if(replicaLikelihoods.empty())
+		throw std::runtime_error("ParallelTempering: at least one hot chain is needed");
+	// the ladder starts as a geometric series from 1 to maxTemperature, and the proposal
+	// scales of the hot chains at sqrt(T); chain i runs on pool thread i, pinned to the 
+	// first CPU of its likelihood (main gives each likelihood its own CPUs)
+	const size_t numChains = replicaLikelihoods.size() + 1;
+	for(size_t i = 0; i < numChains; i++)
+		temperatures.push_back(std::pow(maxTemperature, double(i) / (numChains - 1)));
+	for(size_t i = 0; i < replicaLikelihoods.size(); i++)
+	{
+		replicas.emplace_back(new Replica(inits, queue, replicaLikelihoods[i], thin));
+		replicas.back()->set_proposal_scale(std::sqrt(temperatures[i + 1]));
+	}
+	set_temperatures();
+	pool.reset(new STMThreads::ThreadPool(numChains, 0, likelihood->num_threads()));
+	if(saveResumeData)
+		serialize_all();
+}
+
+
+ParallelTempering::ParallelTempering(std::map<std::string, STMInput::SerializationData> & sd,
+		STMLikelihood::Likelihood * const lhood, 
+		const std::vector<STMLikelihood::Likelihood *> & replicaLikelihoods,
+		STMOutput::OutputQueue * const queue) :
+		Metropolis(sd, lhood, queue), adapting(false)
+{
+	const STMInput::SerializationData & esd = sd.at("Metropolis");
+	numSwapRounds = STMInput::str_convert<int>(esd.at("temperingSwapRounds")[0]);
+	temperatures = STMInput::str_convert<double>(esd.at("temperatures"));
+	if(replicaLikelihoods.size() + 1 != temperatures.size())
+		throw std::runtime_error("ParallelTempering: the number of likelihoods does not "
+				"match the saved temperatures");
+	for(size_t i = 0; i < replicaLikelihoods.size(); i++)
+	{
+		replicas.emplace_back(new Replica(sd, replicaLikelihoods[i], queue));
+		replicas.back()->load(esd, i + 1);
+	}
+	set_temperatures();
+	pool.reset(new STMThreads::ThreadPool(temperatures.size(), 0, 
+			likelihood->num_threads()));
+}
+
+
+ParallelTempering::~ParallelTempering() {}
+
+
+size_t ParallelTempering::num_chains(const STMInput::SerializationData & sd)
+{ return sd.at("temperatures").size(); }
+
+
+std::string ParallelTempering::serialize(char sep) const
+{
+	std::ostringstream result;
+	result << Metropolis::serialize(sep);
+	result << std::setprecision(17);
+	result << "temperingSwapRounds" << sep << numSwapRounds << "\n";
+	result << "temperatures";
+	for(const auto & t : temperatures)
+		result << sep << t;
+	result << "\n";
+	for(size_t i = 0; i < replicas.size(); i++)
+		result << replicas[i]->save(i + 1, sep);
+	return result.str();
+}
+
+
+void ParallelTempering::set_up_rng()
+{
+	Metropolis::set_up_rng();
+	for(auto & r : replicas)
+		r->seed(gsl_rng_get(rng.get()));
+}
+
+
+void ParallelTempering::auto_adapt()
+// the sampler variances are shared by all parameter objects (see STModelParameters), so
+// only the cold chain adapts them; the hot chains wait, and then use the same proposals
+// times their own proposal scales
+{
+	adapting = true;
+	Metropolis::auto_adapt();
+	adapting = false;
+	if(saveResumeData)
+		serialize_all();
+}
+
+
+std::map<std::string, double> ParallelTempering::do_sample(int n, bool saveDeviance)
+// the chains sample concurrently for swapInterval iterations between exchanges; during
+// the burnin, the ladder and the proposal scales are adapted. Returns the acceptance 
+// rates of the cold chain
+{
+	if(adapting)
+		return Metropolis::do_sample(n, saveDeviance);
+
+	swapAttempts.assign(temperatures.size(), 0);
+	swapAccepted.assign(temperatures.size(), 0);
+	std::map<std::string, double> acceptanceRates;
+	std::vector<int> accepted;
+	for(int done = 0; done < n; )
+	{
+		// adaptBlocks is set during the burnin
+		const int k = std::min(swapInterval, n - done);
+		const double gain = adaptBlocks ? 
+				scaleGain * ladderT0 / (numSwapRounds + ladderT0) : 0;
+		pool->run([&](unsigned int chain)
+		{
+			if(chain > 0)
+				replicas[chain - 1]->sample(k, gain);
+			else
+				for(const auto & rate : Metropolis::do_sample(k, saveDeviance))
+					acceptanceRates[rate.first] += rate.second * k / n;
+		});
+		done += k;
+
+		swap_states(accepted);
+		if(adaptBlocks)
+			adapt_ladder(accepted);
+	}
+
+	if(outputLevel >= EngineOutputLevel::Talkative)
+	{
+		std::cerr << "    " << timestamp() << " temperatures";
+		for(const auto & t : temperatures)
+			std::cerr << " " << t;
+		std::cerr << "\n    exchange rates";
+		for(size_t i = 1; i < temperatures.size(); i++)
+			std::cerr << " " << double(swapAccepted[i]) / swapAttempts[i];
+		std::cerr << "\n";
+	}
+	return acceptanceRates;
+}
+
+
+void ParallelTempering::set_temperatures()
+{
+	for(size_t i = 0; i < replicas.size(); i++)
+		replicas[i]->set_temperature(temperatures[i + 1]);
+}
+
+
+void ParallelTempering::swap_states(std::vector<int> & accepted)
+// each pair of neighbouring chains, from the hottest down, exchanges its states with
+// probability min(1, exp((1 / T_(i-1) - 1 / T_i) * (L_i - L_(i-1)))) for the log 
+// likelihoods L; accepted[i] is 1 if chains i - 1 and i exchanged their states
+{
+	accepted.assign(temperatures.size(), 0);
+	for(size_t i = temperatures.size() - 1; i > 0; i--)
+	{
+		Replica & hot = *replicas[i - 1];
+		const double coldLL = (i == 1) ? currentLL : replicas[i - 2]->log_likelihood();
+		const double logRatio = (1 / temperatures[i - 1] - 1 / temperatures[i]) * 
+				(hot.log_likelihood() - coldLL);
+		swapAttempts[i]++;
+		// NaN is rejected
+		if(not (std::log(gsl_rng_uniform(rng.get())) < logRatio))
+			continue;
+		accepted[i] = 1;
+		swapAccepted[i]++;
+
+		const STM::ParVector hotValues (hot.values());
+		const double hotLL = hot.log_likelihood();
+		if(i == 1)
+		{
+			hot.set_state(parameters.values(), currentLL);
+			for(size_t j = 0; j < hotValues.size(); j++)
+				parameters.update(j, hotValues[j]);
+			currentLL = hotLL;
+		}
+		else
+		{
+			hot.set_state(replicas[i - 2]->values(), coldLL);
+			replicas[i - 2]->set_state(hotValues, hotLL);
+		}
+	}
+}
+
+
+void ParallelTempering::adapt_ladder(const std::vector<int> & accepted)
+// the spacing between T_(i-1) and T_i grows if that pair exchanges more often than the 
+// next one, so that all pairs come to exchange at the same rate (Vousden, Farr and Mandel
+// 2016); the spacings are then scaled to keep the highest temperature
+{
+	const size_t numChains = temperatures.size();
+	const double kappa = ladderT0 / (ladderLag * (numSwapRounds + ladderT0));
+	numSwapRounds++;
+	std::vector<double> gap (numChains, 0.0);
+	double sumGaps = 0;
+	for(size_t i = 1; i < numChains; i++)
+	{
+		gap[i] = temperatures[i] - temperatures[i - 1];
+		if(i + 1 < numChains)
+			gap[i] *= std::exp(kappa * (accepted[i] - accepted[i + 1]));
+		sumGaps += gap[i];
+	}
+	const double range = temperatures.back() - temperatures.front();
+	for(size_t i = 1; i + 1 < numChains; i++)
+		temperatures[i] = temperatures[i - 1] + gap[i] * range / sumGaps;
+	set_temperatures();
+}
+
+} // namespace
@@ -0,0 +1,159 @@
+/*
+	QUICC-FOR ST-Model MCMC
+	threadpool.cpp
+
+	  Copyright 2014 Matthew V Talluto, Isabelle Boulangeat, Dominique Gravel
+
+	  This program is free software; you can redistribute it and/or modify
+	  it under the terms of the GNU General Public License as published by
+	  the Free Software Foundation; either version 3 of the License, or (at
+	  your option) any later version.
+
+	  This program is distributed in the hope that it will be useful, but
+	  WITHOUT ANY WARRANTY; without even the implied warranty of
+	  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	  General Public License for more details.
+
+	  You should have received a copy of the GNU General Public License
+	  along with this program; if not, write to the Free Software
+	  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include "../hdr/threadpool.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+	// number of checks a waiting thread makes before going to sleep (or, for run(),
+	// between yields)
+	const unsigned int spinLimit = 4000;
+}
+
+namespace STMThreads {
+
+ThreadPool::ThreadPool(unsigned int numThreads, unsigned int firstCpu, 
+		unsigned int cpuStride) : numThreads(numThreads ? numThreads : 1),
+		currentJob(nullptr), generation(0), pending(0), stopping(false)
+{
+	for(unsigned int id = 1; id < this->numThreads; id++)
+	{
+		threads.push_back(std::thread(&ThreadPool::worker, this, id));
+		pin(threads.back(), firstCpu + id * cpuStride);
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+		generation++;
+	}
+	wake.notify_all();
+	for(auto & th : threads)
+		th.join();
+}
+
+
+void ThreadPool::run(const Job & job)
+{
+	if(threads.empty())
+	{
+		job(0);
+		return;
+	}
+
+	currentJob = &job;
+	jobError = nullptr;
+	pending.store(threads.size(), std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		generation.fetch_add(1, std::memory_order_release);
+	}
+	wake.notify_all();
+
+	execute(0);
+	for(unsigned int spin = 0; pending.load(std::memory_order_acquire) > 0; spin++)
+	{
+		if(spin >= spinLimit)
+			std::this_thread::yield();
+	}
+	currentJob = nullptr;
+	if(jobError)
+		std::rethrow_exception(jobError);
+}
+
+
+void ThreadPool::execute(unsigned int id)
+{
+	try
+	{
+		(*currentJob)(id);
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(not jobError)
+			jobError = std::current_exception();
+	}
+}
+
+
+void ThreadPool::worker(unsigned int id)
+{
+	unsigned long seen = 0;
+	while(true)
+	{
+		// spin for a short time in case the next job comes soon, then sleep
+		unsigned int spin = 0;
+		while(generation.load(std::memory_order_acquire) == seen and spin < spinLimit)
+			spin++;
+		if(generation.load(std::memory_order_acquire) == seen)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			wake.wait(lock, [&]{ return generation.load(std::memory_order_acquire) != seen; });
+		}
+		seen = generation.load(std::memory_order_acquire);
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if(stopping)
+				return;
+		}
+		execute(id);
+		pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+
+void ThreadPool::pin(std::thread & th, unsigned int cpu)
+// pins th to the cpu-th CPU that the process is allowed to run on
+{
+#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return;
+	unsigned int numAllowed = CPU_COUNT(&allowed);
+	if(numAllowed < 2)
+		return;
+	unsigned int target = cpu % numAllowed;
+	for(int c = 0; c < CPU_SETSIZE; c++)
+	{
+		if(CPU_ISSET(c, &allowed) and target-- == 0)
+		{
+			cpu_set_t mask;
+			CPU_ZERO(&mask);
+			CPU_SET(c, &mask);
+			pthread_setaffinity_np(th.native_handle(), sizeof(mask), &mask);
+			return;
+		}
+	}
+#endif
+}
+
+} // !STMThreads namespace
@@ -20,106 +20,31 @@ STModel-MCMC : model_2s.cpp
 
 */
 
-#include "../../hdr/model.hpp"
-
-
-namespace STM
-{
-	enum class StateTypes: char
-	{
-		Absent = '0',
-		Present = '1'
-	};
-}
+#include "../../hdr/model_2s.hpp"
+#include "../../hdr/likelihood.hpp"
 
 namespace STMModel
 {
 
-// static variable and function definition
-STM::PrevalenceModelTypes STMTransition::prevalenceModel = STM::PrevalenceModelTypes::Empirical;
-void STMTransition::set_prevalence_model(const STM::PrevalenceModelTypes &pr)
-{ STMTransition::prevalenceModel = pr; }
-
-
-
-std::vector<char> State::state_names()
-{
-	std::vector<char> result = {'0','1'};
-	return result;
-}
-
-
-
-std::map<STM::StateTypes, std::map<STM::StateTypes, TransProbFunction> > STMTransition::transitionFunctions;
-
-/*
-	This function encodes the two state model
-	It stores function generators in the transitionFunctions object
-	This object is a 2-D map, so that transitionFunctions[STM::StateTypes::A][STM::StateTypes::B]
-	contains a function generator
-	
-	when called (with a parameter e giving the expected values, i.e., prevalence) from a 
-	transition object, it returns a function taking a parameter set p as a parameter
-	
-	this function returns the transition probability from STM::StateTypes::A to STM::StateTypes::B
-	given the parameters (p) and the prevalence (e)
-*/
-void STMTransition::setup_transition_functions()
-{
-	// shorten the names for this function
-	using S = STM::StateTypes;
-	std::map<STM::StateTypes, std::map<STM::StateTypes, TransProbFunction> > &tf = 
-			STMTransition::transitionFunctions;
-
-	// Colonizations
-	tf[S::Absent][S::Present] = [](STM::ParMap p, STM::StateMap e) 
-	{ return p["gamma"] * e[S::Present]; };
-
-	// Absences
-	tf[S::Absent][S::Absent] = [&tf](STM::ParMap p, STM::StateMap e) 
-	{ return 1.0 - tf[S::Absent][S::Present](p,e); };
-	
-	// Extinctions
-	tf[S::Present][S::Absent] = [](STM::ParMap p, STM::StateMap e) 
-	{ return p["epsilon"]; };
-
-	// Presences
-	tf[S::Present][S::Present] = [&tf](STM::ParMap p, STM::StateMap e) 
-	{ return 1.0 - tf[S::Present][S::Absent](p,e); };
-}
-
-
-
-void State::self_check()
-{
-	using S = STM::StateTypes;
-	if(theState != S::Absent and theState != S::Present)
-		invalid_state();
-}
-
-
-STM::ParMap STMTransition::generate_transform_rates(const STM::ParMap & p) const
-{
-	STM::ParMap annualLogitParams;
-	annualLogitParams["gamma"] = p.at("g0") + p.at("g1")*env1 + p.at("g2")*env2 + 
-			p.at("g3")*pow(env1,2) + p.at("g4")*pow(env2,2) + p.at("g5")*pow(env1,3) + 
-			p.at("g6")*pow(env2,3);
-	annualLogitParams["epsilon"] = p.at("e0") + p.at("e1")*env1 + p.at("e2")*env2 + 
-			p.at("e3")*pow(env1,2) + p.at("e4")*pow(env2,2) + p.at("e5")*pow(env1,3) + 
-			p.at("e6")*pow(env2,3);
-	
-	return annualLogitParams;
-}
+constexpr size_t TwoStateModel::numStates;
+constexpr size_t TwoStateModel::numRates;
 
 
-void STMTransition::compute_stm_prevalence(const STM::ParMap &rates)
+const ModelDescription & TwoStateModel::description()
 {
-	STM::ParValue prev = 1.0 - (rates.at("epsilon") / rates.at("gamma"));
-	if(prev < 0) prev = 0;
-	expected[STM::StateTypes::Present] = prev;
-	expected[STM::StateTypes::Absent] = 1.0 - prev;
+	// colonization depends only on gamma and extinction only on epsilon
+	static const ModelDescription desc = { 
+			"2state", 
+			{'0', '1'}, 
+			{ {"gamma", "g"}, {"epsilon", "e"} },
+			{ {gamma}, {epsilon} },
+			std::vector<bool> (numStates * numStates, true),
+			true };
+	return desc;
 }
 
+} // !namespace STMModel
 
 
-} // !namespace STMModel
\ No newline at end of file
+// the likelihood of the two state model is compiled here
+template class STMLikelihood::ModelLikelihood<STMModel::TwoStateModel>;
@@ -0,0 +1,89 @@
+#include "report.hpp"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+
+// checks the analytic gradient of the log likelihood (compute_log_likelihood_and_gradient)
+// against central finite differences at the initial values, for each type of prevalence 
+// and storage mode: the largest relative error over the parameters, the number of 
+// parameters within 1e-4, whether the value equals compute_log_likelihood exactly, and
+// the time of an evaluation with and without the gradient. Finite differences are only
+// as good as the likelihood is smooth: probabilities near 0 that are computed as 1 minus 
+// the others are steps of the rounding error, and with the analytical prevalence of the 
+// four state model the likelihood jumps where the equilibrium of a cell has states at 
+// the solver's noise level, so larger errors there do not come from the gradient
+// usage: gradient_check <model> <inits file> <transition file> [step] [threads]
+
+using STMLikelihood::Likelihood;
+using STMTest::time_per_call;
+
+
+int main(int argc, char ** argv)
+{
+	if(argc < 4)
+	{
+		std::cerr << "usage: gradient_check <model> <inits file> <transition file> " <<
+				"[step] [threads]\n";
+		return 1;
+	}
+	const STMTest::ReportData data (argv);
+	const double step = argc > 4 ? atof(argv[4]) : 1e-5;
+	const unsigned int numThreads = argc > 5 ? atoi(argv[5]) : 1;
+	STMParameters::STModelParameters inits (data.initValues);
+	const size_t numPars = inits.values().size();
+
+	std::cout << std::setprecision(3);
+	std::cout << data.model.name << ", " << data.transitions.size() << " transitions, " <<
+			"step " << step << "\n";
+	std::cout << "prevalence   storage   max rel error (parameter)   within 1e-4   same value   " <<
+			"ms/evaluation (value, value and gradient)\n";
+	int failures = 0;
+	for(int pm = 0; pm < 3; pm++)
+	{
+		if(not STMTest::has_prevalence(data.model, pm))
+			continue;
+		for(int single = 0; single < 2; single++)
+		{
+			std::unique_ptr<Likelihood> lik (data.likelihood(STM::PrevalenceModelTypes(pm),
+					numThreads, single));
+			STM::ParVector gradient;
+			const double value = lik->compute_log_likelihood_and_gradient(inits, gradient);
+			const double check = lik->compute_log_likelihood(inits);
+			const bool same = value == check or (std::isnan(value) and std::isnan(check));
+
+			double maxErr = 0;
+			size_t worstPar = 0, numClose = 0;
+			for(size_t i = 0; i < numPars; i++)
+			{
+				STMParameters::STModelParameters up (inits), down (inits);
+				const double h = step * std::max(1.0, std::fabs(inits.values()[i]));
+				up.update(i, inits.values()[i] + h);
+				down.update(i, inits.values()[i] - h);
+				const double fd = (lik->compute_log_likelihood(up) - 
+						lik->compute_log_likelihood(down)) / (2 * h);
+				const double err = std::fabs(gradient[i] - fd) / 
+						std::max(1.0, std::fabs(fd));
+				if(err < 1e-4)
+					numClose++;
+				if(not (err <= maxErr))
+				{
+					maxErr = err;
+					worstPar = i;
+				}
+			}
+			if(not same)
+				failures++;
+
+			const int reps = 5;
+			double tValue = time_per_call([&]{ lik->compute_log_likelihood(inits); }, reps);
+			double tGrad = time_per_call([&]{ 
+					lik->compute_log_likelihood_and_gradient(inits, gradient); }, reps);
+			std::cout << STMTest::prevalenceNames[pm] << "   " << (single ? "single" : "double") << "   " <<
+					maxErr << " (" << inits.names()[worstPar] << ")   " << numClose << "/" << 
+					numPars << "   " << 
+					(same ? "yes" : "no") << "   " << tValue << ", " << tGrad << "\n";
+		}
+	}
+	return failures;
+}
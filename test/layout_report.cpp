@@ -0,0 +1,73 @@
+#include "report.hpp"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+
+// throughput of the likelihood for each layout of the transition data: rows in file order
+// or along the space-filling curve (STMModel::RowOrder), each placed by the loading 
+// thread or by the worker that owns it (Likelihood::set_first_touch), for each type of
+// prevalence: the time of a full evaluation and of a proposal, the transitions evaluated
+// per second, and the log likelihood (which changes in the last digits with the order)
+// usage: layout_report <model> <inits file> <transition file> [threads] [repetitions]
+
+using STMLikelihood::Likelihood;
+using STMTest::time_per_call;
+
+
+int main(int argc, char ** argv)
+{
+	if(argc < 4)
+	{
+		std::cerr << "usage: layout_report <model> <inits file> <transition file> " <<
+				"[threads] [repetitions]\n";
+		return 1;
+	}
+	const STMTest::ReportData data (argv);
+	const unsigned int numThreads = argc > 4 ? atoi(argv[4]) : 1;
+	const int reps = argc > 5 ? atoi(argv[5]) : 10;
+	STMParameters::STModelParameters inits (data.initValues);
+	const size_t numPars = inits.values().size();
+	const size_t numTransitions = data.transitions.size();
+
+	std::cout << data.model.name << ", " << numTransitions << " transitions, " << numThreads << 
+			" threads\n";
+	std::cout << "prevalence   order   placement   ms/evaluation   ms/proposal   " <<
+			"million transitions/s   log likelihood\n";
+	for(int pm = 0; pm < 3; pm++)
+	{
+		if(not STMTest::has_prevalence(data.model, pm))
+			continue;
+		for(int order = 0; order < 2; order++)
+		{
+			for(int firstTouch = 0; firstTouch < 2; firstTouch++)
+			{
+				std::unique_ptr<Likelihood> lik (data.likelihood(
+						STM::PrevalenceModelTypes(pm), numThreads, false, 
+						STMModel::RowOrder(order)));
+				lik->set_first_touch(firstTouch);
+				const double ll = lik->compute_log_likelihood(inits);
+				const double tFull = time_per_call([&]{ 
+						lik->compute_log_likelihood(inits); }, reps);
+
+				// proposals of each parameter in turn, from the cached state
+				lik->reset_log_likelihood(inits);
+				size_t par = 0;
+				const double tProposal = time_per_call([&]{
+					STMParameters::STModelParameters p (inits);
+					p.update(par, inits.values()[par] + 0.01);
+					lik->propose_log_likelihood(p, par);
+					lik->reject_proposal();
+					par = (par + 1) % numPars;
+				}, reps * int(numPars));
+
+				std::cout << std::setprecision(3) << STMTest::prevalenceNames[pm] << "   " << 
+						(order ? "curve" : "file") << "   " << 
+						(firstTouch ? "workers" : "loader") << "   " << tFull << "   " << 
+						tProposal << "   " << numTransitions / tFull / 1e3 << "   " << 
+						std::setprecision(17) << ll << "\n";
+			}
+		}
+	}
+	return 0;
+}
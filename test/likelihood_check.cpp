@@ -0,0 +1,179 @@
+#include "report.hpp"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cmath>
+
+// checks the invariants that the samplers depend on, for each type of prevalence, with
+// and without exact intervals (-y): along a random walk of single-parameter proposals,
+// each accepted or rejected at random, the likelihood of every proposal and of the
+// cached state after each accept_proposal or reject_proposal must equal a fresh
+// compute_log_likelihood of the same parameters (to a relative 1e-12). With the
+// reproducible sums (-x, set_reproducible), a full evaluation and the cached state after
+// a walk of accepted proposals must be bit-identical for 1 to 8 threads. The likelihoods
+// of 32 parameter sets from one call of compute_log_likelihood must be bit-identical to
+// 32 separate calls. Prints the largest relative error of each, and returns the number
+// of checks that failed
+// usage: likelihood_check <model> <inits file> <transition file> [steps] [threads]
+
+using STMLikelihood::Likelihood;
+
+namespace {
+	const double tolerance = 1e-12;
+
+	const unsigned int threadCounts [] = {1, 2, 3, 5, 8};
+	const int numBatchSets = 32;
+
+	bool same(double a, double b) { return a == b or (std::isnan(a) and std::isnan(b)); }
+
+	// relative error of a against b; 0 if both are nan, infinite if only one is
+	double rel_error(double a, double b)
+	{
+		if(std::isnan(a) or std::isnan(b))
+			return (std::isnan(a) and std::isnan(b)) ? 0 : INFINITY;
+		return a == b ? 0 : std::fabs(a - b) / std::fabs(b);
+	}
+}
+
+
+int check_proposals(Likelihood & lik, STMParameters::STModelParameters params, int steps,
+		double & maxProposal, double & maxState)
+// the random walk of proposals; returns 1 if either error is above the tolerance
+{
+	std::mt19937 rng (3);
+	std::normal_distribution<double> jump (0.0, 0.05);
+	std::bernoulli_distribution accept (0.5);
+	const size_t numPars = params.values().size();
+	maxProposal = maxState = 0;
+	lik.reset_log_likelihood(params);
+	for(int step = 0; step < steps; step++)
+	{
+		const size_t par = rng() % numPars;
+		STMParameters::STModelParameters proposal (params);
+		proposal.update(par, params.values()[par] + jump(rng));
+		const double proposed = lik.propose_log_likelihood(proposal, par);
+		maxProposal = std::max(maxProposal, rel_error(proposed,
+				lik.compute_log_likelihood(proposal)));
+		if(accept(rng))
+		{
+			lik.accept_proposal();
+			params = proposal;
+		}
+		else
+			lik.reject_proposal();
+
+		// a proposal of the same value measures the cached state
+		const double cached = lik.propose_log_likelihood(params, par);
+		lik.reject_proposal();
+		maxState = std::max(maxState, rel_error(cached, lik.compute_log_likelihood(params)));
+	}
+	return (maxProposal > tolerance or maxState > tolerance);
+}
+
+
+double accepted_walk(Likelihood & lik, STMParameters::STModelParameters params, int steps)
+// the cached likelihood after a walk of accepted proposals
+{
+	std::mt19937 rng (5);
+	std::normal_distribution<double> jump (0.0, 0.05);
+	const size_t numPars = params.values().size();
+	double result = lik.reset_log_likelihood(params);
+	for(int step = 0; step < steps; step++)
+	{
+		const size_t par = rng() % numPars;
+		params.update(par, params.values()[par] + jump(rng));
+		result = lik.propose_log_likelihood(params, par);
+		lik.accept_proposal();
+	}
+	return result;
+}
+
+
+int check_threads(const STMTest::ReportData & data, STM::PrevalenceModelTypes prev,
+		bool exact, const STMParameters::STModelParameters & params, int steps)
+// returns 1 if any number of threads gives a different result than a single thread
+{
+	double full = 0, walk = 0;
+	for(const auto numThreads : threadCounts)
+	{
+		std::unique_ptr<Likelihood> lik (data.likelihood(prev, numThreads, false,
+				STMModel::RowOrder::Locality, exact));
+		lik->set_reproducible(true);
+		const double f = lik->compute_log_likelihood(params);
+		const double w = accepted_walk(*lik, params, steps);
+		if(numThreads == threadCounts[0])
+		{
+			full = f;
+			walk = w;
+		}
+		else if(not same(f, full) or not same(w, walk))
+			return 1;
+	}
+	return 0;
+}
+
+
+int check_batch(Likelihood & lik, const STMParameters::STModelParameters & params)
+// returns 1 if the batched likelihood of any set differs from its separate evaluation
+{
+	std::mt19937 rng (7);
+	std::normal_distribution<double> jump (0.0, 0.1);
+	std::vector<STMParameters::STModelParameters> sets;
+	for(int k = 0; k < numBatchSets; k++)
+	{
+		STMParameters::STModelParameters p (params);
+		for(size_t i = 0; i < p.values().size(); i++)
+			p.update(i, params.values()[i] + jump(rng));
+		sets.push_back(p);
+	}
+	const std::vector<double> batch = lik.compute_log_likelihood(sets);
+	for(int k = 0; k < numBatchSets; k++)
+		if(not same(batch[k], lik.compute_log_likelihood(sets[k])))
+			return 1;
+	return 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+	if(argc < 4)
+	{
+		std::cerr << "usage: likelihood_check <model> <inits file> <transition file> " <<
+				"[steps] [threads]\n";
+		return 1;
+	}
+	const STMTest::ReportData data (argv);
+	const int steps = argc > 4 ? atoi(argv[4]) : 400;
+	const unsigned int numThreads = argc > 5 ? atoi(argv[5]) : 1;
+	STMParameters::STModelParameters inits (data.initValues);
+
+	std::cout << std::setprecision(3);
+	std::cout << data.model.name << ", " << data.transitions.size() << " transitions, " <<
+			steps << " proposals, tolerance " << tolerance << "\n";
+	std::cout << "prevalence   intervals   max rel error (proposals, cached state)   " <<
+			"same for 1 to 8 threads (-x)   same in a batch\n";
+	int failures = 0;
+	for(int pm = 0; pm < 3; pm++)
+	{
+		if(not STMTest::has_prevalence(data.model, pm))
+			continue;
+		for(int exact = 0; exact < 2; exact++)
+		{
+			std::unique_ptr<Likelihood> lik (data.likelihood(STM::PrevalenceModelTypes(pm),
+					numThreads, false, STMModel::RowOrder::Locality, exact));
+			double maxProposal, maxState;
+			const int failed = check_proposals(*lik, inits, steps, maxProposal, maxState);
+			const int threadsFailed = check_threads(data, STM::PrevalenceModelTypes(pm),
+					exact, inits, steps);
+			const int batchFailed = check_batch(*lik, inits);
+			failures += failed + threadsFailed + batchFailed;
+			std::cout << STMTest::prevalenceNames[pm] << "   " <<
+					(exact ? "exact" : "scaled") << "   " << maxProposal << ", " <<
+					maxState << (failed ? " FAILED" : "") << "   " << 
+					(threadsFailed ? "no FAILED" : "yes") << "   " << 
+					(batchFailed ? "no FAILED" : "yes") << "\n";
+		}
+	}
+	return failures;
+}
@@ -0,0 +1,234 @@
+#include "../hdr/model_4s.hpp"
+#include "report.hpp"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cmath>
+
+// compares the closed-form 4-state transition probabilities with the previous
+// formulation, in which each probability called the functions of the others
+// (e.g., M -> M = 1 - M_T - M_B - to_R); prints the time per transition and the largest
+// difference between the two for each type of transition, and for all 16 probabilities
+// (transition_matrices, used by the exact intervals). Then the same for the derivatives
+// of all 16 (transition_matrix_gradients, used by the gradient of the equilibrium)
+// against one pass of transition_gradient per type
+
+using STM::ParValue;
+using Model = STMModel::FourStateModel;
+using STMTest::time_per_call;
+
+namespace ref {
+	const size_t T = Model::T, B = Model::B, M = Model::M, R = Model::R;
+
+	inline ParValue to_R(const ParValue *p, const ParValue *e)
+	{ return p[Model::epsilon]; }
+	inline ParValue T_M(const ParValue *p, const ParValue *e)
+	{ return p[Model::beta_b] * (e[B] + e[M]) * (1.0 - to_R(p, e)); }
+	inline ParValue T_T(const ParValue *p, const ParValue *e)
+	{ return 1.0 - to_R(p, e) - T_M(p, e); }
+	inline ParValue B_M(const ParValue *p, const ParValue *e)
+	{ return p[Model::beta_t] * (e[T] + e[M]) * (1.0 - to_R(p, e)); }
+	inline ParValue B_B(const ParValue *p, const ParValue *e)
+	{ return 1.0 - to_R(p, e) - B_M(p, e); }
+	inline ParValue M_T(const ParValue *p, const ParValue *e)
+	{ return p[Model::theta] * p[Model::theta_t] * (1.0 - to_R(p, e)); }
+	inline ParValue M_B(const ParValue *p, const ParValue *e)
+	{ return p[Model::theta] * (1 - p[Model::theta_t]) * (1.0 - to_R(p, e)); }
+	inline ParValue M_M(const ParValue *p, const ParValue *e)
+	{ return 1.0 - M_T(p, e) - M_B(p, e) - to_R(p, e); }
+	inline ParValue R_T(const ParValue *p, const ParValue *e)
+	{ return p[Model::alpha_t] * (e[M] + e[T]) * (1 - p[Model::alpha_b]*(e[B]+e[M])); }
+	inline ParValue R_B(const ParValue *p, const ParValue *e)
+	{ return p[Model::alpha_b] * (e[M] + e[B]) * (1 - p[Model::alpha_t]*(e[T]+e[M])); }
+	inline ParValue R_M(const ParValue *p, const ParValue *e)
+	{ return p[Model::alpha_b] * (e[M] + e[B]) * (p[Model::alpha_t] * (e[M] + e[T])); }
+	inline ParValue R_R(const ParValue *p, const ParValue *e)
+	{ return 1.0 - R_T(p, e) - R_B(p, e) - R_M(p, e); }
+
+	typedef ParValue (*Fn)(const ParValue *, const ParValue *);
+	const Fn matrix [16] = { T_T, nullptr, T_M, to_R, nullptr, B_B, B_M, to_R,
+			M_T, M_B, M_M, to_R, R_T, R_B, R_M, R_R };
+
+	template<Fn F>
+	void run(size_t n, const ParValue * const * rates, const ParValue * prev, ParValue * prob)
+	{ STMModel::evaluate_transitions<F, Model::numRates, Model::numStates>(n, rates, prev, prob); }
+
+	void transition_probs(size_t type, size_t n, const ParValue * const * rates,
+			const ParValue * prev, ParValue * prob)
+	{
+		switch(type)
+		{
+			case 0: run<T_T>(n, rates, prev, prob); break;
+			case 2: run<T_M>(n, rates, prev, prob); break;
+			case 3: case 7: case 11: run<to_R>(n, rates, prev, prob); break;
+			case 5: run<B_B>(n, rates, prev, prob); break;
+			case 6: run<B_M>(n, rates, prev, prob); break;
+			case 8: run<M_T>(n, rates, prev, prob); break;
+			case 9: run<M_B>(n, rates, prev, prob); break;
+			case 10: run<M_M>(n, rates, prev, prob); break;
+			case 12: run<R_T>(n, rates, prev, prob); break;
+			case 13: run<R_B>(n, rates, prev, prob); break;
+			case 14: run<R_M>(n, rates, prev, prob); break;
+			case 15: run<R_R>(n, rates, prev, prob); break;
+		}
+	}
+}
+
+
+void gradients_by_type(size_t n, const ParValue * const * rates, const ParValue * prev,
+		ParValue * prob, ParValue * dRate, ParValue * dPrev)
+// transition_matrix_gradients from one pass of transition_gradient per type, as 
+// STMModel::matrix_gradients_by_type
+{
+	const size_t NR = Model::numRates, NS = Model::numStates, NM = NS * NS;
+	ParValue typeProb [STMModel::chunkSize], typeRate [NR][STMModel::chunkSize], 
+			typePrev [NS][STMModel::chunkSize];
+	ParValue * rateCols [NR], * prevCols [NS];
+	for(size_t r = 0; r < NR; r++)
+		rateCols[r] = typeRate[r];
+	for(size_t s = 0; s < NS; s++)
+		prevCols[s] = typePrev[s];
+	std::fill(prob, prob + n * NM, 0.0);
+	std::fill(dRate, dRate + n * NM * NR, 0.0);
+	std::fill(dPrev, dPrev + n * NM * NS, 0.0);
+	for(size_t type = 0; type < NM; type++)
+	{
+		if(not ref::matrix[type])
+			continue;
+		Model::transition_gradient(type, n, rates, prev, typeProb, rateCols, prevCols);
+		for(size_t j = 0; j < n; j++)
+		{
+			prob[j * NM + type] = typeProb[j];
+			for(size_t r = 0; r < NR; r++)
+				dRate[(j * NM + type) * NR + r] = typeRate[r][j];
+			for(size_t s = 0; s < NS; s++)
+				dPrev[(j * NM + type) * NS + s] = typePrev[s][j];
+		}
+	}
+}
+
+
+int main(void)
+{
+	// small enough to stay in cache, as the likelihood's chunks do
+	const size_t n = 4096;
+	const int reps = 4000;
+	const size_t NR = Model::numRates, NS = Model::numStates;
+	const char * stateNames = "TBMR";
+
+	std::mt19937 rng (12345);
+	std::uniform_real_distribution<double> unif (0.0, 1.0);
+	std::vector<std::vector<ParValue> > rateCols (NR, std::vector<ParValue> (n));
+	std::vector<ParValue> prev (n * NS), probRef (n), probNew (n);
+	for(auto & col : rateCols)
+		for(auto & v : col)
+			v = unif(rng);
+	for(size_t j = 0; j < n; j++)
+	{
+		double tot = 0;
+		for(size_t s = 0; s < NS; s++)
+			tot += (prev[j * NS + s] = unif(rng));
+		for(size_t s = 0; s < NS; s++)
+			prev[j * NS + s] /= tot;
+	}
+	const ParValue * rates [NR];
+	for(size_t r = 0; r < NR; r++)
+		rates[r] = rateCols[r].data();
+
+	std::cout << std::setprecision(3);
+	std::cout << "type   previous (ns)   closed form (ns)   max abs difference\n";
+	double totRef = 0, totNew = 0;
+	for(size_t type = 0; type < NS * NS; type++)
+	{
+		if(not ref::matrix[type])
+			continue;
+		double tRef = time_per_call<std::nano>([&]{ ref::transition_probs(type, n, rates,
+				prev.data(), probRef.data()); }, reps) / n;
+		double tNew = time_per_call<std::nano>([&]{ Model::transition_probs(type, n, rates,
+				prev.data(), probNew.data()); }, reps) / n;
+		double maxDiff = 0;
+		for(size_t j = 0; j < n; j++)
+			maxDiff = std::max(maxDiff, std::fabs(probRef[j] - probNew[j]));
+		std::cout << stateNames[type / NS] << " -> " << stateNames[type % NS] << "   " << tRef <<
+				"   " << tNew << "   " << maxDiff << "\n";
+		totRef += tRef;
+		totNew += tNew;
+	}
+	std::cout << "all types   " << totRef << "   " << totNew << "   speedup " <<
+			totRef / totNew << "\n";
+
+	// all 16 probabilities of each transition, by chunks as in the likelihood
+	const size_t NM = NS * NS, chunk = STMModel::chunkSize;
+	std::vector<ParValue> matRef (n * NM), matNew (n * NM);
+	auto chunk_rates = [&](size_t first, const ParValue ** cols)
+			{ for(size_t r = 0; r < NR; r++) cols[r] = rates[r] + first; };
+	double tRef = time_per_call<std::nano>([&]{
+		for(size_t j = 0; j < n; j++)
+		{
+			ParValue p [NR];
+			for(size_t r = 0; r < NR; r++)
+				p[r] = rates[r][j];
+			for(size_t t = 0; t < NM; t++)
+				matRef[j * NM + t] = ref::matrix[t] ? ref::matrix[t](p, &prev[j * NS]) : 0;
+		}
+	}, reps / 10) / n;
+	double tNew = time_per_call<std::nano>([&]{
+		for(size_t first = 0; first < n; first += chunk)
+		{
+			const ParValue * cols [NR];
+			chunk_rates(first, cols);
+			Model::transition_matrices(chunk, cols, &prev[first * NS], &matNew[first * NM]);
+		}
+	}, reps / 10) / n;
+	double maxDiff = 0, maxRowErr = 0;
+	for(size_t j = 0; j < n; j++)
+	{
+		for(size_t s = 0; s < NS; s++)
+		{
+			double rowSum = 0;
+			for(size_t f = 0; f < NS; f++)
+			{
+				size_t k = j * NS * NS + s * NS + f;
+				maxDiff = std::max(maxDiff, std::fabs(matRef[k] - matNew[k]));
+				rowSum += matNew[k];
+			}
+			maxRowErr = std::max(maxRowErr, std::fabs(rowSum - 1.0));
+		}
+	}
+	std::cout << "matrix   " << tRef << "   " << tNew << "   " << maxDiff <<
+			"   speedup " << tRef / tNew << "   max |row sum - 1| " << maxRowErr << "\n";
+
+	// their derivatives
+	std::vector<ParValue> probByType (n * NM), dRateByType (n * NM * NR), 
+			dPrevByType (n * NM * NS), dRateNew (n * NM * NR), dPrevNew (n * NM * NS);
+	tRef = time_per_call<std::nano>([&]{
+		for(size_t first = 0; first < n; first += chunk)
+		{
+			const ParValue * cols [NR];
+			chunk_rates(first, cols);
+			gradients_by_type(chunk, cols, &prev[first * NS], &probByType[first * NM], 
+					&dRateByType[first * NM * NR], &dPrevByType[first * NM * NS]);
+		}
+	}, reps / 10) / n;
+	tNew = time_per_call<std::nano>([&]{
+		for(size_t first = 0; first < n; first += chunk)
+		{
+			const ParValue * cols [NR];
+			chunk_rates(first, cols);
+			Model::transition_matrix_gradients(chunk, cols, &prev[first * NS], 
+					&matNew[first * NM], &dRateNew[first * NM * NR], 
+					&dPrevNew[first * NM * NS]);
+		}
+	}, reps / 10) / n;
+	maxDiff = 0;
+	for(size_t k = 0; k < n * NM; k++)
+		maxDiff = std::max(maxDiff, std::fabs(probByType[k] - matNew[k]));
+	for(size_t k = 0; k < n * NM * NR; k++)
+		maxDiff = std::max(maxDiff, std::fabs(dRateByType[k] - dRateNew[k]));
+	for(size_t k = 0; k < n * NM * NS; k++)
+		maxDiff = std::max(maxDiff, std::fabs(dPrevByType[k] - dPrevNew[k]));
+	std::cout << "matrix gradient   " << tRef << "   " << tNew << "   " << maxDiff <<
+			"   speedup " << tRef / tNew << "\n";
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include "report.hpp"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cmath>
+
+// validation report of the single-precision transition storage (-f): for each type of
+// prevalence, compares the log likelihood with the double-precision table at the initial
+// values and at random parameters around them, for full evaluations and for single-
+// parameter proposals, and prints the time per evaluation of each storage mode
+// usage: precision_report <model> <inits file> <transition file> [draws] [threads]
+
+using STMLikelihood::Likelihood;
+using STMTest::time_per_call;
+
+// the larger of the two errors, or nan if either is
+double worst(double a, double b) { return (std::isnan(b) or b > a) ? b : a; }
+
+
+int main(int argc, char ** argv)
+{
+	if(argc < 4)
+	{
+		std::cerr << "usage: precision_report <model> <inits file> <transition file> " <<
+				"[draws] [threads]\n";
+		return 1;
+	}
+	const STMTest::ReportData data (argv);
+	const int numDraws = argc > 4 ? atoi(argv[4]) : 20;
+	const unsigned int numThreads = argc > 5 ? atoi(argv[5]) : 1;
+	STMParameters::STModelParameters inits (data.initValues);
+	const size_t numPars = inits.values().size();
+
+	std::mt19937 rng (12345);
+	std::normal_distribution<double> jump (0.0, 0.1);
+	std::vector<STMParameters::STModelParameters> draws (1, inits);
+	for(int d = 1; d < numDraws; d++)
+	{
+		STMParameters::STModelParameters p (inits);
+		for(size_t i = 0; i < numPars; i++)
+			p.update(i, inits.values()[i] + jump(rng));
+		draws.push_back(p);
+	}
+
+	std::cout << std::setprecision(3);
+	std::cout << data.model.name << ", " << data.transitions.size() << " transitions, " <<
+			draws.size() << " parameter sets\n";
+	std::cout << "prevalence   bytes/transition (double, single)   max abs error   " <<
+			"max rel error   max rel error (proposals)   ms/evaluation (double, single)\n";
+	for(int pm = 0; pm < 3; pm++)
+	{
+		if(not STMTest::has_prevalence(data.model, pm))
+			continue;
+		auto prevModel = STM::PrevalenceModelTypes(pm);
+		std::unique_ptr<Likelihood> lDouble (data.likelihood(prevModel, numThreads, false));
+		std::unique_ptr<Likelihood> lSingle (data.likelihood(prevModel, numThreads, true));
+
+		double maxAbs = 0, maxRel = 0, maxRelProposal = 0;
+		std::vector<double> llDouble = lDouble->compute_log_likelihood(draws);
+		std::vector<double> llSingle = lSingle->compute_log_likelihood(draws);
+		for(size_t d = 0; d < draws.size(); d++)
+		{
+			const double err = std::fabs(llSingle[d] - llDouble[d]);
+			maxAbs = worst(maxAbs, err);
+			maxRel = worst(maxRel, err / std::fabs(llDouble[d]));
+		}
+
+		// proposals change one parameter of the initial values at a time
+		lDouble->reset_log_likelihood(inits);
+		lSingle->reset_log_likelihood(inits);
+		for(size_t i = 0; i < numPars; i++)
+		{
+			STMParameters::STModelParameters p (inits);
+			p.update(i, inits.values()[i] + jump(rng));
+			const double ld = lDouble->propose_log_likelihood(p, i);
+			const double ls = lSingle->propose_log_likelihood(p, i);
+			lDouble->reject_proposal();
+			lSingle->reject_proposal();
+			maxRelProposal = worst(maxRelProposal, std::fabs(ls - ld) / std::fabs(ld));
+		}
+
+		const int reps = 10;
+		double tDouble = time_per_call([&]{ lDouble->compute_log_likelihood(inits); }, reps);
+		double tSingle = time_per_call([&]{ lSingle->compute_log_likelihood(inits); }, reps);
+		std::cout << STMTest::prevalenceNames[pm] << "   " <<
+				STMModel::TransitionTable(data.transitions, data.model, prevModel,
+				STMModel::CovariateBasis(), false).bytes_per_transition() << ", " <<
+				STMModel::TransitionTable(data.transitions, data.model, prevModel,
+				STMModel::CovariateBasis(), true).bytes_per_transition() << "   " <<
+				maxAbs << "   " << maxRel << "   " << maxRelProposal << "   " << tDouble <<
+				", " << tSingle << "\n";
+	}
+	return 0;
+}
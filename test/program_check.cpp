@@ -0,0 +1,100 @@
+#include "../hdr/model_program.hpp"
+#include "../hdr/model_2s.hpp"
+#include "../hdr/model_4s.hpp"
+#include "report.hpp"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cmath>
+
+// compares the models read from models/2state.stm and models/4state.stm with the built-in
+// models: for each type of transition, the largest difference in probability and the time
+// per transition of each; then the largest difference in the analytical prevalence and the
+// time per cell of each, at random rates. Returns the number of differences above the
+// tolerance
+// usage: program_check [model directory]
+
+using STM::ParValue;
+using STMTest::time_per_call;
+
+namespace {
+	// largest difference from the built-in models, in probability and in prevalence; the
+	// prevalence is less precise than the solver's residual near a double root (e.g.,
+	// gamma = epsilon in the two state model, where the built-in solution is analytical)
+	const double probTolerance = 1e-14, eqTolerance = 1e-8;
+}
+
+template<class Model>
+int compare(const std::string & fileName)
+{
+	const size_t n = 4096, NS = Model::numStates, NR = Model::numRates;
+	STMModel::ProgramModel program (fileName);
+	std::mt19937 rng (20141201);
+	std::uniform_real_distribution<double> unif (0, 1);
+
+	std::vector<std::vector<ParValue> > rateValues (NR, std::vector<ParValue> (n));
+	const ParValue * rates [STMModel::maxRates];
+	for(size_t r = 0; r < NR; r++)
+	{
+		for(auto & v : rateValues[r])
+			v = unif(rng);
+		rates[r] = rateValues[r].data();
+	}
+	std::vector<ParValue> prevalence (n * NS);
+	for(size_t j = 0; j < n; j++)
+	{
+		double sum = 0;
+		for(size_t s = 0; s < NS; s++)
+			sum += (prevalence[j * NS + s] = unif(rng));
+		for(size_t s = 0; s < NS; s++)
+			prevalence[j * NS + s] /= sum;
+	}
+
+	int failures = 0;
+	std::cout << fileName << "\ntype   max difference   ns/transition (built-in, file)\n";
+	std::vector<ParValue> builtIn (n), fromFile (n);
+	for(size_t type = 0; type < NS * NS; type++)
+	{
+		if(not program.description().validTransitions[type])
+			continue;
+		const double tBuiltIn = time_per_call<std::nano>([&]{ Model::transition_probs(type,
+				n, rates, prevalence.data(), builtIn.data()); }, 200) / n;
+		const double tFile = time_per_call<std::nano>([&]{ program.transition_probs(type,
+				n, rates, prevalence.data(), fromFile.data()); }, 200) / n;
+		double maxDiff = 0;
+		for(size_t j = 0; j < n; j++)
+			maxDiff = std::max(maxDiff, std::fabs(builtIn[j] - fromFile[j]));
+		const std::vector<char> & states = program.description().stateNames;
+		failures += maxDiff > probTolerance;
+		std::cout << states[type / NS] << " -> " << states[type % NS] << "   " << maxDiff <<
+				(maxDiff > probTolerance ? " FAILED" : "") << "   " << tBuiltIn << ", " <<
+				tFile << "\n";
+	}
+
+	if(program.description().hasSTMPrevalence)
+	{
+		std::vector<ParValue> eqBuiltIn (n * NS), eqFile (n * NS);
+		const double tBuiltIn = time_per_call<std::nano>([&]{ Model::equilibrium(n, rates,
+				eqBuiltIn.data(), false); }, 5) / n;
+		const double tFile = time_per_call<std::nano>([&]{ program.equilibrium(n, rates,
+				eqFile.data(), false); }, 5) / n;
+		double maxDiff = 0;
+		for(size_t i = 0; i < n * NS; i++)
+			maxDiff = std::max(maxDiff, std::fabs(eqBuiltIn[i] - eqFile[i]));
+		failures += maxDiff > eqTolerance;
+		std::cout << "equilibrium   " << maxDiff << (maxDiff > eqTolerance ? " FAILED" : "") <<
+				"   ns/cell " << tBuiltIn << ", " << tFile << "\n";
+	}
+	std::cout << "\n";
+	return failures;
+}
+
+
+int main(int argc, char ** argv)
+{
+	const std::string dir = argc > 1 ? argv[1] : "models";
+	std::cout << std::setprecision(3);
+	return compare<STMModel::TwoStateModel>(dir + "/2state.stm") +
+			compare<STMModel::FourStateModel>(dir + "/4state.stm");
+}
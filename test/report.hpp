@@ -0,0 +1,77 @@
+#ifndef STM_TEST_REPORT_H
+#define STM_TEST_REPORT_H
+
+#include "../hdr/models.hpp"
+#include "../hdr/likelihood.hpp"
+#include "../hdr/input.hpp"
+#include "../hdr/parameters.hpp"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+
+// shared by the report and check programs in test/: timing, and the data that most of
+// them read from <model> <inits file> <transition file> on the command line
+
+namespace STMTest {
+
+// the mean time of f over reps calls, in Unit (milliseconds by default)
+template<typename Unit = std::milli, typename F>
+double time_per_call(F f, int reps)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	for(int i = 0; i < reps; i++)
+		f();
+	auto t1 = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, Unit>(t1 - t0).count() / reps;
+}
+
+
+const char * const prevalenceNames [] = {"empirical", "analytical", "global"};
+
+// the types of prevalence that model supports
+inline bool has_prevalence(const STMModel::ModelDescription & model, int pm)
+{ return STM::PrevalenceModelTypes(pm) != STM::PrevalenceModelTypes::STM or
+		model.hasSTMPrevalence; }
+
+
+/*
+	The model, the parameters and the transitions given by argv[1] to argv[3];
+	likelihood() builds the likelihood of the model on the transitions, with the priors
+	of the parameter file and the given settings
+*/
+struct ReportData
+{
+	ReportData(char ** argv) :
+			model(STMModel::find_model(argv[1])), transFileName(argv[3])
+	{
+		STMInput::STMInputHelper parInput (argv[2], STMInput::InputType::parameters);
+		STMInput::STMInputHelper transInput (argv[3], STMInput::InputType::transitions,
+				model);
+		initValues = parInput.parameter_inits();
+		priors = parInput.priors();
+		transitions = transInput.transitions();
+	}
+
+	std::unique_ptr<STMLikelihood::Likelihood> likelihood(STM::PrevalenceModelTypes prev,
+			unsigned int numThreads, bool singlePrecision = false,
+			STMModel::RowOrder order = STMModel::RowOrder::Locality,
+			bool exactIntervals = false) const
+	{
+		return std::unique_ptr<STMLikelihood::Likelihood> (STMLikelihood::make_likelihood(
+				model, transitions, transFileName, priors,
+				numThreads, 1, prev, STMModel::CovariateBasis(), singlePrecision, order,
+				exactIntervals));
+	}
+
+	const STMModel::ModelDescription & model;
+	std::string transFileName;
+	std::vector<STMParameters::ParameterSettings> initValues;
+	std::map<std::string, STMLikelihood::PriorDist> priors;
+	std::vector<STMModel::STMTransition> transitions;
+};
+
+} // namespace
+
+#endif
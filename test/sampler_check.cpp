@@ -0,0 +1,129 @@
+#include "report.hpp"
+#include "../hdr/engine.hpp"
+#include "../hdr/output.hpp"
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+// runs the adaptive Metropolis sampler (-j adaptive) for each type of prevalence, with a
+// burnin long enough for the block proposals to be used (blocks are ready once their
+// covariance is, which needs accepted moves), and checks that the run completes, that
+// each block holds the coefficients of a single rate, one block per rate with active 
+// coefficients, and that the likelihood of the chain equals a fresh compute_log_likelihood of its final
+// state (to a relative 1e-12). Meant for model files (e.g., models/2state.stm), whose
+// blocks come from the rates that the file declares. Returns the number of checks that 
+// failed
+// usage: sampler_check <model> <inits file> <transition file> [samples] [threads]
+
+using STMLikelihood::Likelihood;
+
+namespace {
+	const double tolerance = 1e-12;
+	const int burnin = 1000;
+}
+
+
+class AdaptiveCheck : public STMEngine::Metropolis
+// exposes the blocks and the chain's state of the adaptive sampler
+{
+	public:
+	AdaptiveCheck(const std::vector<STMParameters::ParameterSettings> & inits,
+			STMOutput::OutputQueue * const queue, Likelihood * const lik) :
+			Metropolis(inits, queue, lik, STMEngine::EngineOutputLevel::Quiet,
+			STMOutput::OutputOptions(), 1, burnin, false, true, 11,
+			STMEngine::SamplerType::AdaptiveMetropolis) {}
+
+	size_t num_blocks() const { return blocks.size(); }
+	size_t num_ready() const
+	{
+		size_t n = 0;
+		for(const auto & block : blocks)
+			n += block.ready();
+		return n;
+	}
+
+	// the number of blocks with parameters of more than one rate (or of none), and the
+	// number of rates with active coefficients
+	size_t mixed_blocks(size_t & numRates)
+	{
+		std::vector<bool> hasActive (likelihood->model_description().rates.size(), false);
+		for(const auto & par : parameters.active_names())
+		{
+			size_t rate;
+			if(likelihood->parameter_rate(parameters, parameters.index(par), rate))
+				hasActive.at(rate) = true;
+		}
+		numRates = std::count(hasActive.begin(), hasActive.end(), true);
+
+		size_t mixed = 0;
+		for(const auto & block : blocks)
+		{
+			size_t first, rate;
+			bool same = likelihood->parameter_rate(parameters, block.index()[0], first);
+			for(const auto & par : block.index())
+				same = same and likelihood->parameter_rate(parameters, par, rate) and
+						rate == first;
+			mixed += not same;
+		}
+		return mixed;
+	}
+
+	// relative error of the chain's likelihood
+	double state_error()
+	{
+		const double full = likelihood->compute_log_likelihood(parameters);
+		return currentLL == full ? 0 : std::fabs(currentLL - full) / std::fabs(full);
+	}
+};
+
+
+int main(int argc, char ** argv)
+{
+	if(argc < 4)
+	{
+		std::cerr << "usage: sampler_check <model> <inits file> <transition file> " <<
+				"[samples] [threads]\n";
+		return 1;
+	}
+	const STMTest::ReportData data (argv);
+	const int samples = argc > 4 ? atoi(argv[4]) : 500;
+	const unsigned int numThreads = argc > 5 ? atoi(argv[5]) : 1;
+
+	std::cout << std::setprecision(3);
+	std::cout << data.model.name << ", " << data.transitions.size() << " transitions, " <<
+			burnin << " burnin and " << samples << " samples, tolerance " << tolerance << "\n";
+	std::cout << "prevalence   blocks (ready, rates)   mixed blocks   " <<
+			"rel error of the chain's likelihood\n";
+	int failures = 0;
+	for(int pm = 0; pm < 3; pm++)
+	{
+		if(not STMTest::has_prevalence(data.model, pm))
+			continue;
+		std::unique_ptr<Likelihood> lik (data.likelihood(STM::PrevalenceModelTypes(pm),
+				numThreads));
+		STMOutput::OutputQueue queue;
+		std::cout << STMTest::prevalenceNames[pm] << "   ";
+		try
+		{
+			AdaptiveCheck engine (data.initValues, &queue, lik.get());
+			engine.run_sampler(samples);
+			size_t numRates;
+			const size_t mixed = engine.mixed_blocks(numRates);
+			const double error = engine.state_error();
+			const bool failed = mixed > 0 or engine.num_blocks() != numRates or
+					not (error <= tolerance);
+			failures += failed;
+			std::cout << engine.num_blocks() << " (" << engine.num_ready() << ", " <<
+					numRates << ")   " << mixed << "   " << error <<
+					(failed ? " FAILED" : "") << "\n";
+		}
+		catch(const std::runtime_error & e)
+		{
+			failures++;
+			std::cout << "FAILED: " << e.what() << "\n";
+		}
+	}
+	return failures;
+}